@@ -3,10 +3,14 @@
 
 #include "common.h"
 
+#define NM_MAX_IN_FLIGHT 32  // Outstanding pipelined requests per connection
+#define COMPLETION_PAGE_SIZE 100  // Filenames fetched per tab completion
+
 typedef struct {
     char username[MAX_USERNAME];
     int nm_socket;
     int connected;
+    uint32_t next_request_id;
 } ClientState;
 
 extern ClientState client_state;
@@ -25,7 +29,7 @@ void cmd_delete(const char* filename);
 void cmd_view(const char* flags);
 void cmd_info(const char* filename);
 void cmd_stream(const char* filename);
-void cmd_list();
+void cmd_list(const char* args);
 void cmd_undo(const char* filename);
 void cmd_addaccess(const char* args);
 void cmd_remaccess(const char* args);
@@ -35,9 +39,20 @@ void cmd_checkpoint(const char* args);
 void cmd_listcheckpoints(const char* filename);
 void cmd_revert(const char* args);
 void cmd_requestaccess(const char* args);
+void cmd_multi(const char* script);
+void cmd_search(const char* args);
+void cmd_move(const char* args);
+void cmd_viewfolder(const char* args);
+
+// Name Server requests (tagged with request IDs so several can be in flight)
+uint32_t nm_send_request(Message* msg);
+int nm_wait_response(uint32_t request_id, Message* resp);
+int nm_pipeline(Message* msgs, Message* resps, int count);
+int nm_search(const char* prefix, const char* after, int page_size, Message* resp);
 
 // Helper functions
 int contact_storage_server(const char* ss_info, Message* msg, Message* resp);
 void parse_ss_info(const char* data, char* ip, int* port, char* replica_ip, int* replica_port);
+void apply_storage_key(const char* ss_info, Message* msg);
 
 #endif
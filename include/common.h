@@ -42,6 +42,7 @@
 #define MSG_WRITE_LOCK "WRITE_LOCK"
 #define MSG_WRITE_UPDATE "WRITE_UPDATE"
 #define MSG_WRITE_COMMIT "ETIRW"
+#define MSG_WRITE_UNLOCK "WRITE_UNLOCK"
 #define MSG_DELETE "DELETE"
 #define MSG_VIEW "VIEW"
 #define MSG_INFO "INFO"
@@ -65,6 +66,103 @@
 #define MSG_REPLICATE "REPLICATE"
 #define MSG_HEARTBEAT "HEARTBEAT"
 #define MSG_GET_SS_INFO "GET_SS_INFO"
+#define MSG_STREAM_WORD "STREAM_WORD"
+#define MSG_STREAM_END "STREAM_END"
+#define MSG_MULTI "MULTI"
+#define MSG_VIEW_PAGE "VIEW_PAGE"
+#define MSG_SEARCH "SEARCH"
+
+// MULTI batches: one "TYPE|filename|data" line per sub-operation in data,
+// answered with one "index|error_code|data-or-error" line per item
+#define MULTI_MAX_OPS 128
+
+// VIEW: data holds the flags plus optional "-n page_size" and "-p max_pages";
+// filename holds the resume cursor (empty to start from the beginning).
+// Every page but the last is sent as a VIEW_PAGE frame; the final VIEW frame
+// carries the cursor to resume from in filename, empty once the listing ends
+#define VIEW_DEFAULT_PAGE_SIZE 1000
+#define VIEW_MAX_PAGE_SIZE 10000
+
+// SEARCH: data holds the filename prefix, optionally after "-n page_size ";
+// filename holds the resume key. One page of readable files per reply, one
+// name per line in sorted order; the reply's filename is the key to resume
+// from, empty once no more files match
+#define SEARCH_DEFAULT_PAGE_SIZE 100
+#define SEARCH_MAX_PAGE_SIZE 1000
+#define SEARCH_MAX_SCAN 10000     // Candidates checked per reply before handing back a resume key
+
+// VIEWFOLDER: data holds the folder (empty for the top level), optionally
+// after "-n page_size "; filename holds the resume key. One page of the
+// children the user can read per reply, one base name per line in sorted
+// order, folders marked with a trailing '/'; the reply's filename is the
+// key to resume from, empty on the last page
+#define VIEWFOLDER_DEFAULT_PAGE_SIZE 100
+#define VIEWFOLDER_MAX_PAGE_SIZE 1000
+
+// LIST: data optionally holds "-n page_size"; filename holds the last
+// username already listed. One page of users per reply, in name order; the
+// reply's filename is the name to resume after, empty on the last page
+#define LIST_DEFAULT_PAGE_SIZE 100
+#define LIST_MAX_PAGE_SIZE 1000
+
+// WRITE_LOCK: data holds the sentences to lock, one number or a set such
+// as "2-5" or "1,4,6-8" (see parse_sentence_set), optionally followed by
+// "-w timeout_ms". A set is locked all or nothing. Without a wait a locked
+// sentence fails at once with ERR_LOCKED; with one the request queues
+// behind earlier waiters and is answered when it holds every sentence or
+// the timeout passes. ETIRW and WRITE_UNLOCK release the same set.
+#define WRITE_LOCK_MAX_WAIT_MS 300000
+#define SENTENCE_SPEC_MAX 128
+
+// HEARTBEAT: sent by each storage server on its registration connection
+// every SS_HEARTBEAT_INTERVAL_SECONDS. Not answered. data is
+// "SS_ID:<id>|USED:<bytes>|FREE:<bytes>|RPS:<requests/s>|LAT_US:<us>":
+// bytes its files take, bytes free on its disk, and the request rate and
+// mean request latency since the previous heartbeat.
+#define SS_HEARTBEAT_INTERVAL_SECONDS 1
+
+// Wire opcodes (one per message type, carried in the frame header)
+enum {
+    OP_UNKNOWN = 0,
+    OP_REGISTER_SS,
+    OP_REGISTER_CLIENT,
+    OP_CREATE,
+    OP_READ,
+    OP_WRITE,
+    OP_WRITE_LOCK,
+    OP_WRITE_UPDATE,
+    OP_WRITE_COMMIT,
+    OP_DELETE,
+    OP_VIEW,
+    OP_INFO,
+    OP_STREAM,
+    OP_UNDO,
+    OP_EXEC,
+    OP_LIST,
+    OP_ADDACCESS,
+    OP_REMACCESS,
+    OP_CREATEFOLDER,
+    OP_MOVE,
+    OP_VIEWFOLDER,
+    OP_CHECKPOINT,
+    OP_VIEWCHECKPOINT,
+    OP_REVERT,
+    OP_LISTCHECKPOINTS,
+    OP_REQUESTACCESS,
+    OP_VIEWREQUESTS,
+    OP_APPROVEACCESS,
+    OP_REJECTACCESS,
+    OP_REPLICATE,
+    OP_HEARTBEAT,
+    OP_GET_SS_INFO,
+    OP_STREAM_WORD,
+    OP_STREAM_END,
+    OP_MULTI,
+    OP_VIEW_PAGE,
+    OP_SEARCH,
+    OP_WRITE_UNLOCK,
+    OP_COUNT
+};
 
 // Error Codes
 #define ERR_SUCCESS 0
@@ -80,6 +178,7 @@
 #define ERR_CONNECTION_FAILED 10
 #define ERR_FOLDER_NOT_FOUND 11
 #define ERR_CHECKPOINT_NOT_FOUND 12
+#define ERR_SERVER_BUSY 13
 
 // Access Rights
 #define ACCESS_NONE 0
@@ -91,7 +190,7 @@
 typedef struct {
     char filename[MAX_FILENAME];
     char owner[MAX_USERNAME];
-    char path[MAX_PATH];
+    char path[MAX_FILENAME];    // Storage name (see choose_storage_path)
     int storage_server_id;
     int replica_server_id;
     int word_count;
@@ -115,6 +214,11 @@ typedef struct {
     int is_alive;
     time_t last_heartbeat;
     int file_count;
+    // Load from the latest heartbeat, for placement
+    unsigned long long bytes_used;
+    unsigned long long bytes_free;
+    int request_rate;
+    int latency_us;
 } StorageServerInfo;
 
 typedef struct {
@@ -162,8 +266,27 @@ typedef struct {
     char data[BUFFER_SIZE];
     int error_code;
     char error_msg[256];
+    uint32_t request_id;  // Echoed in the response so pipelined replies can be matched
 } Message;
 
+// Wire frame header, followed by username, filename, error_msg and data
+// (in that order, no terminators). All fields are in network byte order.
+#define WIRE_MAGIC 0x4450  // "DP"
+#define WIRE_VERSION 2     // 2: request_id added to the header
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint16_t opcode;
+    uint16_t username_len;
+    uint16_t filename_len;
+    uint16_t error_msg_len;
+    int32_t error_code;
+    uint32_t request_id;
+    uint32_t data_len;
+} WireHeader;
+
 // Utility Functions
 void get_current_timestamp(char* buffer, size_t size);
 void log_message(const char* component, const char* message);
@@ -171,18 +294,27 @@ char* trim(char* str);
 int split_string(const char* str, char delimiter, char results[][MAX_SENTENCE], int max_results);
 int parse_sentences(const char* content, char sentences[][MAX_SENTENCE], int max_sentences);
 int parse_words(const char* sentence, char words[][MAX_WORD], int max_words);
+// Sentence numbers named by spec ("3", "2-5" or "1,4,6-8"), ascending and
+// without duplicates; -1 if spec is malformed or names more than max
+int parse_sentence_set(const char* spec, int* sentences, int max_sentences);
 const char* error_code_to_string(int code);
 
 // Network Utilities
 int create_server_socket(int port);
 int connect_to_server(const char* ip, int port);
+int set_socket_nodelay(int socket);
 int send_message(int socket, const Message* msg);
 int receive_message(int socket, Message* msg);
+long wire_frame_size(const char* buf, size_t len);
+int decode_message(const char* buf, size_t len, Message* msg);
 int send_data(int socket, const char* data, size_t len);
 int receive_data(int socket, char* buffer, size_t len);
 
 // Message Utilities
 void init_message(Message* msg);
+void init_response(Message* resp, const Message* req);
 void set_message_error(Message* msg, int error_code, const char* error_msg);
+int msg_type_to_opcode(const char* type);
+const char* opcode_to_msg_type(int opcode);
 
 #endif // COMMON_H
@@ -0,0 +1,51 @@
+#ifndef GROUPCOMMIT_H
+#define GROUPCOMMIT_H
+
+#include <pthread.h>
+#include <sqlite3.h>
+
+#define GROUP_COMMIT_DEFAULT_INTERVAL_MS 5
+
+// How long an acknowledged change may sit in an uncommitted batch
+typedef enum {
+    DURABILITY_FULL,    // wait for the batch commit; fsync on every commit
+    DURABILITY_NORMAL,  // wait for the batch commit; WAL fsyncs at checkpoints
+    DURABILITY_ASYNC    // do not wait; a crash may lose the last interval
+} Durability;
+
+// Batches mutations from concurrent requests into one transaction that a
+// background thread commits every interval_ms. Writers bracket their SQL
+// with group_commit_begin/end (nestable, so a MULTI can wrap many
+// operations) and, once their own locks are dropped, call
+// group_commit_wait before acknowledging the change.
+typedef struct {
+    sqlite3* db;
+    pthread_mutex_t mutex;      // Recursive; held from begin to end
+    pthread_cond_t resolved;    // Broadcast when a batch commits or fails
+    pthread_cond_t wakeup;
+    int interval_ms;
+    Durability durability;
+    int in_txn;
+    unsigned long open_batch;   // Batch number of the open transaction
+    unsigned long resolved_batch;
+    unsigned long failed_batch; // Most recent batch that rolled back
+    unsigned long commits;
+    unsigned long mutations;
+    int stop;
+    pthread_t thread;
+} GroupCommit;
+
+// Switches the database to WAL and starts the commit thread
+int group_commit_init(GroupCommit* gc, sqlite3* db, int interval_ms, Durability durability);
+void group_commit_shutdown(GroupCommit* gc);
+
+void group_commit_begin(GroupCommit* gc);
+void group_commit_end(GroupCommit* gc);
+
+// Waits until the calling thread's last batch is resolved (immediately in
+// async mode); returns -1 if that batch was rolled back
+int group_commit_wait(GroupCommit* gc);
+
+int parse_durability(const char* name, Durability* out);
+
+#endif // GROUPCOMMIT_H
@@ -3,41 +3,337 @@
 
 #include "common.h"
 #include "trie.h"
+#include "stmtcache.h"
+#include "groupcommit.h"
 
 #define MAX_STORAGE_SERVERS 10
-#define MAX_USERS 100
-#define MAX_LOCKS 100
+#define NM_USER_TABLE_INITIAL 1024
+#define NM_LOCK_BUCKETS 4096
+#define NM_DEFAULT_LOCK_LEASE_SECONDS 60
+#define NM_LOCK_REAP_INTERVAL_SECONDS 1
+#define NM_LOCK_WAIT_POLL_MS 100
+#define NM_DEFAULT_SS_TIMEOUT_SECONDS 3
+#define NM_SS_CHECK_INTERVAL_SECONDS 1
+// Placement score weights (percent): lower file share, disk use, request
+// rate and latency all make a server a better home for a new file
+#define NM_PLACE_WEIGHT_FILES 30
+#define NM_PLACE_WEIGHT_DISK 30
+#define NM_PLACE_WEIGHT_LOAD 25
+#define NM_PLACE_WEIGHT_LATENCY 15
+#define NM_PLACE_MIN_FREE_BYTES (64ULL * 1024 * 1024)
+#define NM_DEFAULT_WORKERS 8
+#define NM_MAX_EVENTS 256
+#define NM_SEND_TIMEOUT_MS 5000       // A reply not taken by then ends the session
+#define NM_MAX_QUEUED_FRAMES 64       // Per connection; more pipelined ends the session
+#define NM_FILE_STRIPES 64
+#define NM_FILE_TABLE_INITIAL 1024
+#define NM_ACL_TABLE_INITIAL 1024
+#define NM_DEFAULT_FLUSH_INTERVAL_MS 1000
+#define NM_SNAPSHOT_PATH "data/nameserver.snap"
+
+// Lock order: ns_lock -> file stripe -> commits -> index_lock / user_lock / lock_table_mutex
+//             / ss_health_mutex.
+//   ns_lock          shared by every request; exclusive for MULTI (so its
+//                    operations land in one batch and roll back together) and
+//                    for changes to the storage server table
+//   file stripes     serialize check-then-act mutations of one file's rows
+//   commits          held around every SQL write (see groupcommit.h)
+//   index_lock       guards file_trie, the file and ACL tables and the per-SS
+//                    file counts
+//   dirty_mutex      guards the dirty timestamp list (taken under index_lock)
+//   user_lock        guards the user table
+//   lock_table_mutex guards the sentence lock table and the reaper's stop flag
+//   ss_health_mutex  guards the storage servers' last_heartbeat and load
+//                    figures (updated under a shared ns_lock; is_alive only
+//                    changes under an exclusive one) and the failure
+//                    detector's stop flag
+
+struct AclEntry;
+
+// A row of the files table, cached in memory (see nm_index.c).
+// accessed_at/modified_at are updated in place under a shared index_lock
+// and written back to SQLite by the timestamp flusher.
+// meta.path is the name the storage servers keep the file under; it is
+// fixed at creation, so MOVE only renames metadata.
+typedef struct FileEntry {
+    FileMetadata meta;
+    struct FileEntry* next;
+    int dirty;                      // On the dirty list, timestamps not yet saved
+    struct FileEntry* next_dirty;
+    struct AclEntry* acl;           // This file's access_control rows
+    struct FileEntry* parent;       // Containing folder, NULL at the top level
+    struct FileEntry* children;     // Folders only: direct children, unordered
+    struct FileEntry* next_sibling;
+    struct FileEntry* prev_sibling;
+} FileEntry;
+
+// A row of users, hashed by name (see nm_users.c)
+typedef struct UserEntry {
+    UserInfo info;
+    int id;                         // users.id, stable for the user's lifetime
+    struct UserEntry* next;
+} UserEntry;
+
+// A WRITE_LOCK parked until the sentence is free or its timeout passes
+typedef struct LockWaiter {
+    int sock;
+    uint32_t request_id;
+    char type[32];
+    char username[MAX_USERNAME];
+    char spec[SENTENCE_SPEC_MAX];   // Every sentence the request wants
+    struct timespec deadline;       // CLOCK_MONOTONIC
+    struct LockWaiter* next;
+} LockWaiter;
+
+// A sentence lock, hashed by (filename, sentence) and also chained off its
+// holder's socket (see nm_locks.c)
+typedef struct LockEntry {
+    SentenceLock lock;
+    time_t expires_at;              // Lease end; re-acquiring renews it
+    int granted;                    // Handed to a waiter not yet re-run
+    LockWaiter* waiters;            // FIFO, granted the lock in order
+    LockWaiter* waiters_tail;
+    struct LockEntry* next;
+    struct LockEntry* next_by_socket;
+} LockEntry;
+
+// A row of access_control, hashed by (filename, username) and also chained
+// off its file so deleting the file drops its grants
+typedef struct AclEntry {
+    AccessEntry access;
+    FileEntry* file;
+    struct AclEntry* next;
+    struct AclEntry* next_in_file;
+} AclEntry;
 
 typedef struct {
     sqlite3* db;
     Trie* file_trie;
-    pthread_mutex_t mutex;
+    FileEntry** file_table;     // Chained hash table keyed by filename
+    size_t file_buckets;
+    size_t file_total;
+    AclEntry** acl_table;
+    size_t acl_buckets;
+    size_t acl_total;
+    FileEntry* top_level;       // Children of the root folder
+    FileEntry* dirty_head;
+    pthread_mutex_t dirty_mutex;
+    pthread_cond_t flush_cond;
+    pthread_t flush_thread;
+    int flush_interval_ms;
+    int flush_stop;
+    pthread_rwlock_t ns_lock;
+    pthread_mutex_t file_stripes[NM_FILE_STRIPES];
+    pthread_rwlock_t index_lock;
+    pthread_mutex_t lock_table_mutex;
     StorageServerInfo storage_servers[MAX_STORAGE_SERVERS];
     int ss_count;
-    UserInfo users[MAX_USERS];
-    int user_count;
-    SentenceLock locks[MAX_LOCKS];
-    int lock_count;
+    pthread_mutex_t ss_health_mutex;
+    int ss_timeout_seconds;     // Heartbeat silence before a server is marked down
+    pthread_cond_t detector_cond;
+    pthread_t detector_thread;
+    int detector_stop;
+    UserEntry** user_table;     // Chained hash table keyed by username
+    size_t user_buckets;
+    size_t user_total;
+    pthread_rwlock_t user_lock;
+    LockEntry* lock_table[NM_LOCK_BUCKETS];     // Keyed by (filename, sentence)
+    LockEntry* socket_locks[NM_LOCK_BUCKETS];   // The same locks, keyed by holder socket
+    size_t lock_total;
+    size_t waiter_total;
+    int lock_lease_seconds;
+    pthread_cond_t reaper_cond;
+    pthread_t reaper_thread;
+    int reaper_stop;
     int next_ss_id;
+    int worker_count;
+    GroupCommit commits;
+    int commit_interval_ms;
+    Durability durability;
 } NameServerState;
 
 extern NameServerState server_state;
 
+// Statements prepared once in init_database (see nm_statements in nm_db.c)
+typedef enum {
+    NM_STMT_FILE_ACL,
+    NM_STMT_INSERT_FILE,
+    NM_STMT_INSERT_FOLDER,
+    NM_STMT_DELETE_FILE,
+    NM_STMT_DELETE_FILE_ACL,
+    NM_STMT_SAVE_TIMESTAMPS,
+    NM_STMT_VIEW_ALL,
+    NM_STMT_VIEW_USER,
+    NM_STMT_GRANT_ACCESS,
+    NM_STMT_REVOKE_ACCESS,
+    NM_STMT_INSERT_ACCESS_REQUEST,
+    NM_STMT_PENDING_REQUESTS,
+    NM_STMT_STORAGE_PATH_USED,
+    NM_STMT_MOVE_FILES,
+    NM_STMT_MOVE_ACL,
+    NM_STMT_MOVE_REQUESTS,
+    NM_STMT_INSERT_USER,
+    NM_STMT_LIST_USERS,
+    NM_STMT_COUNT
+} NMStatement;
+
+extern CachedStmt nm_statements[NM_STMT_COUNT];
+
 // Core functions
+void dispatch_request(int sock, Message* msg);
+// Queues msg (malloc'd; freed here) on sock's connection as if it had just
+// arrived. Dropped if the connection is closing.
+void connection_resume(int sock, Message* msg);
 int init_database();
 int load_files_from_db();
-int check_permission(const char* username, const char* filename, int required_perm);
+int load_acl_from_db();
+int check_permission(const char* username, const FileMetadata* file, int required_perm);
+// NULL if the server is unknown or marked down
 StorageServerInfo* get_ss_by_id(int ss_id);
-void release_lock(const char* filename, int sentence_num, const char* username, int client_socket);
+// The file's primary, or its replica while the primary is down
+StorageServerInfo* get_ss_for_read(const FileMetadata* file);
+void init_locks();
+void destroy_locks();
+void lock_file(const char* filename);
+void unlock_file(const char* filename);
+void append_storage_key(char* data, size_t size, const FileMetadata* file);
+
+// Namespace snapshot (nm_snapshot.c): the file and ACL index and the storage
+// server registry, written at clean shutdown and mapped back in at startup
+// instead of querying every row. A snapshot is only trusted while the
+// database still holds its generation marker, and loading clears the marker,
+// so any change made after that (or a crash) falls back to SQLite.
+int snapshot_save(const char* path);
+int snapshot_load(const char* path);
+
+// File index: existence, owner and placement without touching SQLite
+unsigned long filename_hash(const char* filename);
+int file_exists(const char* filename);
+int index_get_file(const char* filename, FileMetadata* out);
+int index_add_file(const FileMetadata* meta, StorageServerInfo* ss);
+// index_add_file for bulk loads: the entry goes in at the top level and not
+// in file_trie; the caller fills the trie and runs index_link_orphans
+int index_load_file(const FileMetadata* meta);
+void index_remove_file(const char* filename, int ss_id);
+// Undoes index_add_file for a create whose batch failed to commit,
+// including the file count it added to its storage server
+void index_undo_add(const char* filename);
+// Undoes index_remove_file for a delete whose batch failed to commit: the
+// entry, its storage server's file count and its grants (reloaded from the
+// database) come back. Caller holds ns_lock and the file's stripe, and has
+// checked that the name is still free.
+void index_restore_file(const FileMetadata* meta);
+void index_free();
+// Size the hash tables for a bulk load
+void index_reserve(size_t files, size_t acls);
+// Calls fn on every entry, in no particular order, under a shared
+// index_lock; stops at and returns the first nonzero result
+int index_for_each(int (*fn)(const FileEntry* entry, void* arg), void* arg);
+
+// Folder tree: names are paths ("a/b/c"), and each entry is linked under the
+// folder named by its path up to the last '/'. Entries loaded before their
+// folder sit at the top level until index_link_orphans runs.
+void index_link_orphans();
+// 1 if path is a folder (the empty path is the root), 0 if it is a file,
+// -1 if it does not exist; has_children (optional) says whether it is empty
+int index_lookup_folder(const char* path, int* has_children);
+// Up to max_names of the folder's direct children that username can read,
+// as malloc'd base names sorting after `after`, folders marked with a
+// trailing '/', in order; returns the count or -1
+int index_list_folder(const char* path, const char* username, const char* after,
+                      char** names, int max_names);
+// ERR_SUCCESS if username may rename from (and everything under it) to to
+int index_check_move(const char* from, const char* to, const char* username);
+void index_move(const char* from, const char* to);
+
+// Sentence locks (nm_locks.c): one connection at a time may edit a
+// sentence, for lock_lease_seconds from its last acquire. A request locks
+// all of its sentences or none. ERR_LOCKED (with the first busy sentence in
+// conflict and its holder's name in holder) if another live lease holds
+// one, or with wait_ms > 0, NM_LOCK_QUEUED: the request is parked, and
+// re-queued on its connection (see connection_resume) once a lock it waits
+// for is handed to it or its wait is over, to be answered then.
+#define NM_LOCK_QUEUED (-1)
+int lock_acquire(const Message* request, const int* sentences, int count, int sock, int wait_ms,
+                 char* holder, int* conflict);
+// How many of the sentences sock held (the rest were never locked or
+// their leases were reaped)
+int lock_release(const char* filename, const int* sentences, int count, int sock);
+// Drops every lock sock holds and every wait it has queued; call before
+// the socket is closed
+int lock_release_socket(int sock);
+// 1 if path, or anything under it, has a locked sentence
+int lock_subtree_held(const char* path);
+int lock_reaper_start();
+void lock_reaper_stop();
+void locks_free();
+
+// Failure detector (nm_health.c): a storage server that has sent no
+// HEARTBEAT for ss_timeout_seconds is marked down, so requests skip it
+// without a connect timeout, and up again when its heartbeats resume
+int failure_detector_start();
+void failure_detector_stop();
+// Index into storage_servers of the live server with the best placement
+// score for a new file, or -1 if none is up. If replica_idx is not NULL it
+// receives the next best live server, or -1. Servers that reported less
+// than NM_PLACE_MIN_FREE_BYTES free are used only if nothing else is up.
+// Caller holds ns_lock.
+int choose_storage_servers(int* replica_idx);
+
+// User registry (nm_users.c): every registered user, loaded at startup and
+// looked up by name without a query
+int load_users_from_db();
+// The user's ID, or 0 if no such user is registered
+int user_lookup(const char* username);
+// Registers username if it is new (created set to 1) and returns its ID, or
+// -1 on failure. A new user's row joins the open group commit batch: the
+// caller waits for it and calls user_forget if that fails.
+int user_register(const char* username, int* created);
+void user_forget(const char* username);
+void users_free();
+
+// ACL index: (file, user) -> permission bitmask; owners are not stored
+int index_get_permissions(const char* filename, const char* username);
+void index_set_permissions(const char* filename, const char* username, int permissions);
+void index_reload_permissions(const char* filename);
+
+// Up to max_results strdup'd names starting with prefix, sorting after
+// `after` and readable by username, in order. Checks at most
+// SEARCH_MAX_SCAN candidates; if it stops there, resume receives the last
+// name checked (otherwise it is set empty).
+int index_search_prefix(const char* prefix, const char* after, const char* username,
+                        char** results, int max_results, char* resume);
+
+// Write-behind timestamps: touches only mark the entry dirty, and a
+// background thread saves all dirty entries in one batch every
+// flush_interval_ms. Stopping the flusher saves whatever is still dirty.
+void index_touch_file(const char* filename, int modified);
+int index_flush_timestamps();
+int timestamp_flusher_start();
+void timestamp_flusher_stop();
+
+// Request bodies shared by the single-request handlers and MULTI.
+// Caller holds ns_lock exclusively, or shared plus the file's stripe for
+// create/addaccess (shared alone for read), and sends the response once
+// group_commit_wait has confirmed the change.
+void process_create(const Message* msg, Message* resp);
+void process_read(const Message* msg, Message* resp);
+void process_addaccess(const Message* msg, Message* resp);
+// Creates need the containing folder to exist (the root always does);
+// sets ERR_FOLDER_NOT_FOUND in resp and returns -1 otherwise
+int check_parent_folder(const char* filename, Message* resp);
 
 // Message handlers
 void handle_register_ss(int sock, Message* msg);
 void handle_register_client(int sock, Message* msg);
+void handle_heartbeat(int sock, Message* msg);
 void handle_create(int sock, Message* msg);
 void handle_read(int sock, Message* msg);
 void handle_write(int sock, Message* msg);
+void handle_write_release(int sock, Message* msg);
 void handle_delete(int sock, Message* msg);
 void handle_view(int sock, Message* msg);
+void handle_search(int sock, Message* msg);
 void handle_list(int sock, Message* msg);
 void handle_addaccess(int sock, Message* msg);
 void handle_remaccess(int sock, Message* msg);
@@ -46,5 +342,8 @@ void handle_exec(int sock, Message* msg);
 void handle_createfolder(int sock, Message* msg);
 void handle_checkpoint(int sock, Message* msg);
 void handle_request_access(int sock, Message* msg);
+void handle_multi(int sock, Message* msg);
+void handle_move(int sock, Message* msg);
+void handle_viewfolder(int sock, Message* msg);
 
 #endif
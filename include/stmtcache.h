@@ -0,0 +1,25 @@
+#ifndef STMTCACHE_H
+#define STMTCACHE_H
+
+#include <pthread.h>
+#include <sqlite3.h>
+
+// A statement compiled once at startup and reused for every request.
+// The mutex gives one thread at a time exclusive use of the statement.
+typedef struct {
+    const char* sql;
+    sqlite3_stmt* stmt;
+    pthread_mutex_t mutex;
+} CachedStmt;
+
+// Prepare every statement in a registry; returns -1 if any fails to compile
+int stmt_cache_prepare(sqlite3* db, CachedStmt* stmts, int count);
+void stmt_cache_finalize(CachedStmt* stmts, int count);
+
+// Lock a cached statement for use; returns NULL if it was never prepared.
+// Column text is only valid until stmt_release, which resets the statement
+// and clears its bindings.
+sqlite3_stmt* stmt_acquire(CachedStmt* cs);
+void stmt_release(CachedStmt* cs);
+
+#endif // STMTCACHE_H
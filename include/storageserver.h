@@ -2,31 +2,98 @@
 #define STORAGESERVER_H
 
 #include "common.h"
+#include "stmtcache.h"
+#include "groupcommit.h"
 
 #define MAX_FILES 1000
 #define SS_DATA_DIR "data/storage"
+#define SS_DEFAULT_WORKERS 16
+#define SS_DEFAULT_QUEUE 64
+#define SS_IDLE_TIMEOUT_SECONDS 10    // A pool worker drops a connection silent this long
+#define SS_REJECT_QUEUE 64            // Rejected sockets waiting to be drained and closed
+#define SS_REJECT_DRAIN_MS 200
+#define SS_LOCK_BUCKETS 256
+
+// Per-file reader/writer lock, created on first use and freed when the last
+// holder or waiter releases it
+typedef struct FileLock {
+    char filename[MAX_FILENAME];
+    pthread_rwlock_t rwlock;
+    int refcount;
+    struct FileLock* next;
+} FileLock;
 
 typedef struct {
     int ss_id;
     int port;
     char data_dir[MAX_PATH];
     sqlite3* db;
-    pthread_mutex_t mutex;
+    pthread_mutex_t db_mutex;         // Guards the metadata database only
+    GroupCommit commits;              // Batches metadata writes; acks wait on it
+    int commit_interval_ms;
+    Durability durability;
+    FileLock* file_locks[SS_LOCK_BUCKETS];
+    pthread_mutex_t lock_table_mutex; // Guards file_locks chains and refcounts
     int nm_socket;
+    
+    // Worker pool and bounded queue of accepted client sockets
+    int worker_count;
+    int queue_capacity;
+    int* conn_queue;
+    int queue_head;
+    int queue_depth;
+    int queue_high_water;
+    unsigned long accepted_total;
+    unsigned long rejected_total;
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_cond;
+    
+    // Rejected sockets, closed off the accept thread (see reject_connection)
+    int reject_queue[SS_REJECT_QUEUE];
+    int reject_head;
+    int reject_depth;
+    pthread_mutex_t reject_mutex;
+    pthread_cond_t reject_cond;
+    
+    // Request load, reported to the Name Server with each heartbeat
+    unsigned long requests_total;
+    unsigned long long request_us_total;
+    unsigned long long bytes_stored;  // Document bytes, adjusted on every write and delete
+    pthread_mutex_t stats_mutex;
 } StorageServerState;
 
 extern StorageServerState ss_state;
 
+// Statements prepared once in init_storage_server (see ss_statements in ss_main.c)
+typedef enum {
+    SS_STMT_INSERT_METADATA,
+    SS_STMT_SAVE_METADATA,
+    SS_STMT_DELETE_METADATA,
+    SS_STMT_FILE_INFO,
+    SS_STMT_INSERT_CHECKPOINT,
+    SS_STMT_LIST_CHECKPOINTS,
+    SS_STMT_FIND_CHECKPOINT,
+    SS_STMT_COUNT
+} SSStatement;
+
+extern CachedStmt ss_statements[SS_STMT_COUNT];
+
 // Core functions
 int init_storage_server(int port);
 int register_with_nameserver();
-void* handle_client(void* arg);
-char* get_file_path(const char* filename);
+void handle_client(int client_sock);
+void get_file_path(const char* filename, char* path, size_t size);
 int save_file_content(const char* filename, const char* content);
+void add_stored_bytes(long long delta);
 int load_file_content(const char* filename, char* buffer, size_t max_size);
 int save_undo_state(const char* filename, const char* content);
 int load_undo_state(const char* filename, char* buffer, size_t max_size);
 
+// Per-file locking: readers share, writers are exclusive.
+// Order: file lock -> db_mutex -> commits.
+FileLock* acquire_file_lock(const char* filename, int exclusive);
+void release_file_lock(FileLock* lock);
+
 // Command handlers
 void handle_create(int sock, Message* msg);
 void handle_read(int sock, Message* msg);
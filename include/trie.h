@@ -3,18 +3,86 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
-#define ALPHABET_SIZE 256
+// Adaptive radix tree (ART): path-compressed, with inner nodes that grow
+// from 4 to 16, 48 and 256 children as needed. Keys are stored once, in
+// the leaves, including their terminating NUL so no key is a prefix of
+// another.
 
+// Compressed path bytes kept in each inner node; longer paths are skipped
+// optimistically and verified against the leaf
+#define TRIE_MAX_PREFIX 10
+
+// Nodes and leaves come from an arena: TRIE_SLAB_SIZE slabs carved into
+// TRIE_ALIGN-byte size classes, each with its own free list. Keys longer
+// than TRIE_MAX_KEY are not indexed (filenames are capped well below it).
+#define TRIE_SLAB_SIZE (256 * 1024)
+#define TRIE_ALIGN 16
+#define TRIE_NUM_CLASSES 256
+#define TRIE_MAX_KEY 4000
+
+typedef enum {
+    TRIE_NODE4 = 1,
+    TRIE_NODE16,
+    TRIE_NODE48,
+    TRIE_NODE256
+} TrieNodeType;
+
+// Header shared by all inner node sizes. Child pointers with the low bit
+// set point to a TrieLeaf instead.
 typedef struct TrieNode {
-    struct TrieNode* children[ALPHABET_SIZE];
-    int is_end_of_word;
-    char* filename;
+    uint8_t type;
+    uint16_t num_children;
+    uint32_t prefix_len;
+    unsigned char prefix[TRIE_MAX_PREFIX];
 } TrieNode;
 
+typedef struct {
+    TrieNode n;
+    unsigned char keys[4];      // Sorted
+    TrieNode* children[4];
+} TrieNode4;
+
+typedef struct {
+    TrieNode n;
+    unsigned char keys[16];     // Sorted
+    TrieNode* children[16];
+} TrieNode16;
+
+typedef struct {
+    TrieNode n;
+    unsigned char child_index[256]; // Slot + 1 in children, 0 if absent
+    TrieNode* children[48];
+} TrieNode48;
+
+typedef struct {
+    TrieNode n;
+    TrieNode* children[256];
+} TrieNode256;
+
+typedef struct {
+    uint32_t key_len;           // Including the terminating NUL
+    char key[];
+} TrieLeaf;
+
+typedef struct TrieSlab {
+    struct TrieSlab* next;
+} TrieSlab;
+
+typedef struct {
+    TrieSlab* slabs;
+    char* bump;                 // Unused tail of the newest slab
+    char* bump_end;
+    void* free_lists[TRIE_NUM_CLASSES];
+    size_t slab_bytes;
+} TrieArena;
+
 typedef struct {
     TrieNode* root;
     int size;
+    size_t bytes;               // Arena bytes in use by nodes and leaves
+    TrieArena arena;
 } Trie;
 
 // Trie functions
@@ -23,6 +91,8 @@ void trie_insert(Trie* trie, const char* filename);
 int trie_search(Trie* trie, const char* filename);
 void trie_delete(Trie* trie, const char* filename);
 void trie_free(Trie* trie);
-int trie_search_prefix(Trie* trie, const char* prefix, char** results, int max_results);
+// Up to max_results strdup'd keys starting with prefix, in sorted order;
+// with a non-empty after, only keys sorting after it (a resume key)
+int trie_search_prefix(Trie* trie, const char* prefix, const char* after, char** results, int max_results);
 
 #endif // TRIE_H
@@ -0,0 +1,216 @@
+#include "../../include/nameserver.h"
+
+// Permission-check microbenchmark. Builds the name server's in-memory file
+// and ACL index with a growing number of access_control rows and times
+// check_permission against it, half hits and half misses.
+//
+//   bench_acl [max_rows] [--legacy]
+//
+// --legacy also times the original per-request lookup for comparison: the
+// owner and access_control SELECTs against an in-memory SQLite database
+// holding the same rows.
+
+NameServerState server_state;
+
+#define USERS_PER_FILE 64
+#define LOOKUPS 1000000
+#define LEGACY_LOOKUPS 100000
+#define KEY_RING 65536  // Distinct lookups per size, formatted before timing
+
+typedef struct {
+    char filename[MAX_FILENAME];
+    char username[MAX_USERNAME];
+} LookupKey;
+
+static int legacy_mode = 0;
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void make_name(char* buf, size_t size, const char* prefix, int n) {
+    snprintf(buf, size, "%s_%07d", prefix, n);
+}
+
+// Grow the index from its current size to `rows` access entries
+static void populate_index(int from, int rows) {
+    FileMetadata meta;
+    char username[MAX_USERNAME];
+    for (int i = from; i < rows; i++) {
+        int file = i / USERS_PER_FILE;
+        memset(&meta, 0, sizeof(meta));
+        make_name(meta.filename, sizeof(meta.filename), "file", file);
+        if (i % USERS_PER_FILE == 0) {
+            strcpy(meta.owner, "owner");
+            meta.storage_server_id = 1;
+            meta.replica_server_id = -1;
+            index_add_file(&meta, NULL);
+        }
+        make_name(username, sizeof(username), "user", i % USERS_PER_FILE * 7919 + file);
+        index_set_permissions(meta.filename, username, ACCESS_READ);
+    }
+}
+
+static void populate_sqlite(sqlite3* db, int from, int rows) {
+    sqlite3_stmt* file_stmt;
+    sqlite3_stmt* acl_stmt;
+    sqlite3_prepare_v2(db, "INSERT INTO files (filename, owner) VALUES (?, 'owner');", -1, &file_stmt, NULL);
+    sqlite3_prepare_v2(db, "INSERT INTO access_control VALUES (?, ?, 1);", -1, &acl_stmt, NULL);
+
+    sqlite3_exec(db, "BEGIN;", 0, 0, NULL);
+    char filename[MAX_FILENAME], username[MAX_USERNAME];
+    for (int i = from; i < rows; i++) {
+        int file = i / USERS_PER_FILE;
+        make_name(filename, sizeof(filename), "file", file);
+        if (i % USERS_PER_FILE == 0) {
+            sqlite3_bind_text(file_stmt, 1, filename, -1, SQLITE_STATIC);
+            sqlite3_step(file_stmt);
+            sqlite3_reset(file_stmt);
+        }
+        make_name(username, sizeof(username), "user", i % USERS_PER_FILE * 7919 + file);
+        sqlite3_bind_text(acl_stmt, 1, filename, -1, SQLITE_STATIC);
+        sqlite3_bind_text(acl_stmt, 2, username, -1, SQLITE_STATIC);
+        sqlite3_step(acl_stmt);
+        sqlite3_reset(acl_stmt);
+    }
+    sqlite3_exec(db, "COMMIT;", 0, 0, NULL);
+
+    sqlite3_finalize(file_stmt);
+    sqlite3_finalize(acl_stmt);
+}
+
+// Random (file, user) pairs over the first `rows` entries; about half name
+// a user with no grant
+static void fill_keys(LookupKey* keys, int rows) {
+    unsigned int seed = 42;
+    for (int k = 0; k < KEY_RING; k++) {
+        int i = rand_r(&seed) % rows;
+        int file = i / USERS_PER_FILE;
+        make_name(keys[k].filename, MAX_FILENAME, "file", file);
+        if (rand_r(&seed) & 1) {
+            make_name(keys[k].username, MAX_USERNAME, "user", i % USERS_PER_FILE * 7919 + file);
+        } else {
+            make_name(keys[k].username, MAX_USERNAME, "nobody", i);
+        }
+    }
+}
+
+static double time_index(const LookupKey* keys, int lookups) {
+    int granted = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < lookups; i++) {
+        const LookupKey* key = &keys[i % KEY_RING];
+        FileMetadata file;
+        if (index_get_file(key->filename, &file)) {
+            granted += check_permission(key->username, &file, ACCESS_READ);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (granted == 0) {
+        printf("No permission check succeeded\n");
+    }
+    return elapsed_ns(&start, &end) / lookups;
+}
+
+// The pre-index check_permission: owner SELECT, then access_control SELECT
+static double time_sqlite(sqlite3* db, const LookupKey* keys, int lookups) {
+    sqlite3_stmt* owner_stmt;
+    sqlite3_stmt* acl_stmt;
+    sqlite3_prepare_v2(db, "SELECT owner FROM files WHERE filename = ?;", -1, &owner_stmt, NULL);
+    sqlite3_prepare_v2(db, "SELECT permissions FROM access_control WHERE filename = ? AND username = ?;",
+                       -1, &acl_stmt, NULL);
+
+    int granted = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < lookups; i++) {
+        const LookupKey* key = &keys[i % KEY_RING];
+
+        int is_owner = 0;
+        sqlite3_bind_text(owner_stmt, 1, key->filename, -1, SQLITE_STATIC);
+        if (sqlite3_step(owner_stmt) == SQLITE_ROW) {
+            is_owner = strcmp((const char*)sqlite3_column_text(owner_stmt, 0), key->username) == 0;
+        }
+        sqlite3_reset(owner_stmt);
+
+        if (!is_owner) {
+            sqlite3_bind_text(acl_stmt, 1, key->filename, -1, SQLITE_STATIC);
+            sqlite3_bind_text(acl_stmt, 2, key->username, -1, SQLITE_STATIC);
+            if (sqlite3_step(acl_stmt) == SQLITE_ROW) {
+                granted += (sqlite3_column_int(acl_stmt, 0) & ACCESS_READ) == ACCESS_READ;
+            }
+            sqlite3_reset(acl_stmt);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    sqlite3_finalize(owner_stmt);
+    sqlite3_finalize(acl_stmt);
+
+    if (granted == 0) {
+        printf("No permission check succeeded\n");
+    }
+    return elapsed_ns(&start, &end) / lookups;
+}
+
+int main(int argc, char* argv[]) {
+    int max_rows = 1000000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--legacy") == 0) {
+            legacy_mode = 1;
+        } else {
+            max_rows = atoi(argv[i]);
+        }
+    }
+    if (max_rows < 1000) {
+        printf("Usage: %s [max_rows >= 1000] [--legacy]\n", argv[0]);
+        return 1;
+    }
+
+    memset(&server_state, 0, sizeof(server_state));
+    init_locks();
+    server_state.file_trie = trie_create();
+
+    sqlite3* db = NULL;
+    if (legacy_mode) {
+        sqlite3_open(":memory:", &db);
+        sqlite3_exec(db, "CREATE TABLE files (filename TEXT PRIMARY KEY, owner TEXT NOT NULL);"
+                         "CREATE TABLE access_control (filename TEXT, username TEXT, permissions INTEGER, "
+                         "PRIMARY KEY (filename, username));", 0, 0, NULL);
+    }
+
+    printf("Permission checks, %d users per file, 50%% granted\n", USERS_PER_FILE);
+    printf("%12s %14s%s\n", "ACL rows", "index ns/op", legacy_mode ? "   sqlite ns/op" : "");
+
+    LookupKey* keys = malloc(sizeof(LookupKey) * KEY_RING);
+    int rows = 0;
+    for (int target = 1000; rows < max_rows; target *= 10) {
+        if (target > max_rows) target = max_rows;
+        populate_index(rows, target);
+        if (legacy_mode) {
+            populate_sqlite(db, rows, target);
+        }
+        rows = target;
+        fill_keys(keys, rows);
+
+        printf("%12d %14.1f", rows, time_index(keys, LOOKUPS));
+        if (legacy_mode) {
+            printf(" %15.1f", time_sqlite(db, keys, LEGACY_LOOKUPS));
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    free(keys);
+    if (db) {
+        sqlite3_close(db);
+    }
+    index_free();
+    trie_free(server_state.file_trie);
+    destroy_locks();
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include "../../include/common.h"
+#include <netinet/tcp.h>
+
+// Round-trip latency microbenchmark for small request/response frames.
+// An echo server thread runs on loopback; the main thread times N round
+// trips of a CREATE-sized message and reports p50/p99.
+//
+//   bench_latency [iterations] [--legacy]
+//
+// --legacy reproduces the original transport for comparison: Nagle left on,
+// and a 4-byte length followed by the full sizeof(Message) struct written
+// with two separate send() calls.
+
+static int legacy_mode = 0;
+
+static int legacy_send(int sock, const Message* msg) {
+    uint32_t net_size = htonl(sizeof(Message));
+    if (send(sock, &net_size, sizeof(net_size), 0) != sizeof(net_size)) {
+        return -1;
+    }
+    size_t total = 0;
+    while (total < sizeof(Message)) {
+        ssize_t sent = send(sock, (const char*)msg + total, sizeof(Message) - total, 0);
+        if (sent <= 0) return -1;
+        total += sent;
+    }
+    return 0;
+}
+
+static int legacy_receive(int sock, Message* msg) {
+    uint32_t net_size;
+    if (recv(sock, &net_size, sizeof(net_size), MSG_WAITALL) != sizeof(net_size)) {
+        return -1;
+    }
+    if (ntohl(net_size) != sizeof(Message)) {
+        return -1;
+    }
+    if (recv(sock, msg, sizeof(Message), MSG_WAITALL) != (ssize_t)sizeof(Message)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int bench_send(int sock, const Message* msg) {
+    return legacy_mode ? legacy_send(sock, msg) : send_message(sock, msg);
+}
+
+static int bench_receive(int sock, Message* msg) {
+    return legacy_mode ? legacy_receive(sock, msg) : receive_message(sock, msg);
+}
+
+static void clear_nodelay(int sock) {
+    int opt = 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+}
+
+static void* echo_server(void* arg) {
+    int server_fd = *(int*)arg;
+    int sock = accept(server_fd, NULL, NULL);
+    if (sock < 0) {
+        return NULL;
+    }
+    if (legacy_mode) {
+        clear_nodelay(sock);
+    }
+
+    Message* msg = malloc(sizeof(Message));
+    Message* resp = malloc(sizeof(Message));
+    while (bench_receive(sock, msg) == 0) {
+        // Legacy frames always carried a fully zeroed struct
+        if (legacy_mode) memset(resp, 0, sizeof(Message));
+        else init_message(resp);
+        resp->error_code = ERR_SUCCESS;
+        snprintf(resp->data, sizeof(resp->data), "SS:127.0.0.1:9001|REPLICA:127.0.0.1:9002");
+        if (bench_send(sock, resp) < 0) {
+            break;
+        }
+    }
+
+    free(msg);
+    free(resp);
+    close(sock);
+    return NULL;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = 2000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--legacy") == 0) {
+            legacy_mode = 1;
+        } else {
+            iterations = atoi(argv[i]);
+        }
+    }
+    if (iterations <= 0) {
+        printf("Usage: %s [iterations] [--legacy]\n", argv[0]);
+        return 1;
+    }
+
+    int server_fd = create_server_socket(0);
+    if (server_fd < 0) {
+        return 1;
+    }
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    getsockname(server_fd, (struct sockaddr*)&addr, &addr_len);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, echo_server, &server_fd);
+
+    int sock = connect_to_server("127.0.0.1", ntohs(addr.sin_port));
+    if (sock < 0) {
+        return 1;
+    }
+    if (legacy_mode) {
+        clear_nodelay(sock);
+    }
+
+    Message* msg = malloc(sizeof(Message));
+    Message* resp = malloc(sizeof(Message));
+    double* samples = malloc(sizeof(double) * iterations);
+
+    for (int i = 0; i < iterations; i++) {
+        if (legacy_mode) memset(msg, 0, sizeof(Message));
+        else init_message(msg);
+        strcpy(msg->type, MSG_CREATE);
+        strcpy(msg->username, "bench");
+        snprintf(msg->filename, sizeof(msg->filename), "file_%d.txt", i);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (bench_send(sock, msg) < 0 || bench_receive(sock, resp) < 0) {
+            printf("Round trip %d failed\n", i);
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        samples[i] = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    }
+
+    close(sock);
+    pthread_join(thread, NULL);
+    close(server_fd);
+
+    qsort(samples, iterations, sizeof(double), compare_double);
+    double total = 0;
+    for (int i = 0; i < iterations; i++) {
+        total += samples[i];
+    }
+
+    printf("Transport: %s\n", legacy_mode ? "legacy (fixed frame, split send, Nagle)" :
+                                          "framed (vectored send, TCP_NODELAY)");
+    printf("Round trips: %d\n", iterations);
+    printf("  mean: %9.1f us\n", total / iterations);
+    printf("  p50:  %9.1f us\n", samples[iterations * 50 / 100]);
+    printf("  p99:  %9.1f us\n", samples[iterations * 99 / 100]);
+    printf("  max:  %9.1f us\n", samples[iterations - 1]);
+
+    free(samples);
+    free(msg);
+    free(resp);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "../../include/nameserver.h"
+
+// Name Server startup microbenchmark. Grows a files/access_control database
+// in a scratch directory and times rebuilding the in-memory namespace from
+// it the two ways the NM can: querying every row from SQLite, and mapping
+// the binary namespace snapshot written at shutdown. Both read from a warm
+// page cache.
+//
+//   bench_startup [max_files]
+
+NameServerState server_state;
+
+#define ACL_EVERY 4     // One access entry per this many files
+
+static double elapsed_ms(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void make_key(char* buf, size_t size, int i) {
+    snprintf(buf, size, "team%02d/project_%04d/notes_%07d.txt", i % 97, (i / 97) % 1000, i);
+}
+
+static void populate(int from, int files) {
+    sqlite3_stmt* file_stmt;
+    sqlite3_stmt* acl_stmt;
+    sqlite3_prepare_v2(server_state.db,
+                       "INSERT INTO files (filename, owner, storage_server_id, replica_server_id, "
+                       "created_at, modified_at, accessed_at, storage_path) VALUES (?1, 'owner', 1, 2, 0, 0, 0, ?1);",
+                       -1, &file_stmt, NULL);
+    sqlite3_prepare_v2(server_state.db, "INSERT INTO access_control VALUES (?, 'reader', 1);", -1, &acl_stmt, NULL);
+
+    sqlite3_exec(server_state.db, "BEGIN;", 0, 0, NULL);
+    char filename[MAX_FILENAME];
+    for (int i = from; i < files; i++) {
+        make_key(filename, sizeof(filename), i);
+        sqlite3_bind_text(file_stmt, 1, filename, -1, SQLITE_STATIC);
+        sqlite3_step(file_stmt);
+        sqlite3_reset(file_stmt);
+        if (i % ACL_EVERY == 0) {
+            sqlite3_bind_text(acl_stmt, 1, filename, -1, SQLITE_STATIC);
+            sqlite3_step(acl_stmt);
+            sqlite3_reset(acl_stmt);
+        }
+    }
+    sqlite3_exec(server_state.db, "COMMIT;", 0, 0, NULL);
+
+    sqlite3_finalize(file_stmt);
+    sqlite3_finalize(acl_stmt);
+}
+
+static void reset_index() {
+    index_free();
+    trie_free(server_state.file_trie);
+    server_state.file_trie = trie_create();
+    server_state.ss_count = 0;
+}
+
+int main(int argc, char* argv[]) {
+    int max_files = 1000000;
+    if (argc > 1) {
+        max_files = atoi(argv[1]);
+    }
+    if (max_files < 1000) {
+        printf("Usage: %s [max_files >= 1000]\n", argv[0]);
+        return 1;
+    }
+
+    char dir[] = "/tmp/bench_startup.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) < 0 || mkdir("data", 0755) < 0) {
+        perror("scratch directory");
+        return 1;
+    }
+    // log_message also prints each load; keep those lines out of the table
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!out || !freopen("/dev/null", "w", stdout)) {
+        perror("stdout");
+        return 1;
+    }
+
+    memset(&server_state, 0, sizeof(server_state));
+    init_locks();
+    server_state.file_trie = trie_create();
+    server_state.next_ss_id = 1;
+    if (init_database() < 0) {
+        fprintf(out, "Failed to create database\n");
+        return 1;
+    }
+
+    fprintf(out, "Namespace load, ~35-byte names, one access entry per %d files\n", ACL_EVERY);
+    fprintf(out, "%10s %12s %12s %12s %12s %8s\n", "files", "sqlite ms", "save ms", "snapshot ms",
+            "snap B/file", "speedup");
+    fflush(out);
+
+    int files = 0;
+    for (int target = 1000; files < max_files; target *= 10) {
+        if (target > max_files) target = max_files;
+        populate(files, target);
+        files = target;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        load_files_from_db();
+        load_acl_from_db();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double sqlite_ms = elapsed_ms(&start, &end);
+        size_t loaded = server_state.file_total;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        snapshot_save(NM_SNAPSHOT_PATH);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double save_ms = elapsed_ms(&start, &end);
+        reset_index();
+
+        struct stat st;
+        stat(NM_SNAPSHOT_PATH, &st);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int rc = snapshot_load(NM_SNAPSHOT_PATH);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double snapshot_ms = elapsed_ms(&start, &end);
+        if (rc < 0 || server_state.file_total != loaded) {
+            fprintf(out, "Snapshot load failed\n");
+            return 1;
+        }
+        reset_index();
+
+        fprintf(out, "%10d %12.1f %12.1f %12.1f %12.1f %7.1fx\n", files, sqlite_ms, save_ms, snapshot_ms,
+                (double)st.st_size / files, sqlite_ms / snapshot_ms);
+        fflush(out);
+    }
+
+    stmt_cache_finalize(nm_statements, NM_STMT_COUNT);
+    sqlite3_close(server_state.db);
+    unlink(NM_SNAPSHOT_PATH);
+    unlink("data/nameserver.db");
+    unlink("data/nameserver.db-wal");
+    unlink("data/nameserver.db-shm");
+    rmdir("data");
+    unlink("logs/NameServer.log");
+    rmdir("logs");
+    chdir("/");
+    rmdir(dir);
+    return 0;
+}
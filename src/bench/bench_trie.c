@@ -0,0 +1,144 @@
+#include "../../include/common.h"
+#include "../../include/trie.h"
+#include <malloc.h>
+
+// Filename index memory microbenchmark. Inserts a growing number of
+// path-like filenames (~35 bytes) into the trie and reports heap bytes per
+// key, insert and lookup cost, and the time to build and free the whole
+// index (what NM startup and shutdown pay for the namespace).
+//
+//   bench_trie [max_keys] [--legacy]
+//
+// --legacy also builds the original 256-pointer-per-node trie for
+// comparison, up to LEGACY_MAX_KEYS since it needs ~2KB per node.
+
+#define LOOKUPS 1000000
+#define LEGACY_MAX_KEYS 100000
+
+static int legacy_mode = 0;
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static size_t heap_in_use() {
+    // Slabs above the mmap threshold show up in hblkhd, not uordblks
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static void make_key(char* buf, size_t size, int i) {
+    snprintf(buf, size, "team%02d/project_%04d/notes_%07d.txt", i % 97, (i / 97) % 1000, i);
+}
+
+// The trie this benchmark replaced: one 256-pointer node per key byte and a
+// strdup'd filename at every terminal
+typedef struct LegacyNode {
+    struct LegacyNode* children[256];
+    int is_end_of_word;
+    char* filename;
+} LegacyNode;
+
+static void legacy_insert(LegacyNode* root, const char* filename) {
+    LegacyNode* current = root;
+    for (int i = 0; filename[i] != '\0'; i++) {
+        unsigned char index = (unsigned char)filename[i];
+        if (current->children[index] == NULL) {
+            current->children[index] = calloc(1, sizeof(LegacyNode));
+        }
+        current = current->children[index];
+    }
+    current->is_end_of_word = 1;
+    current->filename = strdup(filename);
+}
+
+static void legacy_free(LegacyNode* node) {
+    for (int i = 0; i < 256; i++) {
+        if (node->children[i]) legacy_free(node->children[i]);
+    }
+    free(node->filename);
+    free(node);
+}
+
+static double legacy_bytes_per_key(int keys) {
+    char key[MAX_FILENAME];
+    size_t before = heap_in_use();
+    LegacyNode* root = calloc(1, sizeof(LegacyNode));
+    for (int i = 0; i < keys; i++) {
+        make_key(key, sizeof(key), i);
+        legacy_insert(root, key);
+    }
+    double per_key = (double)(heap_in_use() - before) / keys;
+    legacy_free(root);
+    return per_key;
+}
+
+int main(int argc, char* argv[]) {
+    int max_keys = 1000000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--legacy") == 0) {
+            legacy_mode = 1;
+        } else {
+            max_keys = atoi(argv[i]);
+        }
+    }
+    if (max_keys < 1000) {
+        printf("Usage: %s [max_keys >= 1000] [--legacy]\n", argv[0]);
+        return 1;
+    }
+
+    printf("Filename index, ~35-byte keys\n");
+    printf("%10s %12s %12s %12s %12s %10s %10s%s\n", "keys", "heap B/key", "trie B/key",
+           "insert ns", "lookup ns", "build ms", "free ms", legacy_mode ? "  legacy B/key" : "");
+
+    char key[MAX_FILENAME];
+    for (int keys = 1000; ; keys = keys * 10 < max_keys ? keys * 10 : max_keys) {
+        size_t before = heap_in_use();
+        Trie* trie = trie_create();
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < keys; i++) {
+            make_key(key, sizeof(key), i);
+            trie_insert(trie, key);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double build_ns = elapsed_ns(&start, &end);
+        double heap_per_key = (double)(heap_in_use() - before) / keys;
+
+        // Key formatting is included in both timings
+        unsigned int seed = 42;
+        int found = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < LOOKUPS; i++) {
+            make_key(key, sizeof(key), rand_r(&seed) % keys);
+            found += trie_search(trie, key);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (found != LOOKUPS) {
+            printf("Lookup missed %d keys\n", LOOKUPS - found);
+        }
+
+        double lookup_ns = elapsed_ns(&start, &end) / LOOKUPS;
+        double trie_per_key = (double)trie->bytes / keys;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        trie_free(trie);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        printf("%10d %12.1f %12.1f %12.1f %12.1f %10.1f %10.1f", keys, heap_per_key, trie_per_key,
+               build_ns / keys, lookup_ns, build_ns / 1e6, elapsed_ns(&start, &end) / 1e6);
+        if (legacy_mode) {
+            if (keys <= LEGACY_MAX_KEYS) {
+                printf(" %14.1f", legacy_bytes_per_key(keys));
+            } else {
+                printf(" %14s", "-");
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+
+        if (keys == max_keys) break;
+    }
+    return 0;
+}
@@ -12,13 +12,14 @@ void cmd_create(const char* filename) {
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -57,13 +58,14 @@ void cmd_read(const char* filename) {
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -90,29 +92,67 @@ void cmd_read(const char* filename) {
     }
 }
 
-void cmd_write(const char* args) {
-    char filename[MAX_FILENAME];
-    int sentence_num;
-    
-    if (sscanf(args, "%s %d", filename, &sentence_num) != 2) {
-        printf("Usage: WRITE <filename> <sentence_number>\n");
-        return;
+// WRITE_LOCK both takes the sentence locks and renews leases we hold.
+// With wait_ms the NM queues us behind other writers instead of failing.
+static int request_write_lock(const char* filename, const char* spec, int wait_ms, Message* resp) {
+    Message msg;
+    init_message(&msg);
+    strcpy(msg.type, MSG_WRITE_LOCK);
+    strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
+    strncpy(msg.filename, filename, MAX_FILENAME - 1);
+    if (wait_ms > 0) {
+        snprintf(msg.data, sizeof(msg.data), "%s -w %d", spec, wait_ms);
+    } else {
+        snprintf(msg.data, sizeof(msg.data), "%s", spec);
     }
     
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
+        return -1;
+    }
+    return nm_wait_response(request_id, resp);
+}
+
+// ETIRW after a successful write, WRITE_UNLOCK for an abandoned edit (so
+// the sentences are free now rather than when the lease runs out)
+static void release_write_lock(const char* type, const char* filename, const char* spec) {
     Message msg;
     init_message(&msg);
-    strcpy(msg.type, MSG_WRITE_LOCK);
+    strcpy(msg.type, type);
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
-    snprintf(msg.data, sizeof(msg.data), "%d", sentence_num);
+    snprintf(msg.data, sizeof(msg.data), "%s", spec);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
-        printf("Error: Failed to send request\n");
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id != 0) {
+        Message resp;
+        nm_wait_response(request_id, &resp);
+    }
+}
+
+typedef char WordList[MAX_WORDS_PER_SENTENCE][MAX_WORD];
+
+void cmd_write(const char* args) {
+    char filename[MAX_FILENAME];
+    char spec[SENTENCE_SPEC_MAX];
+    int targets[MAX_SENTENCES];
+    int target_count = -1;
+    int wait_ms = 0;
+    
+    int fields = sscanf(args, "%255s %127s -w %d", filename, spec, &wait_ms);
+    if (fields >= 2) {
+        target_count = parse_sentence_set(spec, targets, MAX_SENTENCES);
+    }
+    if (target_count <= 0 || (strstr(args, " -w") && fields != 3) ||
+        wait_ms < 0 || wait_ms > WRITE_LOCK_MAX_WAIT_MS) {
+        printf("Usage: WRITE <filename> <sentence|first-last|a,b,...> [-w <wait_ms, up to %d>]\n",
+               WRITE_LOCK_MAX_WAIT_MS);
         return;
     }
     
+    // One request locks the whole set, or none of it
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (request_write_lock(filename, spec, wait_ms, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -125,8 +165,21 @@ void cmd_write(const char* args) {
     char ss_info[BUFFER_SIZE];
     strncpy(ss_info, resp.data, sizeof(ss_info) - 1);
     
-    printf("Lock acquired for sentence %d. Enter word edits:\n", sentence_num);
-    printf("Format: <word_index> <new_content>\n");
+    // The locks last LEASE seconds; renew them halfway through
+    int lease = 0;
+    const char* lease_part = strstr(ss_info, "|LEASE:");
+    if (lease_part) {
+        sscanf(lease_part, "|LEASE:%d", &lease);
+    }
+    time_t renewed_at = time(NULL);
+    
+    if (target_count == 1) {
+        printf("Lock acquired for sentence %d. Enter word edits:\n", targets[0]);
+        printf("Format: <word_index> <new_content>\n");
+    } else {
+        printf("Locks acquired for sentences %s. Enter word edits:\n", spec);
+        printf("Format: <sentence> <word_index> <new_content>\n");
+    }
     printf("Type 'ETIRW' when done.\n\n");
     
     Message read_msg;
@@ -138,6 +191,7 @@ void cmd_write(const char* args) {
     Message read_resp;
     if (contact_storage_server(ss_info, &read_msg, &read_resp) != 0 || read_resp.error_code != ERR_SUCCESS) {
         printf("Error: Could not read current content\n");
+        release_write_lock(MSG_WRITE_UNLOCK, filename, spec);
         return;
     }
     
@@ -148,58 +202,111 @@ void cmd_write(const char* args) {
     int sentence_count = parse_sentences(current_content, sentences, MAX_SENTENCES);
     
     // Allow creating sentence 0 for empty files, or editing existing sentences
-    if (sentence_num > sentence_count || (sentence_num == sentence_count && sentence_num > 0)) {
+    int last = targets[target_count - 1];
+    if (last > sentence_count || (last == sentence_count && last > 0)) {
         printf("Error: Invalid sentence number (max: %d)\n", sentence_count);
+        release_write_lock(MSG_WRITE_UNLOCK, filename, spec);
         return;
     }
     
     // For new sentence (empty file), start with empty sentence
-    if (sentence_num == sentence_count) {
-        sentences[sentence_num][0] = '\0';
+    if (last == sentence_count) {
+        sentences[last][0] = '\0';
         sentence_count++;
     }
     
-    printf("Current sentence: %s\n\n", sentences[sentence_num]);
-    
-    char words[MAX_WORDS_PER_SENTENCE][MAX_WORD];
-    int word_count = parse_words(sentences[sentence_num], words, MAX_WORDS_PER_SENTENCE);
+    WordList* words = malloc(target_count * sizeof(WordList));
+    int word_counts[MAX_SENTENCES];
+    if (!words) {
+        printf("Error: Out of memory\n");
+        release_write_lock(MSG_WRITE_UNLOCK, filename, spec);
+        return;
+    }
+    for (int t = 0; t < target_count; t++) {
+        if (target_count == 1) {
+            printf("Current sentence: %s\n", sentences[targets[t]]);
+        } else {
+            printf("Current sentence %d: %s\n", targets[t], sentences[targets[t]]);
+        }
+        word_counts[t] = parse_words(sentences[targets[t]], words[t], MAX_WORDS_PER_SENTENCE);
+    }
+    printf("\n");
     
     char line[256];
     while (1) {
         printf("> ");
         if (!fgets(line, sizeof(line), stdin)) break;
         
+        if (lease > 0) {
+            time_t now = time(NULL);
+            if (now - renewed_at >= lease) {
+                // Someone else may have edited the sentences since
+                printf("Error: Lock on sentence %s expired; run WRITE again\n", spec);
+                release_write_lock(MSG_WRITE_UNLOCK, filename, spec);
+                free(words);
+                return;
+            }
+            if (now - renewed_at >= lease / 2) {
+                if (request_write_lock(filename, spec, 0, &resp) < 0 || resp.error_code != ERR_SUCCESS) {
+                    printf("Error: Could not renew lock on sentence %s\n", spec);
+                    free(words);
+                    return;
+                }
+                renewed_at = now;
+            }
+        }
+        
         char* trimmed = trim(line);
         if (strcmp(trimmed, "ETIRW") == 0) {
             break;
         }
         
+        int t = 0;
         int word_idx;
         char new_word[MAX_WORD];
-        if (sscanf(trimmed, "%d %s", &word_idx, new_word) == 2) {
+        int parsed;
+        if (target_count == 1) {
+            parsed = sscanf(trimmed, "%d %127s", &word_idx, new_word) == 2;
+        } else {
+            int sentence_num;
+            parsed = sscanf(trimmed, "%d %d %127s", &sentence_num, &word_idx, new_word) == 3;
+            while (parsed && t < target_count && targets[t] != sentence_num) t++;
+            if (parsed && t == target_count) {
+                printf("Error: Sentence %d is not locked (locked: %s)\n", sentence_num, spec);
+                continue;
+            }
+        }
+        
+        if (parsed) {
             // Allow adding new words sequentially or editing existing ones
-            if (word_idx >= 0 && word_idx <= word_count && word_idx < MAX_WORDS_PER_SENTENCE) {
-                strcpy(words[word_idx], new_word);
-                if (word_idx == word_count) {
-                    word_count++; // Added new word
+            int* word_count = &word_counts[t];
+            if (word_idx >= 0 && word_idx <= *word_count && word_idx < MAX_WORDS_PER_SENTENCE) {
+                strcpy(words[t][word_idx], new_word);
+                if (word_idx == *word_count) {
+                    (*word_count)++; // Added new word
                     printf("Word %d added: '%s'\n", word_idx, new_word);
                 } else {
                     printf("Word %d updated to '%s'\n", word_idx, new_word);
                 }
             } else {
-                printf("Error: Invalid word index (0-%d)\n", word_count);
+                printf("Error: Invalid word index (0-%d)\n", *word_count);
             }
-        } else {
+        } else if (target_count == 1) {
             printf("Invalid format. Use: <word_index> <new_content>\n");
+        } else {
+            printf("Invalid format. Use: <sentence> <word_index> <new_content>\n");
         }
     }
     
-    char new_sentence[MAX_SENTENCE] = {0};
-    for (int i = 0; i < word_count; i++) {
-        if (i > 0) strcat(new_sentence, " ");
-        strcat(new_sentence, words[i]);
+    for (int t = 0; t < target_count; t++) {
+        char new_sentence[MAX_SENTENCE] = {0};
+        for (int i = 0; i < word_counts[t]; i++) {
+            if (i > 0) strcat(new_sentence, " ");
+            strcat(new_sentence, words[t][i]);
+        }
+        strcpy(sentences[targets[t]], new_sentence);
     }
-    strcpy(sentences[sentence_num], new_sentence);
+    free(words);
     
     char new_content[BUFFER_SIZE] = {0};
     for (int i = 0; i < sentence_count; i++) {
@@ -217,22 +324,16 @@ void cmd_write(const char* args) {
     Message write_resp;
     if (contact_storage_server(ss_info, &write_msg, &write_resp) == 0) {
         if (write_resp.error_code == ERR_SUCCESS) {
-            Message commit_msg;
-            init_message(&commit_msg);
-            strcpy(commit_msg.type, MSG_WRITE_COMMIT);
-            strncpy(commit_msg.username, client_state.username, MAX_USERNAME - 1);
-            strncpy(commit_msg.filename, filename, MAX_FILENAME - 1);
-            snprintf(commit_msg.data, sizeof(commit_msg.data), "%d", sentence_num);
-            
-            send_message(client_state.nm_socket, &commit_msg);
-            receive_message(client_state.nm_socket, &resp);
-            
+            // One ETIRW releases every sentence of the set
+            release_write_lock(MSG_WRITE_COMMIT, filename, spec);
             printf("Write completed successfully\n");
         } else {
             printf("Error: %s\n", write_resp.error_msg);
+            release_write_lock(MSG_WRITE_UNLOCK, filename, spec);
         }
     } else {
         printf("Error: Failed to contact storage server\n");
+        release_write_lock(MSG_WRITE_UNLOCK, filename, spec);
     }
 }
 
@@ -248,13 +349,14 @@ void cmd_delete(const char* filename) {
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -286,24 +388,54 @@ void cmd_view(const char* flags) {
     init_message(&msg);
     strcpy(msg.type, MSG_VIEW);
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
-    strncpy(msg.data, flags, sizeof(msg.data) - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    // "-c <cursor>" resumes an earlier listing; everything else goes to the NM as-is
+    char options[256] = "";
+    char buf[512];
+    strncpy(buf, flags, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    char* save = NULL;
+    for (char* tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        if (strcmp(tok, "-c") == 0) {
+            char* cursor = strtok_r(NULL, " \t", &save);
+            if (cursor) {
+                strncpy(msg.filename, cursor, sizeof(msg.filename) - 1);
+            }
+            continue;
+        }
+        size_t used = strlen(options);
+        snprintf(options + used, sizeof(options) - used, "%s%s", used ? " " : "", tok);
+    }
+    strcpy(msg.data, options);
+    
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
+    // Pages arrive as VIEW_PAGE frames until the final VIEW reply
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
-        printf("Error: Failed to receive response\n");
-        return;
+    printf("\n");
+    while (1) {
+        if (nm_wait_response(request_id, &resp) < 0) {
+            printf("Error: Failed to receive response\n");
+            return;
+        }
+        if (resp.error_code != ERR_SUCCESS) {
+            printf("Error: %s\n", resp.error_msg);
+            return;
+        }
+        fputs(resp.data, stdout);
+        if (strcmp(resp.type, MSG_VIEW_PAGE) != 0) {
+            break;
+        }
     }
     
-    if (resp.error_code == ERR_SUCCESS) {
-        printf("\n%s\n", resp.data);
-    } else {
-        printf("Error: %s\n", resp.error_msg);
+    if (resp.filename[0]) {
+        printf("-- more: VIEW %s%s-c %s\n", options, options[0] ? " " : "", resp.filename);
     }
+    printf("\n");
 }
 
 void cmd_info(const char* filename) {
@@ -318,13 +450,14 @@ void cmd_info(const char* filename) {
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -364,13 +497,14 @@ void cmd_stream(const char* filename) {
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -393,6 +527,7 @@ void cmd_stream(const char* filename) {
         strcpy(ss_msg.type, MSG_STREAM);
         strncpy(ss_msg.username, client_state.username, MAX_USERNAME - 1);
         strncpy(ss_msg.filename, filename, MAX_FILENAME - 1);
+        apply_storage_key(resp.data, &ss_msg);
         
         if (send_message(ss_sock, &ss_msg) < 0) {
             printf("Error: Failed to send stream request\n");
@@ -416,12 +551,12 @@ void cmd_stream(const char* filename) {
                 break;
             }
             
-            if (strcmp(word_msg.type, "STREAM_END") == 0) {
+            if (strcmp(word_msg.type, MSG_STREAM_END) == 0) {
                 printf("\n[Stream complete]\n");
                 break;
             }
             
-            if (strcmp(word_msg.type, "STREAM_WORD") == 0) {
+            if (strcmp(word_msg.type, MSG_STREAM_WORD) == 0) {
                 printf("%s ", word_msg.data);
                 fflush(stdout);
             }
@@ -433,28 +568,56 @@ void cmd_stream(const char* filename) {
     }
 }
 
-void cmd_list() {
+void cmd_list(const char* args) {
+    // LIST [-n page_size] [-c cursor]
     Message msg;
     init_message(&msg);
     strcpy(msg.type, MSG_LIST);
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    int page_size = -1;
+    char buf[512];
+    strncpy(buf, args, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    char* save = NULL;
+    for (char* tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        char* value = NULL;
+        if ((strcmp(tok, "-c") != 0 && strcmp(tok, "-n") != 0) || !(value = strtok_r(NULL, " \t", &save))) {
+            printf("Usage: LIST [-n page_size] [-c cursor]\n");
+            return;
+        }
+        if (tok[1] == 'c') {
+            strncpy(msg.filename, value, sizeof(msg.filename) - 1);
+        } else {
+            page_size = atoi(value);
+        }
+    }
+    if (page_size >= 0) {
+        snprintf(msg.data, sizeof(msg.data), "-n %d", page_size);
+    }
+    
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Connection to Name Server lost. Please restart the client.\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Connection to Name Server lost. Please restart the client.\n");
         return;
     }
     
-    if (resp.error_code == ERR_SUCCESS) {
-        printf("\n%s\n", resp.data);
-    } else {
+    if (resp.error_code != ERR_SUCCESS) {
         printf("Error: %s\n", resp.error_msg);
+        return;
+    }
+    
+    printf("\n%s", resp.data);
+    if (resp.filename[0]) {
+        printf("-- more: LIST %s%s-c %s\n", msg.data, msg.data[0] ? " " : "", resp.filename);
     }
+    printf("\n");
 }
 
 void cmd_undo(const char* filename) {
@@ -469,13 +632,14 @@ void cmd_undo(const char* filename) {
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -527,13 +691,14 @@ void cmd_addaccess(const char* args) {
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     snprintf(msg.data, sizeof(msg.data), "%s|%d", username, permissions);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -560,13 +725,14 @@ void cmd_remaccess(const char* args) {
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     strncpy(msg.data, username, sizeof(msg.data) - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -590,13 +756,14 @@ void cmd_exec(const char* filename) {
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -642,13 +809,14 @@ void cmd_createfolder(const char* foldername) {
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     strncpy(msg.filename, foldername, MAX_FILENAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -675,13 +843,14 @@ void cmd_checkpoint(const char* args) {
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     snprintf(msg.data, sizeof(msg.data), "CREATE|%s", tag);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -718,13 +887,14 @@ void cmd_listcheckpoints(const char* filename) {
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     strcpy(msg.data, "LIST");
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -763,13 +933,14 @@ void cmd_revert(const char* args) {
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     snprintf(msg.data, sizeof(msg.data), "REVERT|%s", tag);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -17,13 +17,14 @@ void cmd_requestaccess(const char* args) {
     strncpy(msg.filename, filename, MAX_FILENAME - 1);
     snprintf(msg.data, sizeof(msg.data), "REQUEST|%d", atype);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         printf("Error: Failed to send request\n");
         return;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         printf("Error: Failed to receive response\n");
         return;
     }
@@ -34,3 +35,319 @@ void cmd_requestaccess(const char* args) {
         printf("Error: %s\n", resp.error_msg);
     }
 }
+
+typedef struct {
+    char type[32];
+    char filename[MAX_FILENAME];
+    char data[MAX_USERNAME + 16];
+} BatchOp;
+
+// Frames per pipelined burst; bounds the reply bytes queued on the socket
+#define MULTI_PIPELINE_DEPTH 4
+
+static int parse_batch_line(const char* line, BatchOp* op) {
+    char cmd[32], arg1[MAX_FILENAME], arg2[MAX_FILENAME], arg3[MAX_USERNAME];
+    int n = sscanf(line, "%31s %255s %255s %63s", cmd, arg1, arg2, arg3);
+    
+    memset(op, 0, sizeof(*op));
+    if (n == 2 && (strcmp(cmd, "CREATE") == 0 || strcmp(cmd, "READ") == 0)) {
+        strcpy(op->type, strcmp(cmd, "CREATE") == 0 ? MSG_CREATE : MSG_READ);
+        strcpy(op->filename, arg1);
+        return 0;
+    }
+    if (n == 4 && strcmp(cmd, "ADDACCESS") == 0 &&
+        (strcmp(arg1, "-R") == 0 || strcmp(arg1, "-W") == 0)) {
+        strcpy(op->type, MSG_ADDACCESS);
+        strcpy(op->filename, arg2);
+        snprintf(op->data, sizeof(op->data), "%s|%d", arg3,
+                strcmp(arg1, "-R") == 0 ? ACCESS_READ : ACCESS_WRITE);
+        return 0;
+    }
+    return -1;
+}
+
+static void report_batch_result(const BatchOp* op, int error_code, const char* text, int* ok, int* failed) {
+    if (error_code != ERR_SUCCESS) {
+        printf("  %s %s: Error: %s\n", op->type, op->filename, text);
+        (*failed)++;
+        return;
+    }
+    
+    if (strcmp(op->type, MSG_CREATE) == 0) {
+        // Metadata is committed; the storage server still has to create the file
+        Message ss_msg;
+        init_message(&ss_msg);
+        strcpy(ss_msg.type, MSG_CREATE);
+        strncpy(ss_msg.username, client_state.username, MAX_USERNAME - 1);
+        strncpy(ss_msg.filename, op->filename, MAX_FILENAME - 1);
+        
+        Message ss_resp;
+        if (contact_storage_server(text, &ss_msg, &ss_resp) != 0 || ss_resp.error_code != ERR_SUCCESS) {
+            printf("  CREATE %s: Error: Failed to create on storage server\n", op->filename);
+            (*failed)++;
+            return;
+        }
+    } else if (strcmp(op->type, MSG_READ) == 0) {
+        printf("  READ %s: %s\n", op->filename, text);
+    }
+    (*ok)++;
+}
+
+void cmd_multi(const char* script) {
+    if (strlen(script) == 0) {
+        printf("Usage: MULTI <batch_file>\n");
+        return;
+    }
+    
+    FILE* fp = fopen(script, "r");
+    if (!fp) {
+        printf("Error: Cannot open '%s'\n", script);
+        return;
+    }
+    
+    int op_capacity = 256, op_count = 0;
+    BatchOp* ops = malloc(sizeof(BatchOp) * op_capacity);
+    char line[512];
+    int line_no = 0;
+    while (ops && fgets(line, sizeof(line), fp)) {
+        line_no++;
+        char* trimmed = trim(line);
+        if (strlen(trimmed) == 0 || trimmed[0] == '#') continue;
+        
+        if (op_count == op_capacity) {
+            op_capacity *= 2;
+            BatchOp* grown = realloc(ops, sizeof(BatchOp) * op_capacity);
+            if (!grown) break;
+            ops = grown;
+        }
+        if (parse_batch_line(trimmed, &ops[op_count]) < 0) {
+            printf("Line %d skipped (expected CREATE <f>, READ <f> or ADDACCESS -R|-W <f> <user>)\n", line_no);
+            continue;
+        }
+        op_count++;
+    }
+    fclose(fp);
+    
+    Message* msgs = malloc(sizeof(Message) * MULTI_PIPELINE_DEPTH);
+    Message* resps = malloc(sizeof(Message) * MULTI_PIPELINE_DEPTH);
+    if (!ops || !msgs || !resps) {
+        printf("Error: Out of memory\n");
+        free(ops);
+        free(msgs);
+        free(resps);
+        return;
+    }
+    
+    int ok = 0, failed = 0, next = 0;
+    while (next < op_count) {
+        // Pack up to MULTI_PIPELINE_DEPTH frames of MULTI_MAX_OPS operations each
+        int frame_start[MULTI_PIPELINE_DEPTH];
+        int frames = 0;
+        while (frames < MULTI_PIPELINE_DEPTH && next < op_count) {
+            Message* m = &msgs[frames];
+            init_message(m);
+            strcpy(m->type, MSG_MULTI);
+            strncpy(m->username, client_state.username, MAX_USERNAME - 1);
+            
+            frame_start[frames] = next;
+            size_t len = 0;
+            for (int k = 0; k < MULTI_MAX_OPS && next < op_count; k++, next++) {
+                len += snprintf(m->data + len, sizeof(m->data) - len, "%s|%s|%s\n",
+                               ops[next].type, ops[next].filename, ops[next].data);
+            }
+            frames++;
+        }
+        
+        if (nm_pipeline(msgs, resps, frames) < 0) {
+            printf("Error: Connection to Name Server lost\n");
+            break;
+        }
+        
+        for (int f = 0; f < frames; f++) {
+            int frame_ops = (f + 1 < frames ? frame_start[f + 1] : next) - frame_start[f];
+            if (resps[f].error_code != ERR_SUCCESS) {
+                printf("  Batch of %d operations failed: %s\n", frame_ops, resps[f].error_msg);
+                failed += frame_ops;
+                continue;
+            }
+            
+            // Each reply line: index|error_code|data-or-error
+            char* saveptr = NULL;
+            for (char* item = strtok_r(resps[f].data, "\n", &saveptr); item;
+                 item = strtok_r(NULL, "\n", &saveptr)) {
+                int idx, code, consumed = 0;
+                if (sscanf(item, "%d|%d|%n", &idx, &code, &consumed) != 2 ||
+                    idx < 0 || idx >= frame_ops) {
+                    continue;
+                }
+                report_batch_result(&ops[frame_start[f] + idx], code, item + consumed, &ok, &failed);
+            }
+        }
+    }
+    
+    printf("MULTI: %d operations, %d succeeded, %d failed\n", op_count, ok, failed);
+    
+    free(ops);
+    free(msgs);
+    free(resps);
+}
+
+int nm_search(const char* prefix, const char* after, int page_size, Message* resp) {
+    Message msg;
+    init_message(&msg);
+    strcpy(msg.type, MSG_SEARCH);
+    strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
+    strncpy(msg.filename, after, MAX_FILENAME - 1);
+    snprintf(msg.data, sizeof(msg.data), "-n %d %s", page_size, prefix);
+    
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
+        return -1;
+    }
+    return nm_wait_response(request_id, resp);
+}
+
+void cmd_search(const char* args) {
+    // SEARCH <prefix> [-n page_size] [-c resume_key]
+    char prefix[MAX_FILENAME] = "";
+    char after[MAX_FILENAME] = "";
+    int page_size = SEARCH_DEFAULT_PAGE_SIZE;
+    
+    char buf[512];
+    strncpy(buf, args, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    char* save = NULL;
+    for (char* tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        if (strcmp(tok, "-c") == 0 || strcmp(tok, "-n") == 0) {
+            char* value = strtok_r(NULL, " \t", &save);
+            if (!value) {
+                printf("Usage: SEARCH <prefix> [-n page_size] [-c resume_key]\n");
+                return;
+            }
+            if (tok[1] == 'c') {
+                strncpy(after, value, sizeof(after) - 1);
+            } else {
+                page_size = atoi(value);
+            }
+        } else {
+            strncpy(prefix, tok, sizeof(prefix) - 1);
+        }
+    }
+    
+    Message resp;
+    if (nm_search(prefix, after, page_size, &resp) < 0) {
+        printf("Error: Failed to receive response\n");
+        return;
+    }
+    if (resp.error_code != ERR_SUCCESS) {
+        printf("Error: %s\n", resp.error_msg);
+        return;
+    }
+    
+    printf("\n");
+    if (resp.data[0]) {
+        fputs(resp.data, stdout);
+    } else if (!after[0] && !resp.filename[0]) {
+        printf("No matching files\n");
+    }
+    if (resp.filename[0]) {
+        printf("-- more: SEARCH %s -n %d -c %s\n", prefix, page_size, resp.filename);
+    }
+    printf("\n");
+}
+
+void cmd_move(const char* args) {
+    char path[MAX_FILENAME], dest[MAX_FILENAME];
+    
+    if (sscanf(args, "%255s %255s", path, dest) != 2) {
+        printf("Usage: MOVE <path> <folder|new_path|/>\n");
+        return;
+    }
+    
+    Message msg;
+    init_message(&msg);
+    strcpy(msg.type, MSG_MOVE);
+    strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
+    strncpy(msg.filename, path, MAX_FILENAME - 1);
+    strncpy(msg.data, dest, sizeof(msg.data) - 1);
+    
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
+        printf("Error: Failed to send request\n");
+        return;
+    }
+    
+    Message resp;
+    if (nm_wait_response(request_id, &resp) < 0) {
+        printf("Error: Failed to receive response\n");
+        return;
+    }
+    
+    if (resp.error_code == ERR_SUCCESS) {
+        printf("%s\n", resp.data);
+    } else {
+        printf("Error: %s\n", resp.error_msg);
+    }
+}
+
+void cmd_viewfolder(const char* args) {
+    // VIEWFOLDER [folder] [-n page_size] [-c resume_key]
+    char folder[MAX_FILENAME] = "";
+    char after[MAX_FILENAME] = "";
+    int page_size = VIEWFOLDER_DEFAULT_PAGE_SIZE;
+    
+    char buf[512];
+    strncpy(buf, args, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    char* save = NULL;
+    for (char* tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        if (strcmp(tok, "-c") == 0 || strcmp(tok, "-n") == 0) {
+            char* value = strtok_r(NULL, " \t", &save);
+            if (!value) {
+                printf("Usage: VIEWFOLDER [folder] [-n page_size] [-c resume_key]\n");
+                return;
+            }
+            if (tok[1] == 'c') {
+                strncpy(after, value, sizeof(after) - 1);
+            } else {
+                page_size = atoi(value);
+            }
+        } else {
+            strncpy(folder, tok, sizeof(folder) - 1);
+        }
+    }
+    
+    Message msg;
+    init_message(&msg);
+    strcpy(msg.type, MSG_VIEWFOLDER);
+    strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
+    strncpy(msg.filename, after, MAX_FILENAME - 1);
+    snprintf(msg.data, sizeof(msg.data), "-n %d %s", page_size, folder);
+    
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
+        printf("Error: Failed to send request\n");
+        return;
+    }
+    
+    Message resp;
+    if (nm_wait_response(request_id, &resp) < 0) {
+        printf("Error: Failed to receive response\n");
+        return;
+    }
+    if (resp.error_code != ERR_SUCCESS) {
+        printf("Error: %s\n", resp.error_msg);
+        return;
+    }
+    
+    printf("\n");
+    if (resp.data[0]) {
+        fputs(resp.data, stdout);
+    } else if (!after[0]) {
+        printf("(empty)\n");
+    }
+    if (resp.filename[0]) {
+        printf("-- more: VIEWFOLDER %s%s-n %d -c %s\n", folder, folder[0] ? " " : "", page_size, resp.filename);
+    }
+    printf("\n");
+}
@@ -4,6 +4,10 @@
 
 ClientState client_state;
 
+// Replies that arrived while the caller was waiting on a different request
+static Message* stashed_replies[NM_MAX_IN_FLIGHT];
+static int stashed_count = 0;
+
 int main(int argc, char* argv[]) {
     if (argc != 2) {
         printf("Usage: %s <username>\n", argv[0]);
@@ -51,13 +55,14 @@ int connect_to_nameserver() {
     strcpy(msg.type, MSG_REGISTER_CLIENT);
     strncpy(msg.username, client_state.username, MAX_USERNAME - 1);
     
-    if (send_message(client_state.nm_socket, &msg) < 0) {
+    uint32_t request_id = nm_send_request(&msg);
+    if (request_id == 0) {
         close(client_state.nm_socket);
         return -1;
     }
     
     Message resp;
-    if (receive_message(client_state.nm_socket, &resp) < 0) {
+    if (nm_wait_response(request_id, &resp) < 0) {
         close(client_state.nm_socket);
         return -1;
     }
@@ -72,9 +77,60 @@ int connect_to_nameserver() {
     return -1;
 }
 
+static const char* shell_commands[] = {
+    "CREATE", "READ", "WRITE", "DELETE", "VIEW", "SEARCH", "INFO", "STREAM", "LIST",
+    "UNDO", "ADDACCESS", "REMACCESS", "EXEC", "CREATEFOLDER", "CHECKPOINT",
+    "LISTCHECKPOINTS", "REVERT", "REQUESTACCESS", "MULTI", "MOVE", "VIEWFOLDER", "help", "exit", NULL
+};
+
+static char* command_generator(const char* text, int state) {
+    static int index;
+    if (state == 0) {
+        index = 0;
+    }
+    while (shell_commands[index]) {
+        const char* cmd = shell_commands[index++];
+        if (strncmp(cmd, text, strlen(text)) == 0) {
+            return strdup(cmd);
+        }
+    }
+    return NULL;
+}
+
+// Filenames come from one SEARCH page per completion, so only readable files
+// are offered and a prefix matching thousands of names stays one round trip
+static char* filename_generator(const char* text, int state) {
+    static char names[BUFFER_SIZE];
+    static char* next;
+    if (state == 0) {
+        Message resp;
+        names[0] = '\0';
+        if (nm_search(text, "", COMPLETION_PAGE_SIZE, &resp) == 0 && resp.error_code == ERR_SUCCESS) {
+            strcpy(names, resp.data);
+        }
+        next = names;
+    }
+    if (!*next) {
+        return NULL;
+    }
+    char* end = strchr(next, '\n');
+    size_t len = end ? (size_t)(end - next) : strlen(next);
+    char* name = strndup(next, len);
+    next += end ? len + 1 : len;
+    return name;
+}
+
+static char** complete_shell(const char* text, int start, int end) {
+    (void)end;
+    rl_attempted_completion_over = 1;  // Never fall back to local files
+    return rl_completion_matches(text, start == 0 ? command_generator : filename_generator);
+}
+
 void run_interactive_shell() {
     char* line;
     
+    rl_attempted_completion_function = complete_shell;
+    
     while (1) {
         line = readline("docs++> ");
         
@@ -111,12 +167,14 @@ void run_interactive_shell() {
             cmd_delete(args);
         } else if (strcmp(cmd, "VIEW") == 0) {
             cmd_view(args);
+        } else if (strcmp(cmd, "SEARCH") == 0) {
+            cmd_search(args);
         } else if (strcmp(cmd, "INFO") == 0) {
             cmd_info(args);
         } else if (strcmp(cmd, "STREAM") == 0) {
             cmd_stream(args);
         } else if (strcmp(cmd, "LIST") == 0) {
-            cmd_list();
+            cmd_list(args);
         } else if (strcmp(cmd, "UNDO") == 0) {
             cmd_undo(args);
         } else if (strcmp(cmd, "ADDACCESS") == 0) {
@@ -127,6 +185,10 @@ void run_interactive_shell() {
             cmd_exec(args);
         } else if (strcmp(cmd, "CREATEFOLDER") == 0) {
             cmd_createfolder(args);
+        } else if (strcmp(cmd, "MOVE") == 0) {
+            cmd_move(args);
+        } else if (strcmp(cmd, "VIEWFOLDER") == 0) {
+            cmd_viewfolder(args);
         } else if (strcmp(cmd, "CHECKPOINT") == 0) {
             cmd_checkpoint(args);
         } else if (strcmp(cmd, "LISTCHECKPOINTS") == 0) {
@@ -135,6 +197,8 @@ void run_interactive_shell() {
             cmd_revert(args);
         } else if (strcmp(cmd, "REQUESTACCESS") == 0) {
             cmd_requestaccess(args);
+        } else if (strcmp(cmd, "MULTI") == 0) {
+            cmd_multi(args);
         } else {
             printf("Unknown command: %s\n", cmd);
             printf("Type 'help' for available commands.\n");
@@ -151,6 +215,8 @@ void print_help() {
     printf("  CREATE <filename>                 - Create a new empty file\n");
     printf("  READ <filename>                   - Display file contents\n");
     printf("  WRITE <filename> <sentence#>      - Edit a sentence (then word edits, end with ETIRW)\n");
+    printf("  WRITE <filename> <first-last|a,b> - Lock several sentences at once (edits: <sentence> <word#> <text>)\n");
+    printf("  WRITE ... -w <ms>                 - Wait up to ms for a locked sentence instead of failing\n");
     printf("  DELETE <filename>                 - Delete a file (owner only)\n");
     printf("  UNDO <filename>                   - Undo last change to file\n");
     printf("  INFO <filename>                   - Show file metadata\n");
@@ -161,7 +227,12 @@ void print_help() {
     printf("  VIEW -a                           - List all files\n");
     printf("  VIEW -l                           - List with details\n");
     printf("  VIEW -al                          - List all with details\n");
-    printf("  LIST                              - List all registered users\n");
+    printf("  VIEW ... -n <size> -p <pages>     - Page size / number of pages to fetch\n");
+    printf("  VIEW ... -c <cursor>              - Continue a listing from its cursor\n");
+    printf("  SEARCH <prefix> [-n <size>]       - List your readable files starting with prefix\n");
+    printf("  SEARCH ... -c <key>               - Continue a search from its resume key\n");
+    printf("  LIST [-n N] [-c cursor]           - List registered users, a page at a time\n");
+    printf("  (Tab completes commands and filenames)\n");
     printf("\n");
     printf("Access Control:\n");
     printf("  ADDACCESS -R <file> <user>        - Grant read access\n");
@@ -171,10 +242,14 @@ void print_help() {
     printf("\n");
     printf("Advanced:\n");
     printf("  EXEC <filename>                   - Execute file as shell script\n");
-    printf("  CREATEFOLDER <foldername>         - Create a folder\n");
+    printf("  CREATEFOLDER <foldername>         - Create a folder (inside another as a/b)\n");
+    printf("  VIEWFOLDER [folder] [-n <size>]   - List a folder's readable contents (top level by default)\n");
+    printf("  VIEWFOLDER ... -c <key>           - Continue a listing from its resume key\n");
+    printf("  MOVE <path> <folder|new_path|/>   - Move or rename a file or folder\n");
     printf("  CHECKPOINT <file> <tag>           - Create a checkpoint\n");
     printf("  LISTCHECKPOINTS <file>            - List checkpoints\n");
     printf("  REVERT <file> <tag>               - Revert to checkpoint\n");
+    printf("  MULTI <batch_file>                - Run CREATE/READ/ADDACCESS lines in batched requests\n");
     printf("\n");
     printf("System:\n");
     printf("  help                              - Show this help\n");
@@ -204,6 +279,15 @@ void parse_ss_info(const char* data, char* ip, int* port, char* replica_ip, int*
     }
 }
 
+void apply_storage_key(const char* ss_info, Message* msg) {
+    // "|KEY:<name>" comes last: the file lives on the SS under that name
+    const char* key = strstr(ss_info, "|KEY:");
+    if (key) {
+        strncpy(msg->filename, key + 5, MAX_FILENAME - 1);
+        msg->filename[MAX_FILENAME - 1] = '\0';
+    }
+}
+
 int contact_storage_server(const char* ss_info, Message* msg, Message* resp) {
     char ip[INET_ADDRSTRLEN] = {0};
     int port = 0;
@@ -215,6 +299,7 @@ int contact_storage_server(const char* ss_info, Message* msg, Message* resp) {
     if (port == 0) {
         return -1;
     }
+    apply_storage_key(ss_info, msg);
     
     int ss_sock = connect_to_server(ip, port);
     if (ss_sock < 0) {
@@ -242,3 +327,68 @@ int contact_storage_server(const char* ss_info, Message* msg, Message* resp) {
     close(ss_sock);
     return 0;
 }
+
+uint32_t nm_send_request(Message* msg) {
+    client_state.next_request_id++;
+    if (client_state.next_request_id == 0) {
+        client_state.next_request_id = 1;  // 0 means "no request ID"
+    }
+    msg->request_id = client_state.next_request_id;
+    
+    if (send_message(client_state.nm_socket, msg) < 0) {
+        return 0;
+    }
+    return msg->request_id;
+}
+
+int nm_wait_response(uint32_t request_id, Message* resp) {
+    for (int i = 0; i < stashed_count; i++) {
+        if (stashed_replies[i]->request_id == request_id) {
+            memcpy(resp, stashed_replies[i], sizeof(Message));
+            free(stashed_replies[i]);
+            stashed_replies[i] = stashed_replies[--stashed_count];
+            return 0;
+        }
+    }
+    
+    while (1) {
+        if (receive_message(client_state.nm_socket, resp) < 0) {
+            return -1;
+        }
+        if (resp->request_id == request_id) {
+            return 0;
+        }
+        
+        // Reply to another in-flight request; keep it for its owner
+        if (stashed_count >= NM_MAX_IN_FLIGHT) {
+            return -1;
+        }
+        Message* stash = malloc(sizeof(Message));
+        if (!stash) {
+            return -1;
+        }
+        memcpy(stash, resp, sizeof(Message));
+        stashed_replies[stashed_count++] = stash;
+    }
+}
+
+int nm_pipeline(Message* msgs, Message* resps, int count) {
+    int sent = 0;
+    
+    // Keep up to NM_MAX_IN_FLIGHT requests outstanding; replies are matched
+    // by request ID, so the server may answer them in any order
+    for (int received = 0; received < count; received++) {
+        while (sent < count && sent - received < NM_MAX_IN_FLIGHT) {
+            if (nm_send_request(&msgs[sent]) == 0) {
+                return -1;
+            }
+            sent++;
+        }
+        
+        if (nm_wait_response(msgs[received].request_id, &resps[received]) < 0) {
+            return -1;
+        }
+    }
+    
+    return count;
+}
@@ -0,0 +1,134 @@
+#include "../../include/groupcommit.h"
+#include "../../include/common.h"
+
+// Batch the calling thread last wrote into; workers handle one request at a
+// time, so this identifies the request's own changes
+static __thread unsigned long last_batch = 0;
+
+int parse_durability(const char* name, Durability* out) {
+    if (strcmp(name, "full") == 0) {
+        *out = DURABILITY_FULL;
+    } else if (strcmp(name, "normal") == 0) {
+        *out = DURABILITY_NORMAL;
+    } else if (strcmp(name, "async") == 0) {
+        *out = DURABILITY_ASYNC;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Caller holds gc->mutex
+static void commit_batch(GroupCommit* gc) {
+    if (!gc->in_txn) {
+        return;
+    }
+    
+    char* err_msg = NULL;
+    if (sqlite3_exec(gc->db, "COMMIT;", 0, 0, &err_msg) != SQLITE_OK) {
+        char log_buf[256];
+        snprintf(log_buf, sizeof(log_buf), "Batch %lu commit failed: %s",
+                gc->open_batch, err_msg ? err_msg : "unknown error");
+        log_message("GroupCommit", log_buf);
+        sqlite3_free(err_msg);
+        sqlite3_exec(gc->db, "ROLLBACK;", 0, 0, NULL);
+        gc->failed_batch = gc->open_batch;
+    } else {
+        gc->commits++;
+    }
+    
+    gc->in_txn = 0;
+    gc->resolved_batch = gc->open_batch;
+    pthread_cond_broadcast(&gc->resolved);
+}
+
+static void* commit_thread(void* arg) {
+    GroupCommit* gc = arg;
+    
+    pthread_mutex_lock(&gc->mutex);
+    while (!gc->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)gc->interval_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&gc->wakeup, &gc->mutex, &deadline);
+        
+        commit_batch(gc);
+    }
+    pthread_mutex_unlock(&gc->mutex);
+    return NULL;
+}
+
+int group_commit_init(GroupCommit* gc, sqlite3* db, int interval_ms, Durability durability) {
+    memset(gc, 0, sizeof(*gc));
+    gc->db = db;
+    gc->interval_ms = interval_ms;
+    gc->durability = durability;
+    
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&gc->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&gc->resolved, NULL);
+    pthread_cond_init(&gc->wakeup, NULL);
+    
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL;", 0, 0, NULL);
+    sqlite3_exec(db, durability == DURABILITY_FULL ? "PRAGMA synchronous=FULL;" :
+                                                     "PRAGMA synchronous=NORMAL;", 0, 0, NULL);
+    
+    if (pthread_create(&gc->thread, NULL, commit_thread, gc) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void group_commit_shutdown(GroupCommit* gc) {
+    pthread_mutex_lock(&gc->mutex);
+    gc->stop = 1;
+    pthread_cond_signal(&gc->wakeup);
+    pthread_mutex_unlock(&gc->mutex);
+    pthread_join(gc->thread, NULL);
+    
+    // Flush whatever the last tick did not pick up
+    pthread_mutex_lock(&gc->mutex);
+    commit_batch(gc);
+    pthread_mutex_unlock(&gc->mutex);
+    
+    char log_buf[128];
+    snprintf(log_buf, sizeof(log_buf), "%lu mutations in %lu commits",
+            gc->mutations, gc->commits);
+    log_message("GroupCommit", log_buf);
+}
+
+void group_commit_begin(GroupCommit* gc) {
+    pthread_mutex_lock(&gc->mutex);
+    if (!gc->in_txn) {
+        sqlite3_exec(gc->db, "BEGIN;", 0, 0, NULL);
+        gc->in_txn = 1;
+        gc->open_batch++;
+    }
+    gc->mutations++;
+    last_batch = gc->open_batch;
+}
+
+void group_commit_end(GroupCommit* gc) {
+    pthread_mutex_unlock(&gc->mutex);
+}
+
+int group_commit_wait(GroupCommit* gc) {
+    if (gc->durability == DURABILITY_ASYNC || last_batch == 0) {
+        return 0;
+    }
+    
+    pthread_mutex_lock(&gc->mutex);
+    while (gc->resolved_batch < last_batch) {
+        pthread_cond_wait(&gc->resolved, &gc->mutex);
+    }
+    int failed = gc->failed_batch == last_batch;
+    pthread_mutex_unlock(&gc->mutex);
+    
+    last_batch = 0;
+    return failed ? -1 : 0;
+}
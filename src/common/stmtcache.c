@@ -0,0 +1,43 @@
+#include "../../include/stmtcache.h"
+#include "../../include/common.h"
+
+int stmt_cache_prepare(sqlite3* db, CachedStmt* stmts, int count) {
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_init(&stmts[i].mutex, NULL);
+        if (sqlite3_prepare_v3(db, stmts[i].sql, -1, SQLITE_PREPARE_PERSISTENT,
+                               &stmts[i].stmt, NULL) != SQLITE_OK) {
+            char log_buf[512];
+            snprintf(log_buf, sizeof(log_buf), "Failed to prepare statement: %s (%s)",
+                    stmts[i].sql, sqlite3_errmsg(db));
+            log_message("StmtCache", log_buf);
+            stmts[i].stmt = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void stmt_cache_finalize(CachedStmt* stmts, int count) {
+    for (int i = 0; i < count; i++) {
+        sqlite3_finalize(stmts[i].stmt);
+        stmts[i].stmt = NULL;
+        pthread_mutex_destroy(&stmts[i].mutex);
+    }
+}
+
+sqlite3_stmt* stmt_acquire(CachedStmt* cs) {
+    if (!cs->stmt) {
+        return NULL;
+    }
+    pthread_mutex_lock(&cs->mutex);
+    return cs->stmt;
+}
+
+void stmt_release(CachedStmt* cs) {
+    if (!cs->stmt) {
+        return;
+    }
+    sqlite3_reset(cs->stmt);
+    sqlite3_clear_bindings(cs->stmt);
+    pthread_mutex_unlock(&cs->mutex);
+}
@@ -1,160 +1,712 @@
 #include "../../include/trie.h"
 #include <stdio.h>
 
-static TrieNode* create_node() {
-    TrieNode* node = (TrieNode*)calloc(1, sizeof(TrieNode));
-    node->is_end_of_word = 0;
-    node->filename = NULL;
-    for (int i = 0; i < ALPHABET_SIZE; i++) {
-        node->children[i] = NULL;
+#define IS_LEAF(p) ((uintptr_t)(p) & 1)
+#define LEAF_RAW(p) ((TrieLeaf*)((uintptr_t)(p) & ~(uintptr_t)1))
+#define LEAF_TAG(l) ((TrieNode*)((uintptr_t)(l) | 1))
+
+static int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+static size_t node_size(int type) {
+    switch (type) {
+        case TRIE_NODE4: return sizeof(TrieNode4);
+        case TRIE_NODE16: return sizeof(TrieNode16);
+        case TRIE_NODE48: return sizeof(TrieNode48);
+        default: return sizeof(TrieNode256);
+    }
+}
+
+// Slab header padded so blocks keep TRIE_ALIGN alignment
+#define SLAB_HEADER ((sizeof(TrieSlab) + TRIE_ALIGN - 1) / TRIE_ALIGN * TRIE_ALIGN)
+
+static void* arena_alloc(Trie* trie, size_t size) {
+    TrieArena* arena = &trie->arena;
+    int cls = (size + TRIE_ALIGN - 1) / TRIE_ALIGN;
+    size_t rounded = (size_t)cls * TRIE_ALIGN;
+    void** head = &arena->free_lists[cls - 1];
+
+    void* block = *head;
+    if (block) {
+        *head = *(void**)block;
+    } else {
+        if (arena->bump + rounded > arena->bump_end) {
+            TrieSlab* slab = malloc(TRIE_SLAB_SIZE);
+            if (!slab) return NULL;
+            slab->next = arena->slabs;
+            arena->slabs = slab;
+            arena->slab_bytes += TRIE_SLAB_SIZE;
+            arena->bump = (char*)slab + SLAB_HEADER;
+            arena->bump_end = (char*)slab + TRIE_SLAB_SIZE;
+        }
+        block = arena->bump;
+        arena->bump += rounded;
+    }
+    trie->bytes += rounded;
+    return block;
+}
+
+static void arena_free(Trie* trie, void* block, size_t size) {
+    int cls = (size + TRIE_ALIGN - 1) / TRIE_ALIGN;
+    *(void**)block = trie->arena.free_lists[cls - 1];
+    trie->arena.free_lists[cls - 1] = block;
+    trie->bytes -= (size_t)cls * TRIE_ALIGN;
+}
+
+// Only the header and the arrays searched by value need zeroing; node4 and
+// node16 read just their first num_children entries
+static TrieNode* alloc_node(Trie* trie, int type) {
+    TrieNode* node = arena_alloc(trie, node_size(type));
+    if (!node) return NULL;
+    memset(node, 0, sizeof(TrieNode));
+    node->type = type;
+    if (type == TRIE_NODE48) {
+        TrieNode48* n = (TrieNode48*)node;
+        memset(n->child_index, 0, sizeof(n->child_index));
+        memset(n->children, 0, sizeof(n->children));
+    } else if (type == TRIE_NODE256) {
+        memset(((TrieNode256*)node)->children, 0, sizeof(((TrieNode256*)node)->children));
     }
     return node;
 }
 
-Trie* trie_create() {
-    Trie* trie = (Trie*)malloc(sizeof(Trie));
-    trie->root = create_node();
-    trie->size = 0;
-    return trie;
+static void free_inner(Trie* trie, TrieNode* node) {
+    arena_free(trie, node, node_size(node->type));
 }
 
-void trie_insert(Trie* trie, const char* filename) {
-    TrieNode* current = trie->root;
-    
-    for (int i = 0; filename[i] != '\0'; i++) {
-        unsigned char index = (unsigned char)filename[i];
-        if (current->children[index] == NULL) {
-            current->children[index] = create_node();
+static TrieLeaf* alloc_leaf(Trie* trie, const unsigned char* key, int key_len) {
+    TrieLeaf* leaf = arena_alloc(trie, sizeof(TrieLeaf) + key_len);
+    if (!leaf) return NULL;
+    leaf->key_len = key_len;
+    memcpy(leaf->key, key, key_len);
+    return leaf;
+}
+
+static void free_leaf(Trie* trie, TrieLeaf* leaf) {
+    arena_free(trie, leaf, sizeof(TrieLeaf) + leaf->key_len);
+}
+
+static int leaf_matches(const TrieLeaf* leaf, const unsigned char* key, int key_len) {
+    return (int)leaf->key_len == key_len && memcmp(leaf->key, key, key_len) == 0;
+}
+
+// Slot holding the child for byte c, or NULL
+static TrieNode** find_child(TrieNode* node, unsigned char c) {
+    switch (node->type) {
+        case TRIE_NODE4: {
+            TrieNode4* n = (TrieNode4*)node;
+            for (int i = 0; i < n->n.num_children; i++) {
+                if (n->keys[i] == c) return &n->children[i];
+            }
+            return NULL;
+        }
+        case TRIE_NODE16: {
+            TrieNode16* n = (TrieNode16*)node;
+            int lo = 0, hi = n->n.num_children - 1;
+            while (lo <= hi) {
+                int mid = (lo + hi) / 2;
+                if (n->keys[mid] == c) return &n->children[mid];
+                if (n->keys[mid] < c) lo = mid + 1;
+                else hi = mid - 1;
+            }
+            return NULL;
+        }
+        case TRIE_NODE48: {
+            TrieNode48* n = (TrieNode48*)node;
+            int slot = n->child_index[c];
+            return slot ? &n->children[slot - 1] : NULL;
+        }
+        default: {
+            TrieNode256* n = (TrieNode256*)node;
+            return n->children[c] ? &n->children[c] : NULL;
         }
-        current = current->children[index];
     }
-    
-    if (!current->is_end_of_word) {
-        trie->size++;
+}
+
+// Leftmost leaf under node; used to recover compressed bytes past TRIE_MAX_PREFIX
+static TrieLeaf* minimum(TrieNode* node) {
+    while (!IS_LEAF(node)) {
+        switch (node->type) {
+            case TRIE_NODE4:
+                node = ((TrieNode4*)node)->children[0];
+                break;
+            case TRIE_NODE16:
+                node = ((TrieNode16*)node)->children[0];
+                break;
+            case TRIE_NODE48: {
+                TrieNode48* n = (TrieNode48*)node;
+                int c = 0;
+                while (!n->child_index[c]) c++;
+                node = n->children[n->child_index[c] - 1];
+                break;
+            }
+            default: {
+                TrieNode256* n = (TrieNode256*)node;
+                int c = 0;
+                while (!n->children[c]) c++;
+                node = n->children[c];
+                break;
+            }
+        }
     }
-    current->is_end_of_word = 1;
-    if (current->filename) {
-        free(current->filename);
+    return LEAF_RAW(node);
+}
+
+// Stored prefix bytes of node that match key at depth (optimistic: bytes
+// past TRIE_MAX_PREFIX are left for the leaf comparison)
+static int check_prefix(const TrieNode* node, const unsigned char* key, int key_len, int depth) {
+    int max_cmp = min_int(min_int(node->prefix_len, TRIE_MAX_PREFIX), key_len - depth);
+    int idx;
+    for (idx = 0; idx < max_cmp; idx++) {
+        if (node->prefix[idx] != key[depth + idx]) break;
     }
-    current->filename = strdup(filename);
+    return idx;
 }
 
-int trie_search(Trie* trie, const char* filename) {
-    TrieNode* current = trie->root;
-    
-    for (int i = 0; filename[i] != '\0'; i++) {
-        unsigned char index = (unsigned char)filename[i];
-        if (current->children[index] == NULL) {
-            return 0;
+// Exact length of the match between node's full compressed path and key
+static int prefix_mismatch(TrieNode* node, const unsigned char* key, int key_len, int depth) {
+    int max_cmp = min_int((int)node->prefix_len, key_len - depth);
+    int stored = min_int(max_cmp, TRIE_MAX_PREFIX);
+    int idx;
+    for (idx = 0; idx < stored; idx++) {
+        if (node->prefix[idx] != key[depth + idx]) return idx;
+    }
+    if (max_cmp > TRIE_MAX_PREFIX) {
+        const TrieLeaf* leaf = minimum(node);
+        for (; idx < max_cmp; idx++) {
+            if ((unsigned char)leaf->key[depth + idx] != key[depth + idx]) return idx;
         }
-        current = current->children[index];
     }
-    
-    return (current != NULL && current->is_end_of_word);
+    return idx;
 }
 
-static int delete_helper(TrieNode* node, const char* filename, int depth) {
-    if (node == NULL) return 0;
-    
-    if (filename[depth] == '\0') {
-        if (node->is_end_of_word) {
-            node->is_end_of_word = 0;
-            if (node->filename) {
-                free(node->filename);
-                node->filename = NULL;
-            }
+static void copy_header(TrieNode* dest, const TrieNode* src) {
+    dest->num_children = src->num_children;
+    dest->prefix_len = src->prefix_len;
+    memcpy(dest->prefix, src->prefix, min_int(src->prefix_len, TRIE_MAX_PREFIX));
+}
+
+static void add_child(Trie* trie, TrieNode* node, TrieNode** ref, unsigned char c, TrieNode* child);
+
+static void add_child256(TrieNode256* n, unsigned char c, TrieNode* child) {
+    n->children[c] = child;
+    n->n.num_children++;
+}
+
+static void add_child48(Trie* trie, TrieNode48* n, TrieNode** ref, unsigned char c, TrieNode* child) {
+    if (n->n.num_children < 48) {
+        int slot = 0;
+        while (n->children[slot]) slot++;
+        n->children[slot] = child;
+        n->child_index[c] = slot + 1;
+        n->n.num_children++;
+        return;
+    }
+
+    TrieNode256* grown = (TrieNode256*)alloc_node(trie, TRIE_NODE256);
+    for (int i = 0; i < 256; i++) {
+        if (n->child_index[i]) {
+            grown->children[i] = n->children[n->child_index[i] - 1];
+        }
+    }
+    copy_header(&grown->n, &n->n);
+    *ref = &grown->n;
+    free_inner(trie, &n->n);
+    add_child256(grown, c, child);
+}
+
+static void add_child16(Trie* trie, TrieNode16* n, TrieNode** ref, unsigned char c, TrieNode* child) {
+    if (n->n.num_children < 16) {
+        int idx = 0;
+        while (idx < n->n.num_children && n->keys[idx] < c) idx++;
+        memmove(n->keys + idx + 1, n->keys + idx, n->n.num_children - idx);
+        memmove(n->children + idx + 1, n->children + idx, (n->n.num_children - idx) * sizeof(TrieNode*));
+        n->keys[idx] = c;
+        n->children[idx] = child;
+        n->n.num_children++;
+        return;
+    }
+
+    TrieNode48* grown = (TrieNode48*)alloc_node(trie, TRIE_NODE48);
+    memcpy(grown->children, n->children, 16 * sizeof(TrieNode*));
+    for (int i = 0; i < 16; i++) {
+        grown->child_index[n->keys[i]] = i + 1;
+    }
+    copy_header(&grown->n, &n->n);
+    *ref = &grown->n;
+    free_inner(trie, &n->n);
+    add_child48(trie, grown, ref, c, child);
+}
+
+static void add_child4(Trie* trie, TrieNode4* n, TrieNode** ref, unsigned char c, TrieNode* child) {
+    if (n->n.num_children < 4) {
+        int idx = 0;
+        while (idx < n->n.num_children && n->keys[idx] < c) idx++;
+        memmove(n->keys + idx + 1, n->keys + idx, n->n.num_children - idx);
+        memmove(n->children + idx + 1, n->children + idx, (n->n.num_children - idx) * sizeof(TrieNode*));
+        n->keys[idx] = c;
+        n->children[idx] = child;
+        n->n.num_children++;
+        return;
+    }
+
+    TrieNode16* grown = (TrieNode16*)alloc_node(trie, TRIE_NODE16);
+    memcpy(grown->children, n->children, 4 * sizeof(TrieNode*));
+    memcpy(grown->keys, n->keys, 4);
+    copy_header(&grown->n, &n->n);
+    *ref = &grown->n;
+    free_inner(trie, &n->n);
+    add_child16(trie, grown, ref, c, child);
+}
+
+static void add_child(Trie* trie, TrieNode* node, TrieNode** ref, unsigned char c, TrieNode* child) {
+    switch (node->type) {
+        case TRIE_NODE4: add_child4(trie, (TrieNode4*)node, ref, c, child); break;
+        case TRIE_NODE16: add_child16(trie, (TrieNode16*)node, ref, c, child); break;
+        case TRIE_NODE48: add_child48(trie, (TrieNode48*)node, ref, c, child); break;
+        default: add_child256((TrieNode256*)node, c, child); break;
+    }
+}
+
+// Returns 1 if the key was added, 0 if it was already present
+static int insert_key(Trie* trie, const unsigned char* key, int key_len) {
+    TrieNode** ref = &trie->root;
+    int depth = 0;
+
+    while (1) {
+        TrieNode* node = *ref;
+        if (!node) {
+            *ref = LEAF_TAG(alloc_leaf(trie, key, key_len));
+            return 1;
         }
-        
-        // Check if node has any children
-        for (int i = 0; i < ALPHABET_SIZE; i++) {
-            if (node->children[i] != NULL) {
-                return 0; // Don't delete this node
+
+        if (IS_LEAF(node)) {
+            TrieLeaf* existing = LEAF_RAW(node);
+            if (leaf_matches(existing, key, key_len)) {
+                return 0;
+            }
+
+            // Split the leaf: a node4 holding the common bytes and both leaves
+            int max_cmp = min_int(existing->key_len, key_len) - depth;
+            int common = 0;
+            while (common < max_cmp && (unsigned char)existing->key[depth + common] == key[depth + common]) {
+                common++;
             }
+            TrieNode* split = alloc_node(trie, TRIE_NODE4);
+            split->prefix_len = common;
+            memcpy(split->prefix, key + depth, min_int(common, TRIE_MAX_PREFIX));
+            add_child(trie, split, ref, (unsigned char)existing->key[depth + common], node);
+            add_child(trie, split, ref, key[depth + common], LEAF_TAG(alloc_leaf(trie, key, key_len)));
+            *ref = split;
+            return 1;
         }
-        return 1; // Can delete this node
-    }
-    
-    unsigned char index = (unsigned char)filename[depth];
-    if (delete_helper(node->children[index], filename, depth + 1)) {
-        free(node->children[index]);
-        node->children[index] = NULL;
-        
-        // Check if current node should be deleted
-        if (!node->is_end_of_word) {
-            for (int i = 0; i < ALPHABET_SIZE; i++) {
-                if (node->children[i] != NULL) {
-                    return 0;
+
+        if (node->prefix_len) {
+            int diff = prefix_mismatch(node, key, key_len, depth);
+            if (diff < (int)node->prefix_len) {
+                // Key leaves the compressed path: split it at the first difference
+                TrieNode* split = alloc_node(trie, TRIE_NODE4);
+                split->prefix_len = diff;
+                memcpy(split->prefix, node->prefix, min_int(diff, TRIE_MAX_PREFIX));
+                *ref = split;
+
+                if (node->prefix_len <= TRIE_MAX_PREFIX) {
+                    add_child(trie, split, ref, node->prefix[diff], node);
+                    node->prefix_len -= diff + 1;
+                    memmove(node->prefix, node->prefix + diff + 1, min_int(node->prefix_len, TRIE_MAX_PREFIX));
+                } else {
+                    node->prefix_len -= diff + 1;
+                    const TrieLeaf* leaf = minimum(node);
+                    add_child(trie, split, ref, (unsigned char)leaf->key[depth + diff], node);
+                    memcpy(node->prefix, leaf->key + depth + diff + 1, min_int(node->prefix_len, TRIE_MAX_PREFIX));
                 }
+
+                add_child(trie, split, ref, key[depth + diff], LEAF_TAG(alloc_leaf(trie, key, key_len)));
+                return 1;
             }
+            depth += node->prefix_len;
+        }
+
+        TrieNode** child = find_child(node, key[depth]);
+        if (!child) {
+            add_child(trie, node, ref, key[depth], LEAF_TAG(alloc_leaf(trie, key, key_len)));
             return 1;
         }
+        ref = child;
+        depth++;
     }
-    
-    return 0;
 }
 
-void trie_delete(Trie* trie, const char* filename) {
-    if (trie_search(trie, filename)) {
-        delete_helper(trie->root, filename, 0);
-        trie->size--;
+static void remove_child256(Trie* trie, TrieNode256* n, TrieNode** ref, unsigned char c) {
+    n->children[c] = NULL;
+    n->n.num_children--;
+
+    // Shrink with some hysteresis so add/remove at the boundary does not thrash
+    if (n->n.num_children == 37) {
+        TrieNode48* shrunk = (TrieNode48*)alloc_node(trie, TRIE_NODE48);
+        copy_header(&shrunk->n, &n->n);
+        int slot = 0;
+        for (int i = 0; i < 256; i++) {
+            if (n->children[i]) {
+                shrunk->children[slot] = n->children[i];
+                shrunk->child_index[i] = ++slot;
+            }
+        }
+        *ref = &shrunk->n;
+        free_inner(trie, &n->n);
+    }
+}
+
+static void remove_child48(Trie* trie, TrieNode48* n, TrieNode** ref, unsigned char c) {
+    int slot = n->child_index[c];
+    n->child_index[c] = 0;
+    n->children[slot - 1] = NULL;
+    n->n.num_children--;
+
+    if (n->n.num_children == 12) {
+        TrieNode16* shrunk = (TrieNode16*)alloc_node(trie, TRIE_NODE16);
+        copy_header(&shrunk->n, &n->n);
+        int idx = 0;
+        for (int i = 0; i < 256; i++) {
+            if (n->child_index[i]) {
+                shrunk->keys[idx] = i;
+                shrunk->children[idx] = n->children[n->child_index[i] - 1];
+                idx++;
+            }
+        }
+        *ref = &shrunk->n;
+        free_inner(trie, &n->n);
+    }
+}
+
+static void remove_child16(Trie* trie, TrieNode16* n, TrieNode** ref, TrieNode** slot) {
+    int idx = slot - n->children;
+    memmove(n->keys + idx, n->keys + idx + 1, n->n.num_children - 1 - idx);
+    memmove(n->children + idx, n->children + idx + 1, (n->n.num_children - 1 - idx) * sizeof(TrieNode*));
+    n->n.num_children--;
+
+    if (n->n.num_children == 3) {
+        TrieNode4* shrunk = (TrieNode4*)alloc_node(trie, TRIE_NODE4);
+        copy_header(&shrunk->n, &n->n);
+        memcpy(shrunk->keys, n->keys, 3);
+        memcpy(shrunk->children, n->children, 3 * sizeof(TrieNode*));
+        *ref = &shrunk->n;
+        free_inner(trie, &n->n);
+    }
+}
+
+static void remove_child4(Trie* trie, TrieNode4* n, TrieNode** ref, TrieNode** slot) {
+    int idx = slot - n->children;
+    memmove(n->keys + idx, n->keys + idx + 1, n->n.num_children - 1 - idx);
+    memmove(n->children + idx, n->children + idx + 1, (n->n.num_children - 1 - idx) * sizeof(TrieNode*));
+    n->n.num_children--;
+
+    if (n->n.num_children > 1) {
+        return;
+    }
+
+    // One child left: merge this node's path into it
+    TrieNode* child = n->children[0];
+    if (!IS_LEAF(child)) {
+        int prefix = n->n.prefix_len;
+        if (prefix < TRIE_MAX_PREFIX) {
+            n->n.prefix[prefix] = n->keys[0];
+            prefix++;
+        }
+        if (prefix < TRIE_MAX_PREFIX) {
+            int sub = min_int(child->prefix_len, TRIE_MAX_PREFIX - prefix);
+            memcpy(n->n.prefix + prefix, child->prefix, sub);
+            prefix += sub;
+        }
+        memcpy(child->prefix, n->n.prefix, min_int(prefix, TRIE_MAX_PREFIX));
+        child->prefix_len += n->n.prefix_len + 1;
+    }
+    *ref = child;
+    free_inner(trie, &n->n);
+}
+
+static void remove_child(Trie* trie, TrieNode* node, TrieNode** ref, unsigned char c, TrieNode** slot) {
+    switch (node->type) {
+        case TRIE_NODE4: remove_child4(trie, (TrieNode4*)node, ref, slot); break;
+        case TRIE_NODE16: remove_child16(trie, (TrieNode16*)node, ref, slot); break;
+        case TRIE_NODE48: remove_child48(trie, (TrieNode48*)node, ref, c); break;
+        default: remove_child256(trie, (TrieNode256*)node, ref, c); break;
+    }
+}
+
+// Unlinks and returns the leaf for key, or NULL if it is not present
+static TrieLeaf* delete_key(Trie* trie, const unsigned char* key, int key_len) {
+    TrieNode** ref = &trie->root;
+    TrieNode* node = *ref;
+    int depth = 0;
+
+    if (!node) return NULL;
+    if (IS_LEAF(node)) {
+        TrieLeaf* leaf = LEAF_RAW(node);
+        if (!leaf_matches(leaf, key, key_len)) return NULL;
+        *ref = NULL;
+        return leaf;
+    }
+
+    while (1) {
+        if (node->prefix_len) {
+            if (check_prefix(node, key, key_len, depth) != min_int(node->prefix_len, TRIE_MAX_PREFIX)) {
+                return NULL;
+            }
+            depth += node->prefix_len;
+        }
+        if (depth >= key_len) return NULL;
+
+        TrieNode** child = find_child(node, key[depth]);
+        if (!child) return NULL;
+
+        if (IS_LEAF(*child)) {
+            TrieLeaf* leaf = LEAF_RAW(*child);
+            if (!leaf_matches(leaf, key, key_len)) return NULL;
+            remove_child(trie, node, ref, key[depth], child);
+            return leaf;
+        }
+        ref = child;
+        node = *child;
+        depth++;
     }
 }
 
-static void free_node(TrieNode* node) {
-    if (node == NULL) return;
-    
-    for (int i = 0; i < ALPHABET_SIZE; i++) {
-        if (node->children[i] != NULL) {
-            free_node(node->children[i]);
+Trie* trie_create() {
+    return (Trie*)calloc(1, sizeof(Trie));
+}
+
+void trie_insert(Trie* trie, const char* filename) {
+    // The terminating NUL is part of the key
+    int key_len = strlen(filename) + 1;
+    if (key_len > TRIE_MAX_KEY) return;
+    if (insert_key(trie, (const unsigned char*)filename, key_len)) {
+        trie->size++;
+    }
+}
+
+int trie_search(Trie* trie, const char* filename) {
+    const unsigned char* key = (const unsigned char*)filename;
+    int key_len = strlen(filename) + 1;
+    TrieNode* node = trie->root;
+    int depth = 0;
+
+    while (node) {
+        if (IS_LEAF(node)) {
+            return leaf_matches(LEAF_RAW(node), key, key_len);
+        }
+        if (node->prefix_len) {
+            if (check_prefix(node, key, key_len, depth) != min_int(node->prefix_len, TRIE_MAX_PREFIX)) {
+                return 0;
+            }
+            depth += node->prefix_len;
         }
+        if (depth >= key_len) return 0;
+
+        TrieNode** child = find_child(node, key[depth]);
+        node = child ? *child : NULL;
+        depth++;
     }
-    
-    if (node->filename) {
-        free(node->filename);
+    return 0;
+}
+
+void trie_delete(Trie* trie, const char* filename) {
+    int key_len = strlen(filename) + 1;
+    TrieLeaf* leaf = delete_key(trie, (const unsigned char*)filename, key_len);
+    if (leaf) {
+        free_leaf(trie, leaf);
+        trie->size--;
     }
-    free(node);
 }
 
+// Every node and leaf lives in the arena, so teardown releases whole slabs
+// without visiting the tree
 void trie_free(Trie* trie) {
-    if (trie) {
-        free_node(trie->root);
-        free(trie);
+    if (!trie) return;
+    TrieSlab* slab = trie->arena.slabs;
+    while (slab) {
+        TrieSlab* next = slab->next;
+        free(slab);
+        slab = next;
     }
+    free(trie);
 }
 
-static void collect_words(TrieNode* node, char* prefix, int depth, char** results, int* count, int max_results) {
-    if (node == NULL || *count >= max_results) return;
-    
-    if (node->is_end_of_word && node->filename) {
-        results[*count] = strdup(node->filename);
-        (*count)++;
+typedef struct {
+    TrieNode* node;
+    int next;           // Next child position (slot or byte) to visit
+} CollectFrame;
+
+// Inner nodes on the current path, innermost on top
+typedef struct {
+    CollectFrame* frames;
+    int top;            // -1 when empty
+    int capacity;
+} CollectStack;
+
+static int push_frame(CollectStack* st, TrieNode* node, int next) {
+    if (st->top + 1 == st->capacity) {
+        int capacity = st->capacity ? st->capacity * 2 : 64;
+        CollectFrame* grown = realloc(st->frames, capacity * sizeof(CollectFrame));
+        if (!grown) return -1;
+        st->frames = grown;
+        st->capacity = capacity;
     }
-    
-    for (int i = 0; i < ALPHABET_SIZE && *count < max_results; i++) {
-        if (node->children[i] != NULL) {
-            prefix[depth] = (char)i;
-            prefix[depth + 1] = '\0';
-            collect_words(node->children[i], prefix, depth + 1, results, count, max_results);
+    st->top++;
+    st->frames[st->top].node = node;
+    st->frames[st->top].next = next;
+    return 0;
+}
+
+// First child position of node holding a byte greater than c
+static int position_after(TrieNode* node, unsigned char c) {
+    switch (node->type) {
+        case TRIE_NODE4:
+        case TRIE_NODE16: {
+            const unsigned char* keys = node->type == TRIE_NODE4 ? ((TrieNode4*)node)->keys : ((TrieNode16*)node)->keys;
+            int idx = 0;
+            while (idx < node->num_children && keys[idx] <= c) idx++;
+            return idx;
         }
+        default:
+            return c + 1;
     }
 }
 
-int trie_search_prefix(Trie* trie, const char* prefix, char** results, int max_results) {
-    TrieNode* current = trie->root;
-    
-    // Navigate to prefix node
-    for (int i = 0; prefix[i] != '\0'; i++) {
-        unsigned char index = (unsigned char)prefix[i];
-        if (current->children[index] == NULL) {
+static void emit(const TrieLeaf* leaf, char** results, int* count, int max_results) {
+    if (*count < max_results) {
+        results[(*count)++] = strdup(leaf->key);
+    }
+}
+
+// Positions the stack on the first key greater than after within the
+// subtree at node (whose path starts at depth), emitting that key if it is
+// the leaf the descent ends on
+static int seek_after(CollectStack* st, TrieNode* node, int depth, const unsigned char* after,
+                      char** results, int* count, int max_results) {
+    while (1) {
+        if (IS_LEAF(node)) {
+            if (strcmp(LEAF_RAW(node)->key, (const char*)after) > 0) {
+                emit(LEAF_RAW(node), results, count, max_results);
+            }
             return 0;
         }
-        current = current->children[index];
+        if (node->prefix_len) {
+            const TrieLeaf* leaf = node->prefix_len > TRIE_MAX_PREFIX ? minimum(node) : NULL;
+            for (uint32_t i = 0; i < node->prefix_len; i++) {
+                unsigned char b = i < TRIE_MAX_PREFIX ? node->prefix[i] : (unsigned char)leaf->key[depth + i];
+                if (b != after[depth + i]) {
+                    // The whole subtree sorts after (or before) the key
+                    return b > after[depth + i] ? push_frame(st, node, 0) : 0;
+                }
+            }
+            depth += node->prefix_len;
+        }
+        unsigned char c = after[depth];
+        if (push_frame(st, node, position_after(node, c)) < 0) return -1;
+        TrieNode** child = find_child(node, c);
+        if (!child) return 0;
+        node = *child;
+        depth++;
+    }
+}
+
+// Appends keys in sorted order until the stack empties or results fill up
+static void collect_words(CollectStack* st, char** results, int* count, int max_results) {
+    while (st->top >= 0 && *count < max_results) {
+        CollectFrame* frame = &st->frames[st->top];
+        TrieNode* node = frame->node;
+        TrieNode* child = NULL;
+
+        switch (node->type) {
+            case TRIE_NODE4:
+                if (frame->next < node->num_children) child = ((TrieNode4*)node)->children[frame->next++];
+                break;
+            case TRIE_NODE16:
+                if (frame->next < node->num_children) child = ((TrieNode16*)node)->children[frame->next++];
+                break;
+            case TRIE_NODE48: {
+                TrieNode48* n = (TrieNode48*)node;
+                while (frame->next < 256 && !n->child_index[frame->next]) frame->next++;
+                if (frame->next < 256) child = n->children[n->child_index[frame->next++] - 1];
+                break;
+            }
+            default: {
+                TrieNode256* n = (TrieNode256*)node;
+                while (frame->next < 256 && !n->children[frame->next]) frame->next++;
+                if (frame->next < 256) child = n->children[frame->next++];
+                break;
+            }
+        }
+
+        if (!child) {
+            st->top--;
+        } else if (IS_LEAF(child)) {
+            emit(LEAF_RAW(child), results, count, max_results);
+        } else if (push_frame(st, child, 0) < 0) {
+            return;
+        }
     }
-    
-    // Collect all words with this prefix
-    char buffer[512];
-    strncpy(buffer, prefix, sizeof(buffer) - 1);
+}
+
+// Collects the keys of the subtree at node that sort after `after`,
+// depth-first with an explicit stack. All of them share prefix's first
+// depth bytes, where node's own path starts.
+static int collect_subtree(TrieNode* node, const char* prefix, int depth, const char* after,
+                           char** results, int max_results) {
     int count = 0;
-    collect_words(current, buffer, strlen(prefix), results, &count, max_results);
+    CollectStack st = { NULL, -1, 0 };
+    int cmp = after ? strncmp(after, prefix, depth) : -1;
+    if (cmp > 0) return 0;
+    if (cmp < 0 || !*after) {
+        if (IS_LEAF(node)) {
+            emit(LEAF_RAW(node), results, &count, max_results);
+        } else {
+            push_frame(&st, node, 0);
+        }
+    } else {
+        seek_after(&st, node, depth, (const unsigned char*)after, results, &count, max_results);
+    }
+    collect_words(&st, results, &count, max_results);
+    free(st.frames);
     return count;
 }
+
+int trie_search_prefix(Trie* trie, const char* prefix, const char* after, char** results, int max_results) {
+    // Unlike lookups, the prefix is matched without its NUL
+    const unsigned char* key = (const unsigned char*)prefix;
+    int key_len = strlen(prefix);
+    TrieNode* node = trie->root;
+    int depth = 0;
+
+    if (max_results <= 0) return 0;
+
+    // Navigate to the subtree whose keys all start with prefix
+    while (node) {
+        if (IS_LEAF(node)) {
+            TrieLeaf* leaf = LEAF_RAW(node);
+            if ((int)leaf->key_len > key_len && memcmp(leaf->key, key, key_len) == 0) {
+                return collect_subtree(node, prefix, depth, after, results, max_results);
+            }
+            return 0;
+        }
+        if (depth == key_len) {
+            return collect_subtree(node, prefix, depth, after, results, max_results);
+        }
+        if (node->prefix_len) {
+            int matched = prefix_mismatch(node, key, key_len, depth);
+            if (depth + matched == key_len) {
+                // Prefix ends inside this node's compressed path
+                return collect_subtree(node, prefix, depth, after, results, max_results);
+            }
+            if (matched < (int)node->prefix_len) return 0;
+            depth += node->prefix_len;
+        }
+
+        TrieNode** child = find_child(node, key[depth]);
+        node = child ? *child : NULL;
+        depth++;
+    }
+    return 0;
+}
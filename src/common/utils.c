@@ -1,9 +1,12 @@
 #include "../../include/common.h"
+#include <netinet/tcp.h>
+#include <sys/uio.h>
 
 void get_current_timestamp(char* buffer, size_t size) {
     time_t now = time(NULL);
-    struct tm* tm_info = localtime(&now);
-    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);  // Handlers log from many threads
+    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &tm_info);
 }
 
 void log_message(const char* component, const char* message) {
@@ -116,6 +119,50 @@ int parse_sentences(const char* content, char sentences[][MAX_SENTENCE], int max
     return count;
 }
 
+int parse_sentence_set(const char* spec, int* sentences, int max_sentences) {
+    unsigned char seen[MAX_SENTENCES] = {0};
+    const char* p = spec;
+    
+    while (1) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p || *p == '-' || *p == '+') {
+            return -1;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            if (*p < '0' || *p > '9') {
+                return -1;
+            }
+            last = strtol(p, &end, 10);
+            p = end;
+        }
+        if (first < 0 || last < first || last >= MAX_SENTENCES) {
+            return -1;
+        }
+        memset(seen + first, 1, last - first + 1);
+        
+        if (*p == '\0') break;
+        if (*p != ',') {
+            return -1;
+        }
+        p++;
+    }
+    
+    int count = 0;
+    for (int i = 0; i < MAX_SENTENCES; i++) {
+        if (seen[i]) {
+            if (count == max_sentences) {
+                return -1;
+            }
+            sentences[count++] = i;
+        }
+    }
+    return count;
+}
+
 int parse_words(const char* sentence, char words[][MAX_WORD], int max_words) {
     int count = 0;
     const char* ptr = sentence;
@@ -166,10 +213,18 @@ const char* error_code_to_string(int code) {
         case ERR_CONNECTION_FAILED: return "Connection failed";
         case ERR_FOLDER_NOT_FOUND: return "Folder not found";
         case ERR_CHECKPOINT_NOT_FOUND: return "Checkpoint not found";
+        case ERR_SERVER_BUSY: return "Server busy";
         default: return "Unknown error";
     }
 }
 
+int set_socket_nodelay(int socket) {
+    // Request/response frames are small; don't let Nagle hold them back
+    // waiting for the peer's delayed ACK
+    int opt = 1;
+    return setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+}
+
 int create_server_socket(int port) {
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
@@ -185,6 +240,7 @@ int create_server_socket(int port) {
         close(server_fd);
         return -1;
     }
+    set_socket_nodelay(server_fd);
     
     struct sockaddr_in address;
     memset(&address, 0, sizeof(address));
@@ -230,12 +286,83 @@ int connect_to_server(const char* ip, int port) {
         close(sock);
         return -1;
     }
+    set_socket_nodelay(sock);
     
     return sock;
 }
 
+static const char* const opcode_names[OP_COUNT] = {
+    [OP_UNKNOWN] = "",
+    [OP_REGISTER_SS] = MSG_REGISTER_SS,
+    [OP_REGISTER_CLIENT] = MSG_REGISTER_CLIENT,
+    [OP_CREATE] = MSG_CREATE,
+    [OP_READ] = MSG_READ,
+    [OP_WRITE] = MSG_WRITE,
+    [OP_WRITE_LOCK] = MSG_WRITE_LOCK,
+    [OP_WRITE_UPDATE] = MSG_WRITE_UPDATE,
+    [OP_WRITE_COMMIT] = MSG_WRITE_COMMIT,
+    [OP_DELETE] = MSG_DELETE,
+    [OP_VIEW] = MSG_VIEW,
+    [OP_INFO] = MSG_INFO,
+    [OP_STREAM] = MSG_STREAM,
+    [OP_UNDO] = MSG_UNDO,
+    [OP_EXEC] = MSG_EXEC,
+    [OP_LIST] = MSG_LIST,
+    [OP_ADDACCESS] = MSG_ADDACCESS,
+    [OP_REMACCESS] = MSG_REMACCESS,
+    [OP_CREATEFOLDER] = MSG_CREATEFOLDER,
+    [OP_MOVE] = MSG_MOVE,
+    [OP_VIEWFOLDER] = MSG_VIEWFOLDER,
+    [OP_CHECKPOINT] = MSG_CHECKPOINT,
+    [OP_VIEWCHECKPOINT] = MSG_VIEWCHECKPOINT,
+    [OP_REVERT] = MSG_REVERT,
+    [OP_LISTCHECKPOINTS] = MSG_LISTCHECKPOINTS,
+    [OP_REQUESTACCESS] = MSG_REQUESTACCESS,
+    [OP_VIEWREQUESTS] = MSG_VIEWREQUESTS,
+    [OP_APPROVEACCESS] = MSG_APPROVEACCESS,
+    [OP_REJECTACCESS] = MSG_REJECTACCESS,
+    [OP_REPLICATE] = MSG_REPLICATE,
+    [OP_HEARTBEAT] = MSG_HEARTBEAT,
+    [OP_GET_SS_INFO] = MSG_GET_SS_INFO,
+    [OP_STREAM_WORD] = MSG_STREAM_WORD,
+    [OP_STREAM_END] = MSG_STREAM_END,
+    [OP_MULTI] = MSG_MULTI,
+    [OP_VIEW_PAGE] = MSG_VIEW_PAGE,
+    [OP_SEARCH] = MSG_SEARCH,
+    [OP_WRITE_UNLOCK] = MSG_WRITE_UNLOCK,
+};
+
+int msg_type_to_opcode(const char* type) {
+    for (int i = 1; i < OP_COUNT; i++) {
+        if (strcmp(opcode_names[i], type) == 0) {
+            return i;
+        }
+    }
+    return OP_UNKNOWN;
+}
+
+const char* opcode_to_msg_type(int opcode) {
+    if (opcode <= OP_UNKNOWN || opcode >= OP_COUNT) {
+        return opcode_names[OP_UNKNOWN];
+    }
+    return opcode_names[opcode];
+}
+
 void init_message(Message* msg) {
-    memset(msg, 0, sizeof(Message));
+    // Only the fields' first bytes need clearing: every field is sent as a
+    // bounded string, so zeroing the whole 64KB payload is wasted work
+    msg->type[0] = '\0';
+    msg->username[0] = '\0';
+    msg->filename[0] = '\0';
+    msg->data[0] = '\0';
+    msg->error_code = ERR_SUCCESS;
+    msg->error_msg[0] = '\0';
+    msg->request_id = 0;
+}
+
+void init_response(Message* resp, const Message* req) {
+    init_message(resp);
+    resp->request_id = req->request_id;
 }
 
 void set_message_error(Message* msg, int error_code, const char* error_msg) {
@@ -244,67 +371,216 @@ void set_message_error(Message* msg, int error_code, const char* error_msg) {
     msg->error_msg[sizeof(msg->error_msg) - 1] = '\0';
 }
 
+// Write a whole iovec array, normally in a single sendmsg() call.
+// MSG_NOSIGNAL turns a vanished peer into an error instead of SIGPIPE.
+static int sendv_all(int socket, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt;
+        
+        ssize_t sent = sendmsg(socket, &mh, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            // Timed out or failed, maybe mid-frame: the stream can't be
+            // framed any more, so end it and let the peer (and any reactor
+            // watching this socket) see the session close
+            shutdown(socket, SHUT_RDWR);
+            return -1;
+        }
+        
+        // Partial write: skip fully sent buffers and trim the next one
+        while (iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+static int recv_all(int socket, void* buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    ssize_t received = recv(socket, buf, len, MSG_WAITALL);
+    return received == (ssize_t)len ? 0 : -1;
+}
+
+// Scatter-read into an iovec array until every buffer is full
+static int recvv_all(int socket, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        // readv() returning 0 must mean EOF, so never ask for zero bytes
+        if (iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+        
+        ssize_t received = readv(socket, iov, iovcnt);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        
+        while (iovcnt > 0 && (size_t)received >= iov->iov_len) {
+            received -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + received;
+            iov->iov_len -= received;
+        }
+    }
+    return 0;
+}
+
 int send_message(int socket, const Message* msg) {
-    // Send message size first
-    uint32_t size = sizeof(Message);
-    uint32_t net_size = htonl(size);
-    
-    ssize_t sent = send(socket, &net_size, sizeof(net_size), 0);
-    if (sent != sizeof(net_size)) {
+    // Variable-length frame: header plus only the bytes each field uses
+    size_t username_len = strnlen(msg->username, sizeof(msg->username) - 1);
+    size_t filename_len = strnlen(msg->filename, sizeof(msg->filename) - 1);
+    size_t error_msg_len = strnlen(msg->error_msg, sizeof(msg->error_msg) - 1);
+    size_t data_len = strnlen(msg->data, sizeof(msg->data) - 1);
+    
+    WireHeader hdr;
+    hdr.magic = htons(WIRE_MAGIC);
+    hdr.version = WIRE_VERSION;
+    hdr.flags = 0;
+    hdr.opcode = htons(msg_type_to_opcode(msg->type));
+    hdr.username_len = htons(username_len);
+    hdr.filename_len = htons(filename_len);
+    hdr.error_msg_len = htons(error_msg_len);
+    hdr.error_code = htonl(msg->error_code);
+    hdr.request_id = htonl(msg->request_id);
+    hdr.data_len = htonl(data_len);
+    
+    // Header and all fields go out together so the frame is one segment
+    struct iovec iov[5] = {
+        { &hdr, sizeof(hdr) },
+        { (void*)msg->username, username_len },
+        { (void*)msg->filename, filename_len },
+        { (void*)msg->error_msg, error_msg_len },
+        { (void*)msg->data, data_len },
+    };
+    
+    return sendv_all(socket, iov, 5);
+}
+
+// Validate a received header and extract the four field lengths
+// (username, filename, error_msg, data)
+static int parse_header(const WireHeader* hdr, size_t lens[4]) {
+    if (ntohs(hdr->magic) != WIRE_MAGIC || hdr->version != WIRE_VERSION) {
         return -1;
     }
     
-    // Send message
-    sent = send(socket, msg, size, 0);
-    if (sent != size) {
+    lens[0] = ntohs(hdr->username_len);
+    lens[1] = ntohs(hdr->filename_len);
+    lens[2] = ntohs(hdr->error_msg_len);
+    lens[3] = ntohl(hdr->data_len);
+    
+    if (lens[0] >= MAX_USERNAME || lens[1] >= MAX_FILENAME ||
+        lens[2] >= sizeof(((Message*)0)->error_msg) || lens[3] >= BUFFER_SIZE) {
         return -1;
     }
-    
     return 0;
 }
 
+static void finish_decode(const WireHeader* hdr, const size_t lens[4], Message* msg) {
+    strcpy(msg->type, opcode_to_msg_type(ntohs(hdr->opcode)));
+    msg->username[lens[0]] = '\0';
+    msg->filename[lens[1]] = '\0';
+    msg->error_msg[lens[2]] = '\0';
+    msg->data[lens[3]] = '\0';
+    msg->error_code = (int32_t)ntohl(hdr->error_code);
+    msg->request_id = ntohl(hdr->request_id);
+}
+
 int receive_message(int socket, Message* msg) {
-    // Receive message size first
-    uint32_t net_size;
-    ssize_t received = recv(socket, &net_size, sizeof(net_size), MSG_WAITALL);
-    if (received != sizeof(net_size)) {
+    WireHeader hdr;
+    if (recv_all(socket, &hdr, sizeof(hdr)) < 0) {
         return -1;
     }
     
-    uint32_t size = ntohl(net_size);
-    if (size != sizeof(Message)) {
+    size_t lens[4];
+    if (parse_header(&hdr, lens) < 0) {
         return -1;
     }
     
-    // Receive message
-    received = recv(socket, msg, size, MSG_WAITALL);
-    if (received != size) {
+    struct iovec iov[4] = {
+        { msg->username, lens[0] },
+        { msg->filename, lens[1] },
+        { msg->error_msg, lens[2] },
+        { msg->data, lens[3] },
+    };
+    if (recvv_all(socket, iov, 4) < 0) {
         return -1;
     }
     
+    finish_decode(&hdr, lens, msg);
     return 0;
 }
 
-int send_data(int socket, const char* data, size_t len) {
-    // Send length first
-    uint32_t net_len = htonl(len);
-    if (send(socket, &net_len, sizeof(net_len), 0) != sizeof(net_len)) {
+long wire_frame_size(const char* buf, size_t len) {
+    if (len < sizeof(WireHeader)) {
+        return 0;
+    }
+    
+    WireHeader hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    size_t lens[4];
+    if (parse_header(&hdr, lens) < 0) {
         return -1;
     }
     
-    // Send data
-    size_t total_sent = 0;
-    while (total_sent < len) {
-        ssize_t sent = send(socket, data + total_sent, len - total_sent, 0);
-        if (sent <= 0) {
-            return -1;
-        }
-        total_sent += sent;
+    size_t total = sizeof(hdr) + lens[0] + lens[1] + lens[2] + lens[3];
+    return len >= total ? (long)total : 0;
+}
+
+int decode_message(const char* buf, size_t len, Message* msg) {
+    long total = wire_frame_size(buf, len);
+    if (total <= 0) {
+        return -1;
     }
     
+    WireHeader hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    size_t lens[4];
+    parse_header(&hdr, lens);
+    
+    const char* p = buf + sizeof(hdr);
+    memcpy(msg->username, p, lens[0]);
+    p += lens[0];
+    memcpy(msg->filename, p, lens[1]);
+    p += lens[1];
+    memcpy(msg->error_msg, p, lens[2]);
+    p += lens[2];
+    memcpy(msg->data, p, lens[3]);
+    
+    finish_decode(&hdr, lens, msg);
     return 0;
 }
 
+int send_data(int socket, const char* data, size_t len) {
+    // Length prefix and payload in one vectored write
+    uint32_t net_len = htonl(len);
+    struct iovec iov[2] = {
+        { &net_len, sizeof(net_len) },
+        { (void*)data, len },
+    };
+    
+    return sendv_all(socket, iov, 2);
+}
+
 int receive_data(int socket, char* buffer, size_t max_len) {
     // Receive length first
     uint32_t net_len;
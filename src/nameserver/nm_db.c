@@ -1,7 +1,97 @@
 #include "../../include/nameserver.h"
 
+CachedStmt nm_statements[NM_STMT_COUNT] = {
+    [NM_STMT_FILE_ACL] = { .sql = "SELECT username, permissions FROM access_control WHERE filename = ?;" },
+    [NM_STMT_INSERT_FILE] = {
+        .sql = "INSERT INTO files (filename, owner, storage_server_id, replica_server_id, "
+               "created_at, modified_at, accessed_at, storage_path) VALUES (?, ?, ?, ?, ?, ?, ?, ?);" },
+    [NM_STMT_INSERT_FOLDER] = {
+        .sql = "INSERT INTO files (filename, owner, storage_server_id, created_at, modified_at, accessed_at, is_folder, storage_path) "
+               "VALUES (?1, ?2, ?3, ?4, ?5, ?6, 1, ?1);" },
+    [NM_STMT_DELETE_FILE] = { .sql = "DELETE FROM files WHERE filename = ?;" },
+    [NM_STMT_DELETE_FILE_ACL] = { .sql = "DELETE FROM access_control WHERE filename = ?;" },
+    [NM_STMT_SAVE_TIMESTAMPS] = {
+        .sql = "UPDATE files SET accessed_at = ?, modified_at = ? WHERE filename = ?;" },
+    // VIEW pages resume after the cursor filename. The per-user listing merges
+    // two index range scans (owned files, then grants on others' files), so a
+    // page costs its own size rather than a scan of every file
+    [NM_STMT_VIEW_ALL] = {
+        .sql = "SELECT filename, owner, is_folder, word_count, sentence_count, created_at FROM files "
+               "WHERE filename > ?1 ORDER BY filename LIMIT ?2;" },
+    [NM_STMT_VIEW_USER] = {
+        .sql = "SELECT filename, owner, is_folder, word_count, sentence_count, created_at FROM files "
+               "WHERE owner = ?3 AND filename > ?1 "
+               "UNION ALL "
+               "SELECT ac.filename, f.owner, f.is_folder, f.word_count, f.sentence_count, f.created_at "
+               "FROM access_control ac JOIN files f ON f.filename = ac.filename "
+               "WHERE ac.username = ?3 AND ac.filename > ?1 AND f.owner <> ?3 "
+               "ORDER BY 1 LIMIT ?2;" },
+    [NM_STMT_GRANT_ACCESS] = {
+        .sql = "INSERT OR REPLACE INTO access_control (filename, username, permissions) VALUES (?, ?, ?);" },
+    [NM_STMT_REVOKE_ACCESS] = { .sql = "DELETE FROM access_control WHERE filename = ? AND username = ?;" },
+    [NM_STMT_INSERT_ACCESS_REQUEST] = {
+        .sql = "INSERT INTO access_requests (filename, requester, access_type, requested_at) VALUES (?, ?, ?, ?);" },
+    [NM_STMT_PENDING_REQUESTS] = {
+        .sql = "SELECT ar.filename, ar.requester, ar.access_type, ar.requested_at "
+               "FROM access_requests ar JOIN files f ON ar.filename = f.filename "
+               "WHERE f.owner = ? AND ar.status = 'pending';" },
+    [NM_STMT_STORAGE_PATH_USED] = { .sql = "SELECT 1 FROM files WHERE storage_path = ? LIMIT 1;" },
+    // MOVE renames ?1 and every path under it to start with ?2 instead
+    [NM_STMT_MOVE_FILES] = {
+        .sql = "UPDATE files SET filename = ?2 || substr(filename, length(?1) + 1) "
+               "WHERE filename = ?1 OR (filename >= ?1 || '/' AND filename < ?1 || '0');" },
+    [NM_STMT_MOVE_ACL] = {
+        .sql = "UPDATE access_control SET filename = ?2 || substr(filename, length(?1) + 1) "
+               "WHERE filename = ?1 OR (filename >= ?1 || '/' AND filename < ?1 || '0');" },
+    [NM_STMT_MOVE_REQUESTS] = {
+        .sql = "UPDATE access_requests SET filename = ?2 || substr(filename, length(?1) + 1) "
+               "WHERE filename = ?1 OR (filename >= ?1 || '/' AND filename < ?1 || '0');" },
+    [NM_STMT_INSERT_USER] = { .sql = "INSERT INTO users (username, registered_at) VALUES (?, ?);" },
+    [NM_STMT_LIST_USERS] = {
+        .sql = "SELECT username FROM users WHERE username > ?1 ORDER BY username LIMIT ?2;" },
+};
+
+// Databases created before MOVE have no storage_path column; their files
+// are stored under their names. The index backs the uniqueness check on CREATE.
+static void add_storage_path_column() {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(server_state.db, "SELECT 1 FROM pragma_table_info('files') WHERE name = 'storage_path';",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        return;
+    }
+    int present = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    if (!present) {
+        sqlite3_exec(server_state.db,
+                     "ALTER TABLE files ADD COLUMN storage_path TEXT; "
+                     "UPDATE files SET storage_path = filename;", 0, 0, NULL);
+    }
+    sqlite3_exec(server_state.db, "CREATE INDEX IF NOT EXISTS idx_files_storage ON files (storage_path);", 0, 0, NULL);
+}
+
+// Databases created before the users table only know users through the files
+// they own or were granted; register those so grants to them keep working
+static void seed_users() {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(server_state.db, "SELECT 1 FROM users LIMIT 1;", -1, &stmt, NULL) != SQLITE_OK) {
+        return;
+    }
+    int empty = sqlite3_step(stmt) != SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    if (empty) {
+        sqlite3_exec(server_state.db,
+                     "INSERT OR IGNORE INTO users (username, registered_at) "
+                     "SELECT owner, MIN(created_at) FROM files GROUP BY owner ORDER BY owner; "
+                     "INSERT OR IGNORE INTO users (username, registered_at) "
+                     "SELECT DISTINCT username, strftime('%s', 'now') FROM access_control ORDER BY username;",
+                     0, 0, NULL);
+    }
+}
+
 int init_database() {
-    int rc = sqlite3_open("data/nameserver.db", &server_state.db);
+    // Workers share this connection; let SQLite serialize calls on it
+    int rc = sqlite3_open_v2("data/nameserver.db", &server_state.db,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, NULL);
     if (rc != SQLITE_OK) {
         log_message("NameServer", "Failed to open database");
         return -1;
@@ -19,7 +109,8 @@ int init_database() {
         "created_at INTEGER, "
         "modified_at INTEGER, "
         "accessed_at INTEGER, "
-        "is_folder INTEGER DEFAULT 0"
+        "is_folder INTEGER DEFAULT 0, "
+        "storage_path TEXT"         // Name on the storage servers, kept across MOVE
         ");",
         
         "CREATE TABLE IF NOT EXISTS access_control ("
@@ -51,10 +142,26 @@ int init_database() {
         "access_type INTEGER, "
         "requested_at INTEGER, "
         "status TEXT DEFAULT 'pending'"
-        ");"
+        ");",
+        
+        "CREATE TABLE IF NOT EXISTS users ("
+        "id INTEGER PRIMARY KEY, "
+        "username TEXT UNIQUE NOT NULL, "   // The unique index also orders LIST pages
+        "registered_at INTEGER"
+        ");",
+        
+        // Server bookkeeping, e.g. the namespace snapshot's generation marker
+        "CREATE TABLE IF NOT EXISTS nm_meta ("
+        "key TEXT PRIMARY KEY, "
+        "value INTEGER"
+        ");",
+        
+        // Per-user VIEW range scans
+        "CREATE INDEX IF NOT EXISTS idx_files_owner ON files (owner, filename);",
+        "CREATE INDEX IF NOT EXISTS idx_access_user ON access_control (username, filename);"
     };
     
-    for (int i = 0; i < 5; i++) {
+    for (size_t i = 0; i < sizeof(sqls) / sizeof(sqls[0]); i++) {
         char* err_msg = NULL;
         rc = sqlite3_exec(server_state.db, sqls[i], 0, 0, &err_msg);
         if (rc != SQLITE_OK) {
@@ -63,25 +170,53 @@ int init_database() {
         }
     }
     
+    add_storage_path_column();
+    seed_users();
+    
+    if (stmt_cache_prepare(server_state.db, nm_statements, NM_STMT_COUNT) < 0) {
+        return -1;
+    }
+    
     return 0;
 }
 
 int load_files_from_db() {
     sqlite3_stmt* stmt;
-    const char* sql = "SELECT filename FROM files;";
+    const char* sql = "SELECT filename, owner, storage_server_id, replica_server_id, word_count, "
+                      "char_count, sentence_count, created_at, modified_at, accessed_at, is_folder, storage_path "
+                      "FROM files;";
     
     if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) != SQLITE_OK) {
         return -1;
     }
     
     int count = 0;
+    FileMetadata meta;
     while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* filename = (const char*)sqlite3_column_text(stmt, 0);
-        trie_insert(server_state.file_trie, filename);
-        count++;
+        memset(&meta, 0, sizeof(meta));
+        strncpy(meta.filename, (const char*)sqlite3_column_text(stmt, 0), MAX_FILENAME - 1);
+        strncpy(meta.owner, (const char*)sqlite3_column_text(stmt, 1), MAX_USERNAME - 1);
+        meta.storage_server_id = sqlite3_column_int(stmt, 2);
+        // Folders are inserted without a replica
+        meta.replica_server_id = sqlite3_column_type(stmt, 3) == SQLITE_NULL ? -1 : sqlite3_column_int(stmt, 3);
+        meta.word_count = sqlite3_column_int(stmt, 4);
+        meta.char_count = sqlite3_column_int(stmt, 5);
+        meta.sentence_count = sqlite3_column_int(stmt, 6);
+        meta.created_at = sqlite3_column_int64(stmt, 7);
+        meta.modified_at = sqlite3_column_int64(stmt, 8);
+        meta.accessed_at = sqlite3_column_int64(stmt, 9);
+        meta.is_folder = sqlite3_column_int(stmt, 10);
+        if (sqlite3_column_type(stmt, 11) != SQLITE_NULL) {
+            strncpy(meta.path, (const char*)sqlite3_column_text(stmt, 11), MAX_FILENAME - 1);
+        }
+        
+        if (index_add_file(&meta, NULL) == 0) {
+            count++;
+        }
     }
     
     sqlite3_finalize(stmt);
+    index_link_orphans();
     
     char log_buf[128];
     snprintf(log_buf, sizeof(log_buf), "Loaded %d files from database", count);
@@ -90,42 +225,87 @@ int load_files_from_db() {
     return 0;
 }
 
-int check_permission(const char* username, const char* filename, int required_perm) {
+int load_acl_from_db() {
     sqlite3_stmt* stmt;
+    const char* sql = "SELECT filename, username, permissions FROM access_control;";
     
-    // Check if user is owner (owners have all permissions)
-    const char* sql = "SELECT owner FROM files WHERE filename = ?;";
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_STATIC);
-        
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            const char* owner = (const char*)sqlite3_column_text(stmt, 0);
-            if (strcmp(owner, username) == 0) {
-                sqlite3_finalize(stmt);
-                return 1;
-            }
-        }
-        sqlite3_finalize(stmt);
+    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
     }
     
-    // Check access control list
-    sql = "SELECT permissions FROM access_control WHERE filename = ? AND username = ?;";
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, username, -1, SQLITE_STATIC);
-        
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            int perms = sqlite3_column_int(stmt, 0);
-            int has_perm = (perms & required_perm) == required_perm;
-            sqlite3_finalize(stmt);
-            return has_perm;
+    // Grants on files that no longer exist are skipped; nothing can check them
+    int count = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* filename = (const char*)sqlite3_column_text(stmt, 0);
+        if (file_exists(filename)) {
+            index_set_permissions(filename, (const char*)sqlite3_column_text(stmt, 1),
+                                  sqlite3_column_int(stmt, 2));
+            count++;
         }
-        sqlite3_finalize(stmt);
     }
     
+    sqlite3_finalize(stmt);
+    
+    char log_buf[128];
+    snprintf(log_buf, sizeof(log_buf), "Loaded %d access entries from database", count);
+    log_message("NameServer", log_buf);
+    
     return 0;
 }
 
+int check_permission(const char* username, const FileMetadata* file, int required_perm) {
+    // Owners have all permissions
+    if (strcmp(file->owner, username) == 0) {
+        return 1;
+    }
+    
+    int perms = index_get_permissions(file->filename, username);
+    return (perms & required_perm) == required_perm;
+}
+
+void init_locks() {
+    pthread_rwlock_init(&server_state.ns_lock, NULL);
+    for (int i = 0; i < NM_FILE_STRIPES; i++) {
+        pthread_mutex_init(&server_state.file_stripes[i], NULL);
+    }
+    pthread_rwlock_init(&server_state.index_lock, NULL);
+    pthread_mutex_init(&server_state.dirty_mutex, NULL);
+    pthread_cond_init(&server_state.flush_cond, NULL);
+    pthread_mutex_init(&server_state.lock_table_mutex, NULL);
+    pthread_cond_init(&server_state.reaper_cond, NULL);
+    pthread_mutex_init(&server_state.ss_health_mutex, NULL);
+    pthread_cond_init(&server_state.detector_cond, NULL);
+    pthread_rwlock_init(&server_state.user_lock, NULL);
+}
+
+void destroy_locks() {
+    pthread_rwlock_destroy(&server_state.ns_lock);
+    for (int i = 0; i < NM_FILE_STRIPES; i++) {
+        pthread_mutex_destroy(&server_state.file_stripes[i]);
+    }
+    pthread_rwlock_destroy(&server_state.index_lock);
+    pthread_mutex_destroy(&server_state.dirty_mutex);
+    pthread_cond_destroy(&server_state.flush_cond);
+    pthread_mutex_destroy(&server_state.lock_table_mutex);
+    pthread_cond_destroy(&server_state.reaper_cond);
+    pthread_mutex_destroy(&server_state.ss_health_mutex);
+    pthread_cond_destroy(&server_state.detector_cond);
+    pthread_rwlock_destroy(&server_state.user_lock);
+}
+
+static pthread_mutex_t* file_stripe(const char* filename) {
+    // Unrelated files rarely share a stripe
+    return &server_state.file_stripes[filename_hash(filename) % NM_FILE_STRIPES];
+}
+
+void lock_file(const char* filename) {
+    pthread_mutex_lock(file_stripe(filename));
+}
+
+void unlock_file(const char* filename) {
+    pthread_mutex_unlock(file_stripe(filename));
+}
+
 StorageServerInfo* get_ss_by_id(int ss_id) {
     for (int i = 0; i < server_state.ss_count; i++) {
         if (server_state.storage_servers[i].id == ss_id && 
@@ -136,24 +316,19 @@ StorageServerInfo* get_ss_by_id(int ss_id) {
     return NULL;
 }
 
-void release_lock(const char* filename, int sentence_num, const char* username, int client_socket) {
-    for (int i = 0; i < server_state.lock_count; i++) {
-        if (strcmp(server_state.locks[i].filename, filename) == 0 &&
-            server_state.locks[i].sentence_number == sentence_num &&
-            strcmp(server_state.locks[i].username, username) == 0 &&
-            server_state.locks[i].client_socket == client_socket) {
-            
-            // Remove lock by shifting remaining locks
-            for (int j = i; j < server_state.lock_count - 1; j++) {
-                server_state.locks[j] = server_state.locks[j + 1];
-            }
-            server_state.lock_count--;
-            
-            char log_buf[256];
-            snprintf(log_buf, sizeof(log_buf), "Lock released: %s sentence %d by %s", 
-                    filename, sentence_num, username);
-            log_message("NameServer", log_buf);
-            break;
-        }
+StorageServerInfo* get_ss_for_read(const FileMetadata* file) {
+    StorageServerInfo* ss = get_ss_by_id(file->storage_server_id);
+    if (!ss && file->replica_server_id >= 0) {
+        ss = get_ss_by_id(file->replica_server_id);
+    }
+    return ss;
+}
+
+// Files renamed by MOVE (or created with a name the storage servers cannot
+// use as-is) live there under meta.path; clients send that name to the SS
+void append_storage_key(char* data, size_t size, const FileMetadata* file) {
+    if (file->path[0] && strcmp(file->path, file->filename) != 0) {
+        size_t used = strlen(data);
+        snprintf(data + used, size - used, "|KEY:%s", file->path);
     }
 }
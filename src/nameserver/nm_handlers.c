@@ -1,30 +1,43 @@
 #include "../../include/nameserver.h"
 
 void handle_register_ss(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
-    if (server_state.ss_count >= MAX_STORAGE_SERVERS) {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Max storage servers reached");
-        send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
-        return;
-    }
+    char ip[INET_ADDRSTRLEN] = {0};
+    int port = 0;
+    sscanf(msg->data, "%15[^:]:%d", ip, &port);
     
-    char ip[INET_ADDRSTRLEN];
-    int port;
-    sscanf(msg->data, "%[^:]:%d", ip, &port);
+    pthread_rwlock_wrlock(&server_state.ns_lock);
+    
+    // A server coming back on the same address (e.g. one restored from the
+    // namespace snapshot) keeps its ID, so the files placed on it resolve
+    StorageServerInfo* ss = NULL;
+    for (int i = 0; i < server_state.ss_count; i++) {
+        if (server_state.storage_servers[i].port == port && strcmp(server_state.storage_servers[i].ip, ip) == 0) {
+            ss = &server_state.storage_servers[i];
+            break;
+        }
+    }
     
-    int ss_id = server_state.next_ss_id++;
-    StorageServerInfo* ss = &server_state.storage_servers[server_state.ss_count++];
-    ss->id = ss_id;
-    strncpy(ss->ip, ip, INET_ADDRSTRLEN - 1);
-    ss->port = port;
+    if (!ss) {
+        if (server_state.ss_count >= MAX_STORAGE_SERVERS) {
+            pthread_rwlock_unlock(&server_state.ns_lock);
+            set_message_error(&resp, ERR_SERVER_ERROR, "Max storage servers reached");
+            send_message(sock, &resp);
+            return;
+        }
+        ss = &server_state.storage_servers[server_state.ss_count++];
+        ss->id = server_state.next_ss_id++;
+        strncpy(ss->ip, ip, INET_ADDRSTRLEN - 1);
+        ss->port = port;
+        ss->file_count = 0;
+    }
+    int ss_id = ss->id;
     ss->is_alive = 1;
     ss->last_heartbeat = time(NULL);
-    ss->file_count = 0;
+    
+    pthread_rwlock_unlock(&server_state.ns_lock);
     
     resp.error_code = ERR_SUCCESS;
     snprintf(resp.data, sizeof(resp.data), "SS_ID:%d", ss_id);
@@ -33,364 +46,463 @@ void handle_register_ss(int sock, Message* msg) {
     char log_buf[256];
     snprintf(log_buf, sizeof(log_buf), "Storage Server registered: ID=%d, %s:%d", ss_id, ip, port);
     log_message("NameServer", log_buf);
-    
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
-void handle_register_client(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
-    int exists = 0;
-    for (int i = 0; i < server_state.user_count; i++) {
-        if (strcmp(server_state.users[i].username, msg->username) == 0) {
-            exists = 1;
+// Heartbeats refresh last_heartbeat and the load figures placement uses;
+// the failure detector decides whether that brings a server back up
+void handle_heartbeat(int sock, Message* msg) {
+    (void)sock; // Not answered: the storage server never reads this connection
+    
+    int ss_id = -1;
+    unsigned long long used = 0, free_bytes = 0;
+    int rate = 0, latency = 0;
+    sscanf(msg->data, "SS_ID:%d|USED:%llu|FREE:%llu|RPS:%d|LAT_US:%d",
+           &ss_id, &used, &free_bytes, &rate, &latency);
+    
+    int found = 0;
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    pthread_mutex_lock(&server_state.ss_health_mutex);
+    for (int i = 0; i < server_state.ss_count; i++) {
+        if (server_state.storage_servers[i].id == ss_id) {
+            StorageServerInfo* ss = &server_state.storage_servers[i];
+            ss->last_heartbeat = time(NULL);
+            ss->bytes_used = used;
+            ss->bytes_free = free_bytes;
+            ss->request_rate = rate;
+            ss->latency_us = latency;
+            found = 1;
             break;
         }
     }
+    pthread_mutex_unlock(&server_state.ss_health_mutex);
+    pthread_rwlock_unlock(&server_state.ns_lock);
     
-    if (!exists && server_state.user_count < MAX_USERS) {
-        UserInfo* user = &server_state.users[server_state.user_count++];
-        strncpy(user->username, msg->username, MAX_USERNAME - 1);
-        user->registered_at = time(NULL);
-        
-        char log_buf[256];
-        snprintf(log_buf, sizeof(log_buf), "Client registered: %s", msg->username);
+    if (!found) {
+        char log_buf[128];
+        snprintf(log_buf, sizeof(log_buf), "Heartbeat from unknown storage server %d", ss_id);
         log_message("NameServer", log_buf);
     }
-    
-    Message resp;
-    init_message(&resp);
-    resp.error_code = ERR_SUCCESS;
-    strcpy(resp.data, "Registered successfully");
-    send_message(sock, &resp);
-    
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
-void handle_create(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
+void handle_register_client(int sock, Message* msg) {
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
-    if (trie_search(server_state.file_trie, msg->filename)) {
-        set_message_error(&resp, ERR_FILE_EXISTS, "File already exists");
+    if (!msg->username[0]) {
+        set_message_error(&resp, ERR_INVALID_PARAM, "Username required");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    if (server_state.ss_count == 0) {
-        set_message_error(&resp, ERR_SS_NOT_FOUND, "No storage servers available");
+    // Shared: a new user's row must not join (and roll back with) a MULTI batch
+    int created;
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    int user_id = user_register(msg->username, &created);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (user_id > 0 && created && group_commit_wait(&server_state.commits) < 0) {
+        user_forget(msg->username);
+        user_id = -1;
+    }
+    if (user_id < 0) {
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to register user");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    // Select SS with least files (load balancing)
-    int ss_idx = 0;
-    for (int i = 1; i < server_state.ss_count; i++) {
-        if (server_state.storage_servers[i].file_count < server_state.storage_servers[ss_idx].file_count &&
-            server_state.storage_servers[i].is_alive) {
-            ss_idx = i;
+    if (created) {
+        char log_buf[256];
+        snprintf(log_buf, sizeof(log_buf), "Client registered: %s (user %d)", msg->username, user_id);
+        log_message("NameServer", log_buf);
+    }
+    
+    resp.error_code = ERR_SUCCESS;
+    strcpy(resp.data, "Registered successfully");
+    send_message(sock, &resp);
+}
+
+static int storage_path_used(const char* path) {
+    CachedStmt* cs = &nm_statements[NM_STMT_STORAGE_PATH_USED];
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    if (!stmt) {
+        return 1;
+    }
+    sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+    int used = sqlite3_step(stmt) == SQLITE_ROW;
+    stmt_release(cs);
+    return used;
+}
+
+// Names the storage server keeps in its data directory for itself
+static const char* ss_reserved_names[] = {
+    ".", "..", "undo", "checkpoints",
+    "metadata.db", "metadata.db-wal", "metadata.db-shm", "metadata.db-journal", NULL
+};
+
+static int is_reserved_storage_name(const char* name) {
+    for (int i = 0; ss_reserved_names[i]; i++) {
+        if (strcmp(name, ss_reserved_names[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Storage servers keep files flat, under a name no other file uses: the
+// filename with '%', '/' and '~' escaped (and the first character too if
+// it would be one of the server's own files), or a hash if that gets too
+// long, plus "~n" if a moved file already holds it. Caller holds the
+// file's stripe.
+static void choose_storage_path(const char* filename, char* path, size_t size) {
+    char base[MAX_FILENAME];
+    size_t len = 0;
+    int reserved = is_reserved_storage_name(filename);
+    for (const char* p = filename; *p && len < sizeof(base) - 16; p++) {
+        if (*p == '%' || *p == '/' || *p == '~' || (reserved && p == filename)) {
+            len += snprintf(base + len, sizeof(base) - len, "%%%02X", (unsigned char)*p);
+        } else {
+            base[len++] = *p;
         }
     }
+    base[len] = '\0';
+    if (len >= sizeof(base) - 16) {
+        snprintf(base, sizeof(base), "~%016lx", filename_hash(filename));
+    }
     
-    StorageServerInfo* ss = &server_state.storage_servers[ss_idx];
+    snprintf(path, size, "%s", base);
+    for (int n = 1; storage_path_used(path); n++) {
+        snprintf(path, size, "%s~%d", base, n);
+    }
+}
+
+int check_parent_folder(const char* filename, Message* resp) {
+    const char* slash = strrchr(filename, '/');
+    if (!slash) {
+        return 0;
+    }
+    char parent[MAX_FILENAME];
+    memcpy(parent, filename, slash - filename);
+    parent[slash - filename] = '\0';
+    if (!slash[1] || index_lookup_folder(parent, NULL) != 1) {
+        set_message_error(resp, ERR_FOLDER_NOT_FOUND, "Parent folder does not exist");
+        return -1;
+    }
+    return 0;
+}
+
+void process_create(const Message* msg, Message* resp) {
+    if (file_exists(msg->filename)) {
+        set_message_error(resp, ERR_FILE_EXISTS, "File already exists");
+        return;
+    }
+    if (check_parent_folder(msg->filename, resp) < 0) {
+        return;
+    }
     
-    // Select replica server (different from primary)
-    int replica_idx = -1;
-    for (int i = 0; i < server_state.ss_count; i++) {
-        if (i != ss_idx && server_state.storage_servers[i].is_alive) {
-            replica_idx = i;
-            break;
-        }
+    // Primary and replica by placement score (capacity and load)
+    int replica_idx;
+    int ss_idx = choose_storage_servers(&replica_idx);
+    if (ss_idx < 0) {
+        set_message_error(resp, ERR_SS_NOT_FOUND, "No storage servers available");
+        return;
     }
     
-    // Insert into database
-    sqlite3_stmt* stmt;
-    const char* sql = "INSERT INTO files (filename, owner, storage_server_id, replica_server_id, "
-                     "created_at, modified_at, accessed_at) VALUES (?, ?, ?, ?, ?, ?, ?);";
+    StorageServerInfo* ss = &server_state.storage_servers[ss_idx];
     
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        time_t now = time(NULL);
-        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, msg->username, -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 3, ss->id);
-        sqlite3_bind_int(stmt, 4, replica_idx >= 0 ? server_state.storage_servers[replica_idx].id : -1);
-        sqlite3_bind_int64(stmt, 5, now);
-        sqlite3_bind_int64(stmt, 6, now);
-        sqlite3_bind_int64(stmt, 7, now);
+    // Insert into database
+    group_commit_begin(&server_state.commits);
+    CachedStmt* cs = &nm_statements[NM_STMT_INSERT_FILE];
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    
+    if (stmt) {
+        FileMetadata meta;
+        memset(&meta, 0, sizeof(meta));
+        strncpy(meta.filename, msg->filename, MAX_FILENAME - 1);
+        strncpy(meta.owner, msg->username, MAX_USERNAME - 1);
+        meta.storage_server_id = ss->id;
+        meta.replica_server_id = replica_idx >= 0 ? server_state.storage_servers[replica_idx].id : -1;
+        meta.created_at = meta.modified_at = meta.accessed_at = time(NULL);
+        choose_storage_path(meta.filename, meta.path, sizeof(meta.path));
+        
+        sqlite3_bind_text(stmt, 1, meta.filename, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, meta.owner, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 3, meta.storage_server_id);
+        sqlite3_bind_int(stmt, 4, meta.replica_server_id);
+        sqlite3_bind_int64(stmt, 5, meta.created_at);
+        sqlite3_bind_int64(stmt, 6, meta.modified_at);
+        sqlite3_bind_int64(stmt, 7, meta.accessed_at);
+        sqlite3_bind_text(stmt, 8, meta.path, -1, SQLITE_STATIC);
         
         if (sqlite3_step(stmt) == SQLITE_DONE) {
-            trie_insert(server_state.file_trie, msg->filename);
-            ss->file_count++;
+            index_add_file(&meta, ss);
             
-            resp.error_code = ERR_SUCCESS;
-            snprintf(resp.data, sizeof(resp.data), "SS:%s:%d", ss->ip, ss->port);
+            resp->error_code = ERR_SUCCESS;
+            snprintf(resp->data, sizeof(resp->data), "SS:%s:%d", ss->ip, ss->port);
             if (replica_idx >= 0) {
                 char replica_info[128];
                 snprintf(replica_info, sizeof(replica_info), "|REPLICA:%s:%d",
                         server_state.storage_servers[replica_idx].ip,
                         server_state.storage_servers[replica_idx].port);
-                strncat(resp.data, replica_info, sizeof(resp.data) - strlen(resp.data) - 1);
+                strncat(resp->data, replica_info, sizeof(resp->data) - strlen(resp->data) - 1);
             }
+            append_storage_key(resp->data, sizeof(resp->data), &meta);
             
             char log_buf[512];
             snprintf(log_buf, sizeof(log_buf), "File created: %s by %s on SS%d", 
                     msg->filename, msg->username, ss->id);
             log_message("NameServer", log_buf);
         } else {
-            set_message_error(&resp, ERR_SERVER_ERROR, "Failed to create file metadata");
+            set_message_error(resp, ERR_SERVER_ERROR, "Failed to create file metadata");
         }
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     } else {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+        set_message_error(resp, ERR_SERVER_ERROR, "Database error");
     }
-    
-    send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
+    group_commit_end(&server_state.commits);
 }
 
-void handle_read(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
+void handle_create(int sock, Message* msg) {
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
+    
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    lock_file(msg->filename);
+    process_create(msg, &resp);
+    unlock_file(msg->filename);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (resp.error_code == ERR_SUCCESS && group_commit_wait(&server_state.commits) < 0) {
+        index_undo_add(msg->filename);
+        init_response(&resp, msg);
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to persist file metadata");
+    }
     
-    if (!trie_search(server_state.file_trie, msg->filename)) {
-        set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
-        send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
+    send_message(sock, &resp);
+}
+
+void process_read(const Message* msg, Message* resp) {
+    FileMetadata file;
+    if (!index_get_file(msg->filename, &file)) {
+        set_message_error(resp, ERR_FILE_NOT_FOUND, "File not found");
         return;
     }
     
-    if (!check_permission(msg->username, msg->filename, ACCESS_READ)) {
-        set_message_error(&resp, ERR_PERMISSION_DENIED, "No read permission");
-        send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
+    if (!check_permission(msg->username, &file, ACCESS_READ)) {
+        set_message_error(resp, ERR_PERMISSION_DENIED, "No read permission");
         return;
     }
     
-    // Get SS info from database
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT storage_server_id, replica_server_id FROM files WHERE filename = ?;";
+    StorageServerInfo* ss = get_ss_for_read(&file);
     
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-        
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            int ss_id = sqlite3_column_int(stmt, 0);
-            int replica_id = sqlite3_column_int(stmt, 1);
-            
-            StorageServerInfo* ss = get_ss_by_id(ss_id);
-            if (!ss && replica_id >= 0) {
-                ss = get_ss_by_id(replica_id);
-            }
-            
-            if (ss) {
-                resp.error_code = ERR_SUCCESS;
-                snprintf(resp.data, sizeof(resp.data), "SS:%s:%d", ss->ip, ss->port);
-            } else {
-                set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
-            }
-        } else {
-            set_message_error(&resp, ERR_FILE_NOT_FOUND, "File metadata not found");
-        }
-        sqlite3_finalize(stmt);
+    if (ss) {
+        resp->error_code = ERR_SUCCESS;
+        snprintf(resp->data, sizeof(resp->data), "SS:%s:%d", ss->ip, ss->port);
+        append_storage_key(resp->data, sizeof(resp->data), &file);
     } else {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+        set_message_error(resp, ERR_SS_NOT_FOUND, "Storage server not available");
     }
     
-    send_message(sock, &resp);
+    // Saved to the database later by the timestamp flusher
+    index_touch_file(msg->filename, 0);
+}
+
+void handle_read(int sock, Message* msg) {
+    Message resp;
+    init_response(&resp, msg);
     
-    // Update accessed_at timestamp
-    sql = "UPDATE files SET accessed_at = ? WHERE filename = ?;";
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        sqlite3_bind_int64(stmt, 1, time(NULL));
-        sqlite3_bind_text(stmt, 2, msg->filename, -1, SQLITE_STATIC);
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
-    }
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    process_read(msg, &resp);
+    pthread_rwlock_unlock(&server_state.ns_lock);
     
-    pthread_mutex_unlock(&server_state.mutex);
+    send_message(sock, &resp);
 }
 
 void handle_write(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
-    int sentence_num;
-    if (sscanf(msg->data, "%d", &sentence_num) != 1) {
-        set_message_error(&resp, ERR_INVALID_PARAM, "Invalid sentence number");
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    
+    char spec[SENTENCE_SPEC_MAX];
+    int sentences[MAX_SENTENCES];
+    int count = -1;
+    int wait_ms = 0;
+    if (sscanf(msg->data, "%127s -w %d", spec, &wait_ms) >= 1) {
+        count = parse_sentence_set(spec, sentences, MAX_SENTENCES);
+    }
+    if (count <= 0 || wait_ms < 0 || wait_ms > WRITE_LOCK_MAX_WAIT_MS) {
+        set_message_error(&resp, ERR_INVALID_PARAM, "Invalid sentence number or wait");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    if (!trie_search(server_state.file_trie, msg->filename)) {
+    FileMetadata file;
+    if (!index_get_file(msg->filename, &file)) {
+        // Locks granted while the request waited are no use any more
+        lock_release(msg->filename, sentences, count, sock);
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    if (!check_permission(msg->username, msg->filename, ACCESS_WRITE)) {
+    if (!check_permission(msg->username, &file, ACCESS_WRITE)) {
+        lock_release(msg->filename, sentences, count, sock);
         set_message_error(&resp, ERR_PERMISSION_DENIED, "No write permission");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    // Check if sentence is already locked
-    int lock_already_held = 0;
-    for (int i = 0; i < server_state.lock_count; i++) {
-        if (strcmp(server_state.locks[i].filename, msg->filename) == 0 &&
-            server_state.locks[i].sentence_number == sentence_num) {
-            // Check if it's the same client (same socket)
-            if (server_state.locks[i].client_socket == sock) {
-                // Same client re-acquiring lock
-                lock_already_held = 1;
-                break;
-            } else {
-                // Different client (even if same username)
-                char err_buf[256];
-                snprintf(err_buf, sizeof(err_buf), "Sentence %d locked by %s (different session)", 
-                        sentence_num, server_state.locks[i].username);
-                set_message_error(&resp, ERR_LOCKED, err_buf);
-                send_message(sock, &resp);
-                pthread_mutex_unlock(&server_state.mutex);
-                return;
-            }
-        }
+    // Re-acquiring locks this connection holds just renews their leases
+    char holder[MAX_USERNAME];
+    int conflict = sentences[0];
+    int error = lock_acquire(msg, sentences, count, sock, wait_ms, holder, &conflict);
+    if (error == NM_LOCK_QUEUED) {
+        // Answered when this request is re-run (see nm_locks.c)
+        pthread_rwlock_unlock(&server_state.ns_lock);
+        return;
     }
-    
-    // Acquire new lock if not already held
-    if (!lock_already_held) {
-        if (server_state.lock_count < MAX_LOCKS) {
-            SentenceLock* lock = &server_state.locks[server_state.lock_count++];
-            strncpy(lock->filename, msg->filename, MAX_FILENAME - 1);
-            lock->sentence_number = sentence_num;
-            strncpy(lock->username, msg->username, MAX_USERNAME - 1);
-            lock->client_socket = sock;  // Track specific client connection
-            lock->locked_at = time(NULL);
-            
-            char log_buf[256];
-            snprintf(log_buf, sizeof(log_buf), "Lock acquired: %s sentence %d by %s",
-                    msg->filename, sentence_num, msg->username);
-            log_message("NameServer", log_buf);
+    if (error != ERR_SUCCESS) {
+        char err_buf[256];
+        if (error == ERR_LOCKED) {
+            snprintf(err_buf, sizeof(err_buf), "Sentence %d locked by %s (different session)",
+                    conflict, holder);
         } else {
-            set_message_error(&resp, ERR_SERVER_ERROR, "Lock table full");
-            send_message(sock, &resp);
-            pthread_mutex_unlock(&server_state.mutex);
-            return;
+            snprintf(err_buf, sizeof(err_buf), "Failed to lock sentence %s", spec);
         }
+        set_message_error(&resp, error, err_buf);
+        pthread_rwlock_unlock(&server_state.ns_lock);
+        send_message(sock, &resp);
+        return;
     }
     
-    // Get SS info
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT storage_server_id, replica_server_id FROM files WHERE filename = ?;";
+    StorageServerInfo* ss = get_ss_by_id(file.storage_server_id);
+    StorageServerInfo* replica = file.replica_server_id >= 0 ? get_ss_by_id(file.replica_server_id) : NULL;
     
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-        
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            int ss_id = sqlite3_column_int(stmt, 0);
-            int replica_id = sqlite3_column_int(stmt, 1);
-            
-            StorageServerInfo* ss = get_ss_by_id(ss_id);
-            StorageServerInfo* replica = replica_id >= 0 ? get_ss_by_id(replica_id) : NULL;
-            
-            if (ss) {
-                resp.error_code = ERR_SUCCESS;
-                snprintf(resp.data, sizeof(resp.data), "SS:%s:%d|SENTENCE:%d", ss->ip, ss->port, sentence_num);
-                if (replica) {
-                    char replica_info[128];
-                    snprintf(replica_info, sizeof(replica_info), "|REPLICA:%s:%d", replica->ip, replica->port);
-                    strncat(resp.data, replica_info, sizeof(resp.data) - strlen(resp.data) - 1);
-                }
-            } else {
-                set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
-            }
-        } else {
-            set_message_error(&resp, ERR_FILE_NOT_FOUND, "File metadata not found");
+    if (ss) {
+        resp.error_code = ERR_SUCCESS;
+        snprintf(resp.data, sizeof(resp.data), "SS:%s:%d|SENTENCE:%s|LEASE:%d", ss->ip, ss->port,
+                spec, server_state.lock_lease_seconds);
+        if (replica) {
+            char replica_info[128];
+            snprintf(replica_info, sizeof(replica_info), "|REPLICA:%s:%d", replica->ip, replica->port);
+            strncat(resp.data, replica_info, sizeof(resp.data) - strlen(resp.data) - 1);
         }
-        sqlite3_finalize(stmt);
+        append_storage_key(resp.data, sizeof(resp.data), &file);
     } else {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+        // Nothing can be written, so don't leave the sentences locked
+        lock_release(msg->filename, sentences, count, sock);
+        set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
     }
     
+    pthread_rwlock_unlock(&server_state.ns_lock);
     send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
-void handle_delete(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
+// ETIRW (the edit was written) and WRITE_UNLOCK (it was abandoned) release
+// the set WRITE_LOCK took
+void handle_write_release(int sock, Message* msg) {
+    Message resp;
+    init_response(&resp, msg);
+    
+    char spec[SENTENCE_SPEC_MAX];
+    int sentences[MAX_SENTENCES];
+    int count = -1;
+    if (sscanf(msg->data, "%127s", spec) == 1) {
+        count = parse_sentence_set(spec, sentences, MAX_SENTENCES);
+    }
+    if (count <= 0) {
+        set_message_error(&resp, ERR_INVALID_PARAM, "Invalid sentence number");
+        send_message(sock, &resp);
+        return;
+    }
     
+    int released = lock_release(msg->filename, sentences, count, sock);
+    if (strcmp(msg->type, MSG_WRITE_COMMIT) == 0) {
+        // The write already landed on the SS; a lease that ran out mid-edit
+        // only means someone else may be editing too, so just note it
+        if (released < count) {
+            char warn_buf[512];
+            snprintf(warn_buf, sizeof(warn_buf), "Commit of %s sentence %s by %s without a live lock",
+                    msg->filename, spec, msg->username);
+            log_message("NameServer", warn_buf);
+        }
+        index_touch_file(msg->filename, 1);
+    }
+    
+    resp.error_code = ERR_SUCCESS;
+    send_message(sock, &resp);
+}
+
+void handle_delete(int sock, Message* msg) {
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
-    if (!trie_search(server_state.file_trie, msg->filename)) {
+    // Folders are deleted under an exclusive ns_lock so no CREATE can add a
+    // child between the emptiness check and the delete
+    int exclusive = index_lookup_folder(msg->filename, NULL) == 1;
+    if (exclusive) {
+        pthread_rwlock_wrlock(&server_state.ns_lock);
+    } else {
+        pthread_rwlock_rdlock(&server_state.ns_lock);
+    }
+    lock_file(msg->filename);
+    
+    FileMetadata file;
+    if (!index_get_file(msg->filename, &file)) {
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
     // Check if user is owner
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT owner, storage_server_id, replica_server_id FROM files WHERE filename = ?;";
-    
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+    if (strcmp(file.owner, msg->username) != 0) {
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
+        set_message_error(&resp, ERR_NOT_OWNER, "Only owner can delete file");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-    
-    int ss_id = -1, replica_id = -1;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* owner = (const char*)sqlite3_column_text(stmt, 0);
-        if (strcmp(owner, msg->username) != 0) {
-            set_message_error(&resp, ERR_NOT_OWNER, "Only owner can delete file");
+    if (file.is_folder) {
+        int has_children = 0;
+        index_lookup_folder(msg->filename, &has_children);
+        if (!exclusive || has_children) {
+            unlock_file(msg->filename);
+            pthread_rwlock_unlock(&server_state.ns_lock);
+            if (has_children) {
+                set_message_error(&resp, ERR_INVALID_PARAM, "Folder is not empty");
+            } else {
+                set_message_error(&resp, ERR_SERVER_BUSY, "File changed during delete, try again");
+            }
             send_message(sock, &resp);
-            sqlite3_finalize(stmt);
-            pthread_mutex_unlock(&server_state.mutex);
             return;
         }
-        ss_id = sqlite3_column_int(stmt, 1);
-        replica_id = sqlite3_column_int(stmt, 2);
     }
-    sqlite3_finalize(stmt);
+    int ss_id = file.storage_server_id;
+    int replica_id = file.replica_server_id;
     
     // Delete from database
-    sql = "DELETE FROM files WHERE filename = ?;";
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    group_commit_begin(&server_state.commits);
+    CachedStmt* cs = &nm_statements[NM_STMT_DELETE_FILE];
+    sqlite3_stmt* stmt;
+    if ((stmt = stmt_acquire(cs))) {
         sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
         sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     }
     
-    sql = "DELETE FROM access_control WHERE filename = ?;";
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    cs = &nm_statements[NM_STMT_DELETE_FILE_ACL];
+    if ((stmt = stmt_acquire(cs))) {
         sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
         sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     }
+    group_commit_end(&server_state.commits);
     
-    trie_delete(server_state.file_trie, msg->filename);
-    
-    // Decrease file count
-    for (int i = 0; i < server_state.ss_count; i++) {
-        if (server_state.storage_servers[i].id == ss_id) {
-            server_state.storage_servers[i].file_count--;
-            break;
-        }
-    }
+    index_remove_file(msg->filename, ss_id);
     
     // Get SS info for deletion
     StorageServerInfo* ss = get_ss_by_id(ss_id);
@@ -404,99 +516,283 @@ void handle_delete(int sock, Message* msg) {
             snprintf(replica_info, sizeof(replica_info), "|REPLICA:%s:%d", replica->ip, replica->port);
             strncat(resp.data, replica_info, sizeof(resp.data) - strlen(resp.data) - 1);
         }
+        append_storage_key(resp.data, sizeof(resp.data), &file);
+    }
+    
+    unlock_file(msg->filename);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (group_commit_wait(&server_state.commits) < 0) {
+        // The rows are back; put the entry back too, unless the name was
+        // taken while no lock was held
+        pthread_rwlock_rdlock(&server_state.ns_lock);
+        lock_file(msg->filename);
+        if (!file_exists(msg->filename)) {
+            index_restore_file(&file);
+        }
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
+        
+        init_response(&resp, msg);
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to persist deletion");
+        send_message(sock, &resp);
+        return;
     }
     send_message(sock, &resp);
     
     char log_buf[256];
     snprintf(log_buf, sizeof(log_buf), "File deleted: %s by %s", msg->filename, msg->username);
     log_message("NameServer", log_buf);
-    
-    pthread_mutex_unlock(&server_state.mutex);
+}
+
+// VIEW options: flag letters (a = all files, l = details), "-n page_size"
+// and "-p max_pages" (0 = until the listing ends)
+static int parse_view_options(const char* data, int* show_all, int* show_detailed,
+                              int* page_size, int* max_pages) {
+    char buf[256];
+    strncpy(buf, data, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    
+    char* save = NULL;
+    for (char* tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        if (tok[0] != '-') return -1;
+        if (strcmp(tok, "-n") == 0 || strcmp(tok, "-p") == 0) {
+            char* value = strtok_r(NULL, " \t", &save);
+            if (!value) return -1;
+            char* end;
+            long n = strtol(value, &end, 10);
+            if (*end != '\0' || n < 0) return -1;
+            if (tok[1] == 'n') {
+                if (n < 1 || n > VIEW_MAX_PAGE_SIZE) return -1;
+                *page_size = (int)n;
+            } else {
+                *max_pages = (int)n;
+            }
+            continue;
+        }
+        for (const char* c = tok + 1; *c; c++) {
+            if (*c == 'a') *show_all = 1;
+            else if (*c == 'l') *show_detailed = 1;
+            else return -1;
+        }
+    }
+    return 0;
 }
 
 void handle_view(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
-    int show_all = strstr(msg->data, "-a") != NULL;
-    int show_detailed = strstr(msg->data, "-l") != NULL;
-    
-    sqlite3_stmt* stmt;
-    const char* sql;
+    int show_all = 0, show_detailed = 0;
+    int page_size = VIEW_DEFAULT_PAGE_SIZE, max_pages = 0;
+    if (parse_view_options(msg->data, &show_all, &show_detailed, &page_size, &max_pages) < 0) {
+        set_message_error(&resp, ERR_INVALID_PARAM, "Usage: VIEW [-a] [-l] [-n page_size] [-p max_pages] [-c cursor]");
+        send_message(sock, &resp);
+        return;
+    }
     
-    if (show_all) {
-        sql = "SELECT filename, owner, is_folder, word_count, sentence_count, created_at FROM files ORDER BY filename;";
-        sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL);
-    } else {
-        sql = "SELECT DISTINCT f.filename, f.owner, f.is_folder, f.word_count, f.sentence_count, f.created_at "
-              "FROM files f LEFT JOIN access_control ac ON f.filename = ac.filename "
-              "WHERE f.owner = ? OR ac.username = ? ORDER BY f.filename;";
-        sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL);
-        sqlite3_bind_text(stmt, 1, msg->username, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, msg->username, -1, SQLITE_STATIC);
-    }
-    
-    char result[BUFFER_SIZE] = "";
-    int count = 0;
-    
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* filename = (const char*)sqlite3_column_text(stmt, 0);
-        const char* owner = (const char*)sqlite3_column_text(stmt, 1);
-        int is_folder = sqlite3_column_int(stmt, 2);
-        int word_count = sqlite3_column_int(stmt, 3);
-        int sentence_count = sqlite3_column_int(stmt, 4);
-        time_t created_at = sqlite3_column_int64(stmt, 5);
+    // The cursor is the last filename already sent; pages are keyset queries
+    // after it, so locks are dropped between pages and a file created or
+    // deleted mid-listing never shifts or repeats the remaining entries
+    char cursor[MAX_FILENAME];
+    strncpy(cursor, msg->filename, sizeof(cursor) - 1);
+    cursor[sizeof(cursor) - 1] = '\0';
+    int resumed = cursor[0] != '\0';
+    
+    CachedStmt* cs = &nm_statements[show_all ? NM_STMT_VIEW_ALL : NM_STMT_VIEW_USER];
+    int total = 0;
+    for (int page = 1; ; page++) {
+        size_t len = 0;
+        int count = 0;
+        int more = 0;
         
-        char line[512];
-        if (show_detailed) {
-            char time_str[64];
-            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&created_at));
-            snprintf(line, sizeof(line), "%s %-30s %-15s %5dw %3ds  %s\n",
-                    is_folder ? "d" : "-", filename, owner, word_count, sentence_count, time_str);
-        } else {
-            snprintf(line, sizeof(line), "%s%s\n", is_folder ? "[DIR] " : "", filename);
+        pthread_rwlock_rdlock(&server_state.ns_lock);
+        sqlite3_stmt* stmt = stmt_acquire(cs);
+        if (!stmt) {
+            pthread_rwlock_unlock(&server_state.ns_lock);
+            init_response(&resp, msg);
+            set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+            send_message(sock, &resp);
+            return;
+        }
+        sqlite3_bind_text(stmt, 1, cursor, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 2, page_size + 1);  // One extra row says whether another page follows
+        if (!show_all) {
+            sqlite3_bind_text(stmt, 3, msg->username, -1, SQLITE_STATIC);
         }
         
-        if (strlen(result) + strlen(line) < sizeof(result) - 1) {
-            strcat(result, line);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (count == page_size) {
+                more = 1;
+                break;
+            }
+            
+            const char* filename = (const char*)sqlite3_column_text(stmt, 0);
+            const char* owner = (const char*)sqlite3_column_text(stmt, 1);
+            int is_folder = sqlite3_column_int(stmt, 2);
+            int word_count = sqlite3_column_int(stmt, 3);
+            int sentence_count = sqlite3_column_int(stmt, 4);
+            time_t created_at = sqlite3_column_int64(stmt, 5);
+            
+            char line[512];
+            int line_len;
+            if (show_detailed) {
+                char time_str[64];
+                struct tm tm_info;
+                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime_r(&created_at, &tm_info));
+                line_len = snprintf(line, sizeof(line), "%s %-30s %-15s %5dw %3ds  %s\n",
+                                    is_folder ? "d" : "-", filename, owner, word_count, sentence_count, time_str);
+            } else {
+                line_len = snprintf(line, sizeof(line), "%s%s\n", is_folder ? "[DIR] " : "", filename);
+            }
+            if (line_len >= (int)sizeof(line)) line_len = sizeof(line) - 1;
+            
+            // A full frame ends the page early; the next one resumes here
+            if (len + line_len >= sizeof(resp.data)) {
+                more = 1;
+                break;
+            }
+            memcpy(resp.data + len, line, line_len + 1);
+            len += line_len;
+            
+            strncpy(cursor, filename, sizeof(cursor) - 1);
             count++;
         }
+        
+        stmt_release(cs);
+        pthread_rwlock_unlock(&server_state.ns_lock);
+        
+        total += count;
+        int last = !more || (max_pages > 0 && page == max_pages);
+        
+        resp.error_code = ERR_SUCCESS;
+        strcpy(resp.type, last ? MSG_VIEW : MSG_VIEW_PAGE);
+        if (last && more) {
+            strcpy(resp.filename, cursor);
+        }
+        if (total == 0 && !resumed) {
+            strcpy(resp.data, "No files found\n");
+        }
+        if (send_message(sock, &resp) < 0 || last) {
+            return;
+        }
+        resp.data[0] = '\0';
+    }
+}
+
+void handle_search(int sock, Message* msg) {
+    Message resp;
+    init_response(&resp, msg);
+    
+    // An optional "-n page_size " comes first; the rest is the prefix, verbatim
+    int page_size = SEARCH_DEFAULT_PAGE_SIZE;
+    const char* prefix = msg->data;
+    if (strncmp(prefix, "-n ", 3) == 0) {
+        char* end;
+        long n = strtol(prefix + 3, &end, 10);
+        if (end == prefix + 3 || (*end != ' ' && *end != '\0') || n < 1 || n > SEARCH_MAX_PAGE_SIZE) {
+            set_message_error(&resp, ERR_INVALID_PARAM, "Usage: SEARCH [-n page_size] <prefix> [-c resume_key]");
+            send_message(sock, &resp);
+            return;
+        }
+        page_size = (int)n;
+        prefix = *end ? end + 1 : end;
     }
     
-    sqlite3_finalize(stmt);
+    // One extra result says whether another page follows
+    char** results = malloc((page_size + 1) * sizeof(char*));
+    if (!results) {
+        set_message_error(&resp, ERR_SERVER_ERROR, "Out of memory");
+        send_message(sock, &resp);
+        return;
+    }
+    char resume[MAX_FILENAME];
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    int count = index_search_prefix(prefix, msg->filename, msg->username, results, page_size + 1, resume);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    size_t len = 0;
+    int sent = 0;
+    while (sent < count && sent < page_size) {
+        size_t name_len = strlen(results[sent]);
+        // A full frame ends the page early
+        if (len + name_len + 1 >= sizeof(resp.data)) break;
+        memcpy(resp.data + len, results[sent], name_len);
+        len += name_len;
+        resp.data[len++] = '\n';
+        sent++;
+    }
+    resp.data[len] = '\0';
     
-    if (count == 0) {
-        strcpy(result, "No files found\n");
+    if (sent < count) {
+        strcpy(resp.filename, results[sent - 1]);
+    } else if (resume[0]) {
+        strcpy(resp.filename, resume);
     }
+    for (int i = 0; i < count; i++) {
+        free(results[i]);
+    }
+    free(results);
     
     resp.error_code = ERR_SUCCESS;
-    strncpy(resp.data, result, sizeof(resp.data) - 1);
     send_message(sock, &resp);
-    
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
 void handle_list(int sock, Message* msg) {
-    (void)msg; // Unused parameter
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
-    
-    char result[BUFFER_SIZE] = "Registered Users:\n";
-    for (int i = 0; i < server_state.user_count; i++) {
-        char line[128];
-        snprintf(line, sizeof(line), "  - %s\n", server_state.users[i].username);
-        if (strlen(result) + strlen(line) < sizeof(result) - 1) {
-            strcat(result, line);
+    init_response(&resp, msg);
+    
+    int page_size = LIST_DEFAULT_PAGE_SIZE;
+    if (msg->data[0]) {
+        char extra;
+        if (sscanf(msg->data, "-n %d %c", &page_size, &extra) != 1 ||
+            page_size < 1 || page_size > LIST_MAX_PAGE_SIZE) {
+            set_message_error(&resp, ERR_INVALID_PARAM, "Usage: LIST [-n page_size] [-c cursor]");
+            send_message(sock, &resp);
+            return;
         }
     }
     
+    // Keyset page after the last name already sent, like VIEW
+    size_t len = 0;
+    if (!msg->filename[0]) {
+        len = snprintf(resp.data, sizeof(resp.data), "Registered Users:\n");
+    }
+    char cursor[MAX_USERNAME] = "";
+    int count = 0, more = 0;
+    
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    CachedStmt* cs = &nm_statements[NM_STMT_LIST_USERS];
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    if (stmt) {
+        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 2, page_size + 1);  // One extra row says whether another page follows
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* username = (const char*)sqlite3_column_text(stmt, 0);
+            char line[128];
+            int line_len = snprintf(line, sizeof(line), "  - %s\n", username);
+            // A full frame ends the page early; the next one resumes here
+            if (count == page_size || len + line_len >= sizeof(resp.data)) {
+                more = 1;
+                break;
+            }
+            memcpy(resp.data + len, line, line_len + 1);
+            len += line_len;
+            strncpy(cursor, username, sizeof(cursor) - 1);
+            count++;
+        }
+        stmt_release(cs);
+    }
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (!stmt) {
+        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+        send_message(sock, &resp);
+        return;
+    }
+    if (more) {
+        strcpy(resp.filename, cursor);
+    }
     resp.error_code = ERR_SUCCESS;
-    strncpy(resp.data, result, sizeof(resp.data) - 1);
     send_message(sock, &resp);
-    
-    pthread_mutex_unlock(&server_state.mutex);
 }
@@ -1,96 +1,88 @@
 #include "../../include/nameserver.h"
 
-void handle_addaccess(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
-    Message resp;
-    init_message(&resp);
-    
+void process_addaccess(const Message* msg, Message* resp) {
     // Parse: filename|username|permissions (1=read, 2=write)
     char target_user[MAX_USERNAME];
     int permissions = 0;
     
     if (sscanf(msg->data, "%[^|]|%d", target_user, &permissions) != 2) {
-        set_message_error(&resp, ERR_INVALID_PARAM, "Invalid format");
-        send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
+        set_message_error(resp, ERR_INVALID_PARAM, "Invalid format");
         return;
     }
     
-    if (!trie_search(server_state.file_trie, msg->filename)) {
-        set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
-        send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
+    FileMetadata file;
+    if (!index_get_file(msg->filename, &file)) {
+        set_message_error(resp, ERR_FILE_NOT_FOUND, "File not found");
         return;
     }
     
     // Check if requester is owner
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(server_state.db, "SELECT owner FROM files WHERE filename = ?;", -1, &stmt, NULL);
-    sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-    
-    int is_owner = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* owner = (const char*)sqlite3_column_text(stmt, 0);
-        is_owner = (strcmp(owner, msg->username) == 0);
-    }
-    sqlite3_finalize(stmt);
-    
-    if (!is_owner) {
-        set_message_error(&resp, ERR_NOT_OWNER, "Only owner can grant access");
-        send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
+    if (strcmp(file.owner, msg->username) != 0) {
+        set_message_error(resp, ERR_NOT_OWNER, "Only owner can grant access");
         return;
     }
     
-    // Check if target user exists
-    int user_exists = 0;
-    for (int i = 0; i < server_state.user_count; i++) {
-        if (strcmp(server_state.users[i].username, target_user) == 0) {
-            user_exists = 1;
-            break;
-        }
-    }
-    
-    if (!user_exists) {
-        set_message_error(&resp, ERR_USER_NOT_FOUND, "Target user not found");
-        send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
+    if (!user_lookup(target_user)) {
+        set_message_error(resp, ERR_USER_NOT_FOUND, "Target user not found");
         return;
     }
     
     // Insert or update access control
-    const char* sql = "INSERT OR REPLACE INTO access_control (filename, username, permissions) VALUES (?, ?, ?);";
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    group_commit_begin(&server_state.commits);
+    CachedStmt* cs = &nm_statements[NM_STMT_GRANT_ACCESS];
+    sqlite3_stmt* stmt;
+    if ((stmt = stmt_acquire(cs))) {
         sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
         sqlite3_bind_text(stmt, 2, target_user, -1, SQLITE_STATIC);
         sqlite3_bind_int(stmt, 3, permissions);
         
         if (sqlite3_step(stmt) == SQLITE_DONE) {
-            resp.error_code = ERR_SUCCESS;
-            snprintf(resp.data, sizeof(resp.data), "Access granted to %s", target_user);
+            index_set_permissions(msg->filename, target_user, permissions);
+            
+            resp->error_code = ERR_SUCCESS;
+            snprintf(resp->data, sizeof(resp->data), "Access granted to %s", target_user);
             
             char log_buf[256];
             snprintf(log_buf, sizeof(log_buf), "Access granted: %s to %s with perms %d by %s",
                     msg->filename, target_user, permissions, msg->username);
             log_message("NameServer", log_buf);
         } else {
-            set_message_error(&resp, ERR_SERVER_ERROR, "Failed to grant access");
+            set_message_error(resp, ERR_SERVER_ERROR, "Failed to grant access");
         }
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     } else {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+        set_message_error(resp, ERR_SERVER_ERROR, "Database error");
+    }
+    group_commit_end(&server_state.commits);
+}
+
+void handle_addaccess(int sock, Message* msg) {
+    Message resp;
+    init_response(&resp, msg);
+    
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    lock_file(msg->filename);
+    process_addaccess(msg, &resp);
+    unlock_file(msg->filename);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (resp.error_code == ERR_SUCCESS && group_commit_wait(&server_state.commits) < 0) {
+        lock_file(msg->filename);
+        index_reload_permissions(msg->filename);
+        unlock_file(msg->filename);
+        init_response(&resp, msg);
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to persist access change");
     }
     
     send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
 void handle_remaccess(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
+    
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    lock_file(msg->filename);
     
     // Parse: username
     char target_user[MAX_USERNAME];
@@ -98,39 +90,35 @@ void handle_remaccess(int sock, Message* msg) {
     target_user[MAX_USERNAME - 1] = '\0';
     trim(target_user);
     
-    if (!trie_search(server_state.file_trie, msg->filename)) {
+    FileMetadata file;
+    if (!index_get_file(msg->filename, &file)) {
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
     // Check if requester is owner
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(server_state.db, "SELECT owner FROM files WHERE filename = ?;", -1, &stmt, NULL);
-    sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-    
-    int is_owner = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* owner = (const char*)sqlite3_column_text(stmt, 0);
-        is_owner = (strcmp(owner, msg->username) == 0);
-    }
-    sqlite3_finalize(stmt);
-    
-    if (!is_owner) {
+    if (strcmp(file.owner, msg->username) != 0) {
         set_message_error(&resp, ERR_NOT_OWNER, "Only owner can revoke access");
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
     // Delete access control entry
-    const char* sql = "DELETE FROM access_control WHERE filename = ? AND username = ?;";
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    group_commit_begin(&server_state.commits);
+    CachedStmt* cs = &nm_statements[NM_STMT_REVOKE_ACCESS];
+    sqlite3_stmt* stmt;
+    if ((stmt = stmt_acquire(cs))) {
         sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
         sqlite3_bind_text(stmt, 2, target_user, -1, SQLITE_STATIC);
         
         if (sqlite3_step(stmt) == SQLITE_DONE) {
+            index_set_permissions(msg->filename, target_user, ACCESS_NONE);
+            
             resp.error_code = ERR_SUCCESS;
             snprintf(resp.data, sizeof(resp.data), "Access revoked from %s", target_user);
             
@@ -141,178 +129,168 @@ void handle_remaccess(int sock, Message* msg) {
         } else {
             set_message_error(&resp, ERR_SERVER_ERROR, "Failed to revoke access");
         }
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     } else {
         set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
     }
+    group_commit_end(&server_state.commits);
     
+    unlock_file(msg->filename);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (resp.error_code == ERR_SUCCESS && group_commit_wait(&server_state.commits) < 0) {
+        lock_file(msg->filename);
+        index_reload_permissions(msg->filename);
+        unlock_file(msg->filename);
+        init_response(&resp, msg);
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to persist access change");
+    }
     send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
 void handle_undo(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
-    if (!trie_search(server_state.file_trie, msg->filename)) {
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    
+    FileMetadata file;
+    if (!index_get_file(msg->filename, &file)) {
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    if (!check_permission(msg->username, msg->filename, ACCESS_WRITE)) {
+    if (!check_permission(msg->username, &file, ACCESS_WRITE)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "No write permission");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    // Get SS info
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT storage_server_id, replica_server_id FROM files WHERE filename = ?;";
+    StorageServerInfo* ss = get_ss_by_id(file.storage_server_id);
+    StorageServerInfo* replica = file.replica_server_id >= 0 ? get_ss_by_id(file.replica_server_id) : NULL;
     
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-        
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            int ss_id = sqlite3_column_int(stmt, 0);
-            int replica_id = sqlite3_column_int(stmt, 1);
-            
-            StorageServerInfo* ss = get_ss_by_id(ss_id);
-            StorageServerInfo* replica = replica_id >= 0 ? get_ss_by_id(replica_id) : NULL;
-            
-            if (ss) {
-                resp.error_code = ERR_SUCCESS;
-                snprintf(resp.data, sizeof(resp.data), "SS:%s:%d", ss->ip, ss->port);
-                if (replica) {
-                    char replica_info[128];
-                    snprintf(replica_info, sizeof(replica_info), "|REPLICA:%s:%d", replica->ip, replica->port);
-                    strncat(resp.data, replica_info, sizeof(resp.data) - strlen(resp.data) - 1);
-                }
-                
-                char log_buf[256];
-                snprintf(log_buf, sizeof(log_buf), "Undo requested: %s by %s", msg->filename, msg->username);
-                log_message("NameServer", log_buf);
-            } else {
-                set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
-            }
-        } else {
-            set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+    if (ss) {
+        resp.error_code = ERR_SUCCESS;
+        snprintf(resp.data, sizeof(resp.data), "SS:%s:%d", ss->ip, ss->port);
+        if (replica) {
+            char replica_info[128];
+            snprintf(replica_info, sizeof(replica_info), "|REPLICA:%s:%d", replica->ip, replica->port);
+            strncat(resp.data, replica_info, sizeof(resp.data) - strlen(resp.data) - 1);
         }
-        sqlite3_finalize(stmt);
+        append_storage_key(resp.data, sizeof(resp.data), &file);
+        
+        char log_buf[256];
+        snprintf(log_buf, sizeof(log_buf), "Undo requested: %s by %s", msg->filename, msg->username);
+        log_message("NameServer", log_buf);
     } else {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+        set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
     }
     
+    pthread_rwlock_unlock(&server_state.ns_lock);
     send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
 void handle_exec(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
+    
+    pthread_rwlock_rdlock(&server_state.ns_lock);
     
-    if (!trie_search(server_state.file_trie, msg->filename)) {
+    FileMetadata file;
+    if (!index_get_file(msg->filename, &file)) {
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    if (!check_permission(msg->username, msg->filename, ACCESS_READ)) {
+    if (!check_permission(msg->username, &file, ACCESS_READ)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "No read permission");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
     // First get SS info to read file content
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT storage_server_id FROM files WHERE filename = ?;";
+    StorageServerInfo* ss = get_ss_for_read(&file);
     
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
+    if (ss) {
+        // Return SS info so client can fetch content and execute
+        resp.error_code = ERR_SUCCESS;
+        snprintf(resp.data, sizeof(resp.data), "SS:%s:%d", ss->ip, ss->port);
+        append_storage_key(resp.data, sizeof(resp.data), &file);
         
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            int ss_id = sqlite3_column_int(stmt, 0);
-            StorageServerInfo* ss = get_ss_by_id(ss_id);
-            
-            if (ss) {
-                // Return SS info so client can fetch content and execute
-                resp.error_code = ERR_SUCCESS;
-                snprintf(resp.data, sizeof(resp.data), "SS:%s:%d", ss->ip, ss->port);
-                
-                char log_buf[256];
-                snprintf(log_buf, sizeof(log_buf), "Exec requested: %s by %s", msg->filename, msg->username);
-                log_message("NameServer", log_buf);
-            } else {
-                set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
-            }
-        } else {
-            set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
-        }
-        sqlite3_finalize(stmt);
+        char log_buf[256];
+        snprintf(log_buf, sizeof(log_buf), "Exec requested: %s by %s", msg->filename, msg->username);
+        log_message("NameServer", log_buf);
     } else {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+        set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
     }
     
+    pthread_rwlock_unlock(&server_state.ns_lock);
     send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
 void handle_createfolder(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
+    
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    lock_file(msg->filename);
     
-    if (trie_search(server_state.file_trie, msg->filename)) {
+    if (file_exists(msg->filename)) {
         set_message_error(&resp, ERR_FILE_EXISTS, "Folder already exists");
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    if (server_state.ss_count == 0) {
-        set_message_error(&resp, ERR_SS_NOT_FOUND, "No storage servers available");
+    if (check_parent_folder(msg->filename, &resp) < 0) {
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    // Select SS with least files
-    int ss_idx = 0;
-    for (int i = 1; i < server_state.ss_count; i++) {
-        if (server_state.storage_servers[i].file_count < server_state.storage_servers[ss_idx].file_count &&
-            server_state.storage_servers[i].is_alive) {
-            ss_idx = i;
-        }
+    int ss_idx = choose_storage_servers(NULL);
+    if (ss_idx < 0) {
+        set_message_error(&resp, ERR_SS_NOT_FOUND, "No storage servers available");
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
+        send_message(sock, &resp);
+        return;
     }
     
     StorageServerInfo* ss = &server_state.storage_servers[ss_idx];
     
     // Insert into database as folder
-    sqlite3_stmt* stmt;
-    const char* sql = "INSERT INTO files (filename, owner, storage_server_id, created_at, modified_at, accessed_at, is_folder) "
-                     "VALUES (?, ?, ?, ?, ?, ?, 1);";
-    
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        time_t now = time(NULL);
-        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, msg->username, -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 3, ss->id);
-        sqlite3_bind_int64(stmt, 4, now);
-        sqlite3_bind_int64(stmt, 5, now);
-        sqlite3_bind_int64(stmt, 6, now);
+    group_commit_begin(&server_state.commits);
+    CachedStmt* cs = &nm_statements[NM_STMT_INSERT_FOLDER];
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    
+    if (stmt) {
+        FileMetadata meta;
+        memset(&meta, 0, sizeof(meta));
+        strncpy(meta.filename, msg->filename, MAX_FILENAME - 1);
+        strncpy(meta.owner, msg->username, MAX_USERNAME - 1);
+        meta.storage_server_id = ss->id;
+        meta.replica_server_id = -1;
+        meta.created_at = meta.modified_at = meta.accessed_at = time(NULL);
+        meta.is_folder = 1;
+        
+        sqlite3_bind_text(stmt, 1, meta.filename, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, meta.owner, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 3, meta.storage_server_id);
+        sqlite3_bind_int64(stmt, 4, meta.created_at);
+        sqlite3_bind_int64(stmt, 5, meta.modified_at);
+        sqlite3_bind_int64(stmt, 6, meta.accessed_at);
         
         if (sqlite3_step(stmt) == SQLITE_DONE) {
-            trie_insert(server_state.file_trie, msg->filename);
-            ss->file_count++;
+            index_add_file(&meta, ss);
             
             resp.error_code = ERR_SUCCESS;
             snprintf(resp.data, sizeof(resp.data), "Folder created: %s", msg->filename);
@@ -323,86 +301,79 @@ void handle_createfolder(int sock, Message* msg) {
         } else {
             set_message_error(&resp, ERR_SERVER_ERROR, "Failed to create folder");
         }
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     } else {
         set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
     }
+    group_commit_end(&server_state.commits);
     
+    unlock_file(msg->filename);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (resp.error_code == ERR_SUCCESS && group_commit_wait(&server_state.commits) < 0) {
+        index_undo_add(msg->filename);
+        init_response(&resp, msg);
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to persist folder metadata");
+    }
     send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
 void handle_checkpoint(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
+    
+    pthread_rwlock_rdlock(&server_state.ns_lock);
     
     // Parse command: CREATE|tag or LIST or REVERT|tag
     char cmd[32], tag[64];
     if (sscanf(msg->data, "%[^|]|%s", cmd, tag) < 1) {
         set_message_error(&resp, ERR_INVALID_PARAM, "Invalid checkpoint command");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    if (!trie_search(server_state.file_trie, msg->filename)) {
+    FileMetadata file;
+    if (!index_get_file(msg->filename, &file)) {
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    if (!check_permission(msg->username, msg->filename, ACCESS_READ)) {
+    if (!check_permission(msg->username, &file, ACCESS_READ)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "No read permission");
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
-    // Get SS info
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT storage_server_id, replica_server_id FROM files WHERE filename = ?;";
+    StorageServerInfo* ss = get_ss_by_id(file.storage_server_id);
+    StorageServerInfo* replica = file.replica_server_id >= 0 ? get_ss_by_id(file.replica_server_id) : NULL;
     
-    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
-        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-        
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            int ss_id = sqlite3_column_int(stmt, 0);
-            int replica_id = sqlite3_column_int(stmt, 1);
-            
-            StorageServerInfo* ss = get_ss_by_id(ss_id);
-            StorageServerInfo* replica = replica_id >= 0 ? get_ss_by_id(replica_id) : NULL;
-            
-            if (ss) {
-                resp.error_code = ERR_SUCCESS;
-                snprintf(resp.data, sizeof(resp.data), "SS:%s:%d|CMD:%s", ss->ip, ss->port, msg->data);
-                if (replica) {
-                    char replica_info[128];
-                    snprintf(replica_info, sizeof(replica_info), "|REPLICA:%s:%d", replica->ip, replica->port);
-                    strncat(resp.data, replica_info, sizeof(resp.data) - strlen(resp.data) - 1);
-                }
-            } else {
-                set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
-            }
-        } else {
-            set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+    if (ss) {
+        resp.error_code = ERR_SUCCESS;
+        snprintf(resp.data, sizeof(resp.data), "SS:%s:%d|CMD:%s", ss->ip, ss->port, msg->data);
+        if (replica) {
+            char replica_info[128];
+            snprintf(replica_info, sizeof(replica_info), "|REPLICA:%s:%d", replica->ip, replica->port);
+            strncat(resp.data, replica_info, sizeof(resp.data) - strlen(resp.data) - 1);
         }
-        sqlite3_finalize(stmt);
+        append_storage_key(resp.data, sizeof(resp.data), &file);
     } else {
-        set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
+        set_message_error(&resp, ERR_SS_NOT_FOUND, "Storage server not available");
     }
     
+    pthread_rwlock_unlock(&server_state.ns_lock);
     send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
 }
 
 void handle_request_access(int sock, Message* msg) {
-    pthread_mutex_lock(&server_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
+    
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    lock_file(msg->filename);
     
     // Parse: REQUEST|access_type or VIEWREQUESTS or APPROVE|requester or REJECT|requester
     char cmd[32], param[MAX_USERNAME];
@@ -410,8 +381,9 @@ void handle_request_access(int sock, Message* msg) {
     
     if (sscanf(msg->data, "%[^|]|%s", cmd, param) < 1) {
         set_message_error(&resp, ERR_INVALID_PARAM, "Invalid request format");
+        unlock_file(msg->filename);
+        pthread_rwlock_unlock(&server_state.ns_lock);
         send_message(sock, &resp);
-        pthread_mutex_unlock(&server_state.mutex);
         return;
     }
     
@@ -420,18 +392,20 @@ void handle_request_access(int sock, Message* msg) {
             access_type = atoi(param);
         }
         
-        if (!trie_search(server_state.file_trie, msg->filename)) {
+        if (!file_exists(msg->filename)) {
             set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
+            unlock_file(msg->filename);
+            pthread_rwlock_unlock(&server_state.ns_lock);
             send_message(sock, &resp);
-            pthread_mutex_unlock(&server_state.mutex);
             return;
         }
         
         // Insert access request
-        sqlite3_stmt* stmt;
-        const char* sql = "INSERT INTO access_requests (filename, requester, access_type, requested_at) VALUES (?, ?, ?, ?);";
+        group_commit_begin(&server_state.commits);
+        CachedStmt* cs = &nm_statements[NM_STMT_INSERT_ACCESS_REQUEST];
+        sqlite3_stmt* stmt = stmt_acquire(cs);
         
-        if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (stmt) {
             sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
             sqlite3_bind_text(stmt, 2, msg->username, -1, SQLITE_STATIC);
             sqlite3_bind_int(stmt, 3, access_type);
@@ -443,17 +417,16 @@ void handle_request_access(int sock, Message* msg) {
             } else {
                 set_message_error(&resp, ERR_SERVER_ERROR, "Failed to submit request");
             }
-            sqlite3_finalize(stmt);
+            stmt_release(cs);
         }
+        group_commit_end(&server_state.commits);
     }
     else if (strcmp(cmd, "VIEWREQUESTS") == 0) {
         // Show pending requests for files owned by this user
-        sqlite3_stmt* stmt;
-        const char* sql = "SELECT ar.filename, ar.requester, ar.access_type, ar.requested_at "
-                         "FROM access_requests ar JOIN files f ON ar.filename = f.filename "
-                         "WHERE f.owner = ? AND ar.status = 'pending';";
+        CachedStmt* cs = &nm_statements[NM_STMT_PENDING_REQUESTS];
+        sqlite3_stmt* stmt = stmt_acquire(cs);
         
-        if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (stmt) {
             sqlite3_bind_text(stmt, 1, msg->username, -1, SQLITE_STATIC);
             
             char result[BUFFER_SIZE] = "Pending Access Requests:\n";
@@ -472,10 +445,319 @@ void handle_request_access(int sock, Message* msg) {
             
             resp.error_code = ERR_SUCCESS;
             strncpy(resp.data, result, sizeof(resp.data) - 1);
-            sqlite3_finalize(stmt);
+            stmt_release(cs);
+        }
+    }
+    
+    unlock_file(msg->filename);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (strcmp(cmd, "REQUEST") == 0 && resp.error_code == ERR_SUCCESS &&
+        group_commit_wait(&server_state.commits) < 0) {
+        init_response(&resp, msg);
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to persist request");
+    }
+    send_message(sock, &resp);
+}
+
+void handle_multi(int sock, Message* msg) {
+    Message resp;
+    init_response(&resp, msg);
+    
+    int op_count = 0;
+    for (const char* p = msg->data; *p; p++) {
+        if (*p == '\n' || p[1] == '\0') op_count++;
+    }
+    
+    if (op_count == 0 || op_count > MULTI_MAX_OPS) {
+        char err_buf[64];
+        snprintf(err_buf, sizeof(err_buf), "MULTI takes 1 to %d operations", MULTI_MAX_OPS);
+        set_message_error(&resp, ERR_INVALID_PARAM, err_buf);
+        send_message(sock, &resp);
+        return;
+    }
+    
+    // Sub-requests reuse full Message buffers; keep them off the stack
+    Message* sub = malloc(sizeof(Message));
+    Message* sub_resp = malloc(sizeof(Message));
+    char (*created)[MAX_FILENAME] = malloc(sizeof(*created) * op_count);
+    char (*granted)[MAX_FILENAME] = malloc(sizeof(*granted) * op_count);
+    if (!sub || !sub_resp || !created || !granted) {
+        free(sub);
+        free(sub_resp);
+        free(created);
+        free(granted);
+        set_message_error(&resp, ERR_SERVER_ERROR, "Out of memory");
+        send_message(sock, &resp);
+        return;
+    }
+    
+    // Exclusive so no other request interleaves with the batch; holding the
+    // group commit across it keeps every operation in the same transaction
+    pthread_rwlock_wrlock(&server_state.ns_lock);
+    group_commit_begin(&server_state.commits);
+    
+    const char* line = msg->data;
+    size_t out_len = 0;
+    int created_count = 0, granted_count = 0, ok_count = 0;
+    
+    for (int i = 0; i < op_count; i++) {
+        const char* end = strchr(line, '\n');
+        size_t len = end ? (size_t)(end - line) : strlen(line);
+        
+        init_message(sub);
+        init_response(sub_resp, sub);
+        strcpy(sub->username, msg->username);
+        
+        // Parse: TYPE|filename|data
+        char item[MAX_FILENAME + MAX_SENTENCE];
+        char* bar1 = NULL;
+        if (len < sizeof(item)) {
+            memcpy(item, line, len);
+            item[len] = '\0';
+            bar1 = strchr(item, '|');
+        }
+        
+        if (!bar1 || bar1 - item >= (long)sizeof(sub->type)) {
+            set_message_error(sub_resp, ERR_INVALID_PARAM, "Malformed operation");
+        } else {
+            *bar1 = '\0';
+            char* bar2 = strchr(bar1 + 1, '|');
+            if (bar2) {
+                *bar2 = '\0';
+                strcpy(sub->data, bar2 + 1);
+            }
+            strcpy(sub->type, item);
+            strncpy(sub->filename, bar1 + 1, MAX_FILENAME - 1);
+            sub->filename[MAX_FILENAME - 1] = '\0';
+            
+            if (strcmp(sub->type, MSG_CREATE) == 0) {
+                process_create(sub, sub_resp);
+                if (sub_resp->error_code == ERR_SUCCESS) {
+                    strcpy(created[created_count++], sub->filename);
+                }
+            } else if (strcmp(sub->type, MSG_ADDACCESS) == 0) {
+                process_addaccess(sub, sub_resp);
+                if (sub_resp->error_code == ERR_SUCCESS) {
+                    strcpy(granted[granted_count++], sub->filename);
+                }
+            } else if (strcmp(sub->type, MSG_READ) == 0) {
+                process_read(sub, sub_resp);
+            } else {
+                set_message_error(sub_resp, ERR_INVALID_PARAM, "Operation not supported in MULTI");
+            }
+        }
+        
+        if (sub_resp->error_code == ERR_SUCCESS) ok_count++;
+        
+        // Result lines are short (<300 bytes), so MULTI_MAX_OPS of them always fit
+        int n = snprintf(resp.data + out_len, sizeof(resp.data) - out_len, "%d|%d|%s\n",
+                        i, sub_resp->error_code,
+                        sub_resp->error_code == ERR_SUCCESS ? sub_resp->data : sub_resp->error_msg);
+        if (n > 0 && out_len + n < sizeof(resp.data)) {
+            out_len += n;
+        }
+        
+        line = end ? end + 1 : line + len;
+    }
+    
+    group_commit_end(&server_state.commits);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (group_commit_wait(&server_state.commits) == 0) {
+        resp.error_code = ERR_SUCCESS;
+    } else {
+        // Undo the in-memory half of the rolled back creates
+        for (int i = 0; i < created_count; i++) {
+            index_undo_add(created[i]);
+        }
+        for (int i = 0; i < granted_count; i++) {
+            index_reload_permissions(granted[i]);
+        }
+        
+        init_response(&resp, msg);
+        set_message_error(&resp, ERR_SERVER_ERROR, "Batch commit failed, no changes applied");
+        ok_count = 0;
+    }
+    
+    char log_buf[256];
+    snprintf(log_buf, sizeof(log_buf), "MULTI by %s: %d/%d operations succeeded",
+            msg->username, ok_count, op_count);
+    log_message("NameServer", log_buf);
+    
+    send_message(sock, &resp);
+    
+    free(sub);
+    free(sub_resp);
+    free(created);
+    free(granted);
+}
+
+static int run_move_statement(NMStatement id, const char* from, const char* to) {
+    CachedStmt* cs = &nm_statements[id];
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    if (!stmt) {
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, from, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, to, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    stmt_release(cs);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// MOVE: filename is the file or folder to move, data the destination. An
+// existing folder (or "/" for the top level) receives it under its current
+// base name; anything else is the new full name. Only metadata changes: the
+// storage servers keep every file under its storage path.
+void handle_move(int sock, Message* msg) {
+    Message resp;
+    init_response(&resp, msg);
+    
+    const char* from = msg->filename;
+    const char* slash = strrchr(from, '/');
+    const char* base = slash ? slash + 1 : from;
+    char to[MAX_FILENAME];
+    
+    if (!from[0] || !msg->data[0]) {
+        set_message_error(&resp, ERR_INVALID_PARAM, "Usage: MOVE <path> <folder|new_path|/>");
+        send_message(sock, &resp);
+        return;
+    }
+    
+    // Exclusive: every name under the subtree changes at once
+    pthread_rwlock_wrlock(&server_state.ns_lock);
+    
+    int written;
+    if (strcmp(msg->data, "/") == 0) {
+        written = snprintf(to, sizeof(to), "%s", base);
+    } else if (index_lookup_folder(msg->data, NULL) == 1) {
+        written = snprintf(to, sizeof(to), "%s/%s", msg->data, base);
+    } else {
+        written = snprintf(to, sizeof(to), "%s", msg->data);
+    }
+    
+    int error = written >= (int)sizeof(to) ? ERR_INVALID_PARAM : index_check_move(from, to, msg->username);
+    if (error == ERR_SUCCESS && lock_subtree_held(from)) {
+        error = ERR_LOCKED;
+    }
+    
+    if (error != ERR_SUCCESS) {
+        pthread_rwlock_unlock(&server_state.ns_lock);
+        const char* text = error == ERR_FILE_NOT_FOUND ? "File not found" :
+                           error == ERR_NOT_OWNER ? "Only the owner can move a file" :
+                           error == ERR_FILE_EXISTS ? "Destination already exists" :
+                           error == ERR_FOLDER_NOT_FOUND ? "Destination folder does not exist" :
+                           error == ERR_LOCKED ? "A file being moved is locked for writing" :
+                           "Invalid destination";
+        set_message_error(&resp, error, text);
+        send_message(sock, &resp);
+        return;
+    }
+    
+    // The three renames commit or roll back together inside the batch
+    group_commit_begin(&server_state.commits);
+    int ok = sqlite3_exec(server_state.db, "SAVEPOINT move;", 0, 0, NULL) == SQLITE_OK;
+    if (ok) {
+        ok = run_move_statement(NM_STMT_MOVE_FILES, from, to) == 0 &&
+             run_move_statement(NM_STMT_MOVE_ACL, from, to) == 0 &&
+             run_move_statement(NM_STMT_MOVE_REQUESTS, from, to) == 0;
+        if (!ok) {
+            sqlite3_exec(server_state.db, "ROLLBACK TO move;", 0, 0, NULL);
+        }
+        sqlite3_exec(server_state.db, "RELEASE move;", 0, 0, NULL);
+    }
+    if (ok) {
+        index_move(from, to);
+    }
+    group_commit_end(&server_state.commits);
+    
+    // Wait with ns_lock still held: once it is released a CREATE or MOVE
+    // could claim the old name, and the revert would clobber it. MOVEs are
+    // rare, so stalling the namespace for one batch interval is cheap.
+    int persisted = ok && group_commit_wait(&server_state.commits) == 0;
+    if (ok && !persisted) {
+        index_move(to, from);
+    }
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (!ok) {
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to update metadata");
+    } else if (!persisted) {
+        set_message_error(&resp, ERR_SERVER_ERROR, "Failed to persist move");
+    } else {
+        resp.error_code = ERR_SUCCESS;
+        snprintf(resp.data, sizeof(resp.data), "Moved %s to %s", from, to);
+        
+        char log_buf[600];
+        snprintf(log_buf, sizeof(log_buf), "Moved %s to %s by %s", from, to, msg->username);
+        log_message("NameServer", log_buf);
+    }
+    send_message(sock, &resp);
+}
+
+// VIEWFOLDER: data is the folder (empty for the top level), optionally
+// after "-n page_size "; filename is the resume key. The reply lists one
+// page of the children the user can read, one per line in sorted order,
+// folders marked with a trailing '/', and its filename is the key to resume
+// from, empty on the last page
+void handle_viewfolder(int sock, Message* msg) {
+    Message resp;
+    init_response(&resp, msg);
+    
+    int page_size = VIEWFOLDER_DEFAULT_PAGE_SIZE;
+    const char* folder = msg->data;
+    if (strncmp(folder, "-n ", 3) == 0) {
+        char* end;
+        long n = strtol(folder + 3, &end, 10);
+        if (end == folder + 3 || (*end != ' ' && *end != '\0') || n < 1 || n > VIEWFOLDER_MAX_PAGE_SIZE) {
+            set_message_error(&resp, ERR_INVALID_PARAM, "Usage: VIEWFOLDER [folder] [-n page_size] [-c resume_key]");
+            send_message(sock, &resp);
+            return;
         }
+        page_size = (int)n;
+        folder = *end ? end + 1 : end;
+    }
+    
+    // One extra name says whether another page follows
+    char** names = malloc((page_size + 1) * sizeof(char*));
+    if (!names) {
+        set_message_error(&resp, ERR_SERVER_ERROR, "Out of memory");
+        send_message(sock, &resp);
+        return;
+    }
+    pthread_rwlock_rdlock(&server_state.ns_lock);
+    int count = index_list_folder(folder, msg->username, msg->filename, names, page_size + 1);
+    pthread_rwlock_unlock(&server_state.ns_lock);
+    
+    if (count < 0) {
+        free(names);
+        set_message_error(&resp, ERR_FOLDER_NOT_FOUND, "Folder not found");
+        send_message(sock, &resp);
+        return;
+    }
+    
+    size_t len = 0;
+    int sent = 0;
+    while (sent < count && sent < page_size) {
+        size_t name_len = strlen(names[sent]);
+        // A full frame ends the page early
+        if (len + name_len + 1 >= sizeof(resp.data)) break;
+        memcpy(resp.data + len, names[sent], name_len);
+        len += name_len;
+        resp.data[len++] = '\n';
+        sent++;
+    }
+    resp.data[len] = '\0';
+    
+    if (sent < count) {
+        strcpy(resp.filename, names[sent - 1]);
+    }
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
     }
+    free(names);
     
+    resp.error_code = ERR_SUCCESS;
     send_message(sock, &resp);
-    pthread_mutex_unlock(&server_state.mutex);
 }
@@ -0,0 +1,171 @@
+#include "../../include/nameserver.h"
+
+// Storage server failure detector. Every storage server sends a HEARTBEAT
+// each SS_HEARTBEAT_INTERVAL_SECONDS; once a server has been silent for
+// ss_timeout_seconds the detector marks it down, and get_ss_by_id stops
+// returning it, so reads go straight to the replica instead of making the
+// client wait out a connect to a dead address. A server whose heartbeats
+// resume (or that registers again) is marked up.
+//
+// Heartbeats arrive under a shared ns_lock, so checking for a change only
+// needs that too; the exclusive ns_lock that is_alive requires is taken
+// only when a server actually goes down or comes back.
+//
+// Heartbeats also carry each server's load (bytes stored and free, request
+// rate, mean latency), which choose_storage_servers weighs with its file
+// count to place new files on the least busy, least full servers.
+
+// Caller holds ns_lock (exclusively if apply) and ss_health_mutex.
+// Returns how many servers' is_alive disagrees with their heartbeats.
+static int check_servers(time_t now, int apply) {
+    int changes = 0;
+    for (int i = 0; i < server_state.ss_count; i++) {
+        StorageServerInfo* ss = &server_state.storage_servers[i];
+        // Servers restored from the snapshot stay down until they register
+        int alive = ss->last_heartbeat > 0 &&
+                    now - ss->last_heartbeat <= server_state.ss_timeout_seconds;
+        if (alive == ss->is_alive) {
+            continue;
+        }
+        changes++;
+        if (!apply) {
+            continue;
+        }
+
+        ss->is_alive = alive;
+        char log_buf[256];
+        if (alive) {
+            snprintf(log_buf, sizeof(log_buf), "Storage Server %d (%s:%d) is back up",
+                    ss->id, ss->ip, ss->port);
+        } else {
+            snprintf(log_buf, sizeof(log_buf), "Storage Server %d (%s:%d) marked down: no heartbeat for %ld s",
+                    ss->id, ss->ip, ss->port, (long)(now - ss->last_heartbeat));
+        }
+        log_message("NameServer", log_buf);
+    }
+    return changes;
+}
+
+static void* detector_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&server_state.ss_health_mutex);
+    while (!server_state.detector_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += NM_SS_CHECK_INTERVAL_SECONDS;
+        pthread_cond_timedwait(&server_state.detector_cond, &server_state.ss_health_mutex, &deadline);
+        if (server_state.detector_stop) {
+            break;
+        }
+        pthread_mutex_unlock(&server_state.ss_health_mutex);
+
+        time_t now = time(NULL);
+        pthread_rwlock_rdlock(&server_state.ns_lock);
+        pthread_mutex_lock(&server_state.ss_health_mutex);
+        int changes = check_servers(now, 0);
+        pthread_mutex_unlock(&server_state.ss_health_mutex);
+        pthread_rwlock_unlock(&server_state.ns_lock);
+
+        if (changes > 0) {
+            pthread_rwlock_wrlock(&server_state.ns_lock);
+            pthread_mutex_lock(&server_state.ss_health_mutex);
+            check_servers(now, 1);
+            pthread_mutex_unlock(&server_state.ss_health_mutex);
+            pthread_rwlock_unlock(&server_state.ns_lock);
+        }
+
+        pthread_mutex_lock(&server_state.ss_health_mutex);
+    }
+    pthread_mutex_unlock(&server_state.ss_health_mutex);
+    return NULL;
+}
+
+int failure_detector_start() {
+    server_state.detector_stop = 0;
+    if (pthread_create(&server_state.detector_thread, NULL, detector_main, NULL) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void failure_detector_stop() {
+    pthread_mutex_lock(&server_state.ss_health_mutex);
+    server_state.detector_stop = 1;
+    pthread_cond_signal(&server_state.detector_cond);
+    pthread_mutex_unlock(&server_state.ss_health_mutex);
+    pthread_join(server_state.detector_thread, NULL);
+}
+
+// Lower is better. Each term is the server's share of the busiest live
+// server's figure, so the weights hold whatever the units.
+typedef struct {
+    double files;
+    double rate;
+    double latency;
+} PlacementMax;
+
+// Caller holds ss_health_mutex
+static double placement_score(const StorageServerInfo* ss, int file_count, const PlacementMax* max) {
+    double score = 0;
+    if (max->files > 0) {
+        score += NM_PLACE_WEIGHT_FILES * file_count / max->files;
+    }
+    if (ss->bytes_used + ss->bytes_free > 0) {
+        score += NM_PLACE_WEIGHT_DISK * (double)ss->bytes_used / (ss->bytes_used + ss->bytes_free);
+    }
+    if (max->rate > 0) {
+        score += NM_PLACE_WEIGHT_LOAD * ss->request_rate / max->rate;
+    }
+    if (max->latency > 0) {
+        score += NM_PLACE_WEIGHT_LATENCY * ss->latency_us / max->latency;
+    }
+    return score;
+}
+
+int choose_storage_servers(int* replica_idx) {
+    // File counts live under index_lock, load under ss_health_mutex; never both
+    int file_counts[MAX_STORAGE_SERVERS];
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    for (int i = 0; i < server_state.ss_count; i++) {
+        file_counts[i] = server_state.storage_servers[i].file_count;
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+
+    double scores[MAX_STORAGE_SERVERS];
+    int low_space[MAX_STORAGE_SERVERS];
+    pthread_mutex_lock(&server_state.ss_health_mutex);
+    PlacementMax max = { 0, 0, 0 };
+    for (int i = 0; i < server_state.ss_count; i++) {
+        const StorageServerInfo* ss = &server_state.storage_servers[i];
+        if (!ss->is_alive) continue;
+        if (file_counts[i] > max.files) max.files = file_counts[i];
+        if (ss->request_rate > max.rate) max.rate = ss->request_rate;
+        if (ss->latency_us > max.latency) max.latency = ss->latency_us;
+    }
+    for (int i = 0; i < server_state.ss_count; i++) {
+        const StorageServerInfo* ss = &server_state.storage_servers[i];
+        scores[i] = placement_score(ss, file_counts[i], &max);
+        // Zero free means no load report yet, not a full disk
+        low_space[i] = ss->bytes_free > 0 && ss->bytes_free < NM_PLACE_MIN_FREE_BYTES;
+    }
+    pthread_mutex_unlock(&server_state.ss_health_mutex);
+
+    // Best and second best live server, preferring ones with room to spare
+    int best = -1, second = -1;
+    for (int i = 0; i < server_state.ss_count; i++) {
+        if (!server_state.storage_servers[i].is_alive) continue;
+        if (best < 0 || low_space[i] < low_space[best] ||
+            (low_space[i] == low_space[best] && scores[i] < scores[best])) {
+            second = best;
+            best = i;
+        } else if (second < 0 || low_space[i] < low_space[second] ||
+                   (low_space[i] == low_space[second] && scores[i] < scores[second])) {
+            second = i;
+        }
+    }
+
+    if (replica_idx) {
+        *replica_idx = second;
+    }
+    return best;
+}
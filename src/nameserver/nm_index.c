@@ -0,0 +1,821 @@
+#include "../../include/nameserver.h"
+
+// In-memory view of the files and access_control tables. Every row is
+// loaded at startup and kept in step with the database by the handlers that
+// change it, so resolving a file or checking a permission never has to run a
+// query. Guarded by index_lock.
+
+unsigned long filename_hash(const char* filename) {
+    // djb2
+    unsigned long hash = 5381;
+    for (const char* p = filename; *p; p++) {
+        hash = hash * 33 + (unsigned char)*p;
+    }
+    return hash;
+}
+
+// Caller holds index_lock
+static FileEntry* find_entry(const char* filename) {
+    if (!server_state.file_buckets) {
+        return NULL;
+    }
+    FileEntry* entry = server_state.file_table[filename_hash(filename) % server_state.file_buckets];
+    while (entry && strcmp(entry->meta.filename, filename) != 0) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+// Caller holds index_lock exclusively
+static void grow_file_table() {
+    size_t buckets = server_state.file_buckets ? server_state.file_buckets * 2 : NM_FILE_TABLE_INITIAL;
+    FileEntry** table = calloc(buckets, sizeof(FileEntry*));
+    if (!table) {
+        return; // Keep the old table; chains just get longer
+    }
+
+    for (size_t i = 0; i < server_state.file_buckets; i++) {
+        FileEntry* entry = server_state.file_table[i];
+        while (entry) {
+            FileEntry* next = entry->next;
+            size_t b = filename_hash(entry->meta.filename) % buckets;
+            entry->next = table[b];
+            table[b] = entry;
+            entry = next;
+        }
+    }
+
+    free(server_state.file_table);
+    server_state.file_table = table;
+    server_state.file_buckets = buckets;
+}
+
+static unsigned long acl_hash(const char* filename, const char* username) {
+    return filename_hash(filename) * 31 + filename_hash(username);
+}
+
+// Caller holds index_lock
+static AclEntry* find_acl(const char* filename, const char* username) {
+    if (!server_state.acl_buckets) {
+        return NULL;
+    }
+    AclEntry* acl = server_state.acl_table[acl_hash(filename, username) % server_state.acl_buckets];
+    while (acl && (strcmp(acl->access.username, username) != 0 ||
+                   strcmp(acl->file->meta.filename, filename) != 0)) {
+        acl = acl->next;
+    }
+    return acl;
+}
+
+// Caller holds index_lock exclusively
+static void grow_acl_table() {
+    size_t buckets = server_state.acl_buckets ? server_state.acl_buckets * 2 : NM_ACL_TABLE_INITIAL;
+    AclEntry** table = calloc(buckets, sizeof(AclEntry*));
+    if (!table) {
+        return;
+    }
+
+    for (size_t i = 0; i < server_state.acl_buckets; i++) {
+        AclEntry* acl = server_state.acl_table[i];
+        while (acl) {
+            AclEntry* next = acl->next;
+            size_t b = acl_hash(acl->file->meta.filename, acl->access.username) % buckets;
+            acl->next = table[b];
+            table[b] = acl;
+            acl = next;
+        }
+    }
+
+    free(server_state.acl_table);
+    server_state.acl_table = table;
+    server_state.acl_buckets = buckets;
+}
+
+// Caller holds index_lock exclusively
+static void unhash_acl(AclEntry* acl) {
+    AclEntry** link = &server_state.acl_table[acl_hash(acl->file->meta.filename, acl->access.username) %
+                                               server_state.acl_buckets];
+    while (*link != acl) {
+        link = &(*link)->next;
+    }
+    *link = acl->next;
+}
+
+// Caller holds index_lock exclusively
+static void hash_acl(AclEntry* acl) {
+    size_t b = acl_hash(acl->file->meta.filename, acl->access.username) % server_state.acl_buckets;
+    acl->next = server_state.acl_table[b];
+    server_state.acl_table[b] = acl;
+}
+
+// Unlink from the hash chain and free; caller holds index_lock exclusively
+// and has already taken the entry off its file's list
+static void drop_acl(AclEntry* acl) {
+    unhash_acl(acl);
+    free(acl);
+    server_state.acl_total--;
+}
+
+// Caller holds index_lock exclusively
+static void drop_file_acl(FileEntry* file) {
+    AclEntry* acl = file->acl;
+    while (acl) {
+        AclEntry* next = acl->next_in_file;
+        drop_acl(acl);
+        acl = next;
+    }
+    file->acl = NULL;
+}
+
+// Caller holds index_lock exclusively
+static void hash_entry(FileEntry* entry) {
+    size_t b = filename_hash(entry->meta.filename) % server_state.file_buckets;
+    entry->next = server_state.file_table[b];
+    server_state.file_table[b] = entry;
+}
+
+// Caller holds index_lock exclusively
+static void unhash_entry(FileEntry* entry) {
+    FileEntry** link = &server_state.file_table[filename_hash(entry->meta.filename) % server_state.file_buckets];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+}
+
+// Folder named by filename up to its last '/', or NULL for the top level
+// (also when that folder is missing). Caller holds index_lock.
+static FileEntry* find_parent(const char* filename) {
+    const char* slash = strrchr(filename, '/');
+    if (!slash) {
+        return NULL;
+    }
+    char parent[MAX_FILENAME];
+    size_t len = slash - filename;
+    memcpy(parent, filename, len);
+    parent[len] = '\0';
+    FileEntry* entry = find_entry(parent);
+    return entry && entry->meta.is_folder ? entry : NULL;
+}
+
+// Caller holds index_lock exclusively
+static void link_child(FileEntry* entry, FileEntry* parent) {
+    FileEntry** head = parent ? &parent->children : &server_state.top_level;
+    entry->parent = parent;
+    entry->prev_sibling = NULL;
+    entry->next_sibling = *head;
+    if (*head) (*head)->prev_sibling = entry;
+    *head = entry;
+}
+
+// Caller holds index_lock exclusively
+static void unlink_child(FileEntry* entry) {
+    if (entry->prev_sibling) {
+        entry->prev_sibling->next_sibling = entry->next_sibling;
+    } else {
+        *(entry->parent ? &entry->parent->children : &server_state.top_level) = entry->next_sibling;
+    }
+    if (entry->next_sibling) {
+        entry->next_sibling->prev_sibling = entry->prev_sibling;
+    }
+}
+
+int file_exists(const char* filename) {
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    int found = find_entry(filename) != NULL;
+    pthread_rwlock_unlock(&server_state.index_lock);
+    return found;
+}
+
+int index_get_file(const char* filename, FileMetadata* out) {
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    FileEntry* entry = find_entry(filename);
+    if (entry) {
+        *out = entry->meta;
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+    return entry != NULL;
+}
+
+static int add_file(const FileMetadata* meta, StorageServerInfo* ss, int bulk) {
+    FileEntry* entry = malloc(sizeof(FileEntry));
+    if (!entry) {
+        return -1;
+    }
+    entry->meta = *meta;
+    if (!entry->meta.path[0]) {
+        strcpy(entry->meta.path, meta->filename);
+    }
+    entry->dirty = 0;
+    entry->next_dirty = NULL;
+    entry->acl = NULL;
+    entry->children = NULL;
+
+    pthread_rwlock_wrlock(&server_state.index_lock);
+    if (server_state.file_total >= server_state.file_buckets) {
+        grow_file_table();
+    }
+    hash_entry(entry);
+    server_state.file_total++;
+    link_child(entry, bulk ? NULL : find_parent(meta->filename));
+
+    if (!bulk) {
+        trie_insert(server_state.file_trie, meta->filename);
+    }
+    if (ss) ss->file_count++;
+    pthread_rwlock_unlock(&server_state.index_lock);
+    return 0;
+}
+
+int index_add_file(const FileMetadata* meta, StorageServerInfo* ss) {
+    return add_file(meta, ss, 0);
+}
+
+int index_load_file(const FileMetadata* meta) {
+    return add_file(meta, NULL, 1);
+}
+
+void index_remove_file(const char* filename, int ss_id) {
+    pthread_rwlock_wrlock(&server_state.index_lock);
+    if (server_state.file_buckets) {
+        FileEntry** link = &server_state.file_table[filename_hash(filename) % server_state.file_buckets];
+        while (*link && strcmp((*link)->meta.filename, filename) != 0) {
+            link = &(*link)->next;
+        }
+        if (*link) {
+            FileEntry* entry = *link;
+            *link = entry->next;
+            if (entry->dirty) {
+                // Nothing left to save; the row is being deleted
+                pthread_mutex_lock(&server_state.dirty_mutex);
+                FileEntry** d = &server_state.dirty_head;
+                while (*d && *d != entry) {
+                    d = &(*d)->next_dirty;
+                }
+                if (*d) *d = entry->next_dirty;
+                pthread_mutex_unlock(&server_state.dirty_mutex);
+            }
+            drop_file_acl(entry);
+            unlink_child(entry);
+            // Folders are only deleted empty, but a rolled back batch can
+            // drop one that still has children; keep those reachable
+            while (entry->children) {
+                FileEntry* child = entry->children;
+                unlink_child(child);
+                link_child(child, NULL);
+            }
+            free(entry);
+            server_state.file_total--;
+        }
+    }
+
+    trie_delete(server_state.file_trie, filename);
+    for (int i = 0; i < server_state.ss_count; i++) {
+        if (server_state.storage_servers[i].id == ss_id) {
+            server_state.storage_servers[i].file_count--;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+}
+
+void index_undo_add(const char* filename) {
+    FileMetadata meta;
+    if (index_get_file(filename, &meta)) {
+        index_remove_file(filename, meta.storage_server_id);
+    }
+}
+
+void index_restore_file(const FileMetadata* meta) {
+    StorageServerInfo* ss = NULL;
+    for (int i = 0; i < server_state.ss_count; i++) {
+        if (server_state.storage_servers[i].id == meta->storage_server_id) {
+            ss = &server_state.storage_servers[i];
+            break;
+        }
+    }
+    if (index_add_file(meta, ss) == 0) {
+        index_reload_permissions(meta->filename);
+    }
+}
+
+void index_link_orphans() {
+    pthread_rwlock_wrlock(&server_state.index_lock);
+    FileEntry* entry = server_state.top_level;
+    while (entry) {
+        FileEntry* next = entry->next_sibling;
+        FileEntry* parent = find_parent(entry->meta.filename);
+        if (parent) {
+            unlink_child(entry);
+            link_child(entry, parent);
+        }
+        entry = next;
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+}
+
+int index_lookup_folder(const char* path, int* has_children) {
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    int result;
+    if (!path[0]) {
+        result = 1;
+        if (has_children) *has_children = server_state.top_level != NULL;
+    } else {
+        FileEntry* entry = find_entry(path);
+        result = entry ? entry->meta.is_folder : -1;
+        if (has_children) *has_children = entry && entry->children;
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+    return result;
+}
+
+// Caller holds index_lock
+static int entry_readable(const FileEntry* entry, const char* username) {
+    if (strcmp(entry->meta.owner, username) == 0) return 1;
+    AclEntry* acl = find_acl(entry->meta.filename, username);
+    return acl && (acl->access.permissions & ACCESS_READ);
+}
+
+// Max-heap on strcmp: names[0] is the largest name kept so far
+static void sift_down(char** names, int n, int i) {
+    for (;;) {
+        int largest = i;
+        int left = 2 * i + 1, right = left + 1;
+        if (left < n && strcmp(names[left], names[largest]) > 0) largest = left;
+        if (right < n && strcmp(names[right], names[largest]) > 0) largest = right;
+        if (largest == i) return;
+        char* tmp = names[i];
+        names[i] = names[largest];
+        names[largest] = tmp;
+        i = largest;
+    }
+}
+
+static void sift_up(char** names, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (strcmp(names[i], names[parent]) <= 0) return;
+        char* tmp = names[i];
+        names[i] = names[parent];
+        names[parent] = tmp;
+        i = parent;
+    }
+}
+
+int index_list_folder(const char* path, const char* username, const char* after,
+                      char** names, int max_names) {
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    FileEntry* folder = path[0] ? find_entry(path) : NULL;
+    if (path[0] && (!folder || !folder->meta.is_folder)) {
+        pthread_rwlock_unlock(&server_state.index_lock);
+        return -1;
+    }
+
+    // One pass keeping the max_names smallest names after `after` in a
+    // bounded heap, so a page costs O(children * log max_names)
+    int n = 0;
+    for (FileEntry* e = folder ? folder->children : server_state.top_level; e; e = e->next_sibling) {
+        if (!entry_readable(e, username)) continue;
+        const char* slash = strrchr(e->meta.filename, '/');
+        const char* base = slash ? slash + 1 : e->meta.filename;
+        char name[MAX_FILENAME + 1];
+        size_t len = strlen(base);
+        memcpy(name, base, len);
+        // Folders are marked with a trailing '/'
+        if (e->meta.is_folder) name[len++] = '/';
+        name[len] = '\0';
+        if (strcmp(name, after) <= 0) continue;
+
+        if (n < max_names) {
+            char* copy = malloc(len + 1);
+            if (!copy) break;
+            memcpy(copy, name, len + 1);
+            names[n] = copy;
+            sift_up(names, n++);
+        } else if (n > 0 && strcmp(name, names[0]) < 0) {
+            // Evict the largest, reusing its buffer
+            char* copy = realloc(names[0], len + 1);
+            if (!copy) break;
+            memcpy(copy, name, len + 1);
+            names[0] = copy;
+            sift_down(names, n, 0);
+        }
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+
+    // Heapsort the survivors into ascending order
+    for (int end = n - 1; end > 0; end--) {
+        char* tmp = names[0];
+        names[0] = names[end];
+        names[end] = tmp;
+        sift_down(names, end, 0);
+    }
+    return n;
+}
+
+// top and everything under it, top first; caller holds index_lock and
+// frees the array
+static FileEntry** collect_subtree(FileEntry* top, int* count) {
+    int capacity = 16;
+    FileEntry** list = malloc(capacity * sizeof(FileEntry*));
+    if (!list) return NULL;
+    int n = 0;
+    list[n++] = top;
+    // Breadth-first: the list doubles as the queue
+    for (int i = 0; i < n; i++) {
+        for (FileEntry* child = list[i]->children; child; child = child->next_sibling) {
+            if (n == capacity) {
+                capacity *= 2;
+                FileEntry** grown = realloc(list, capacity * sizeof(FileEntry*));
+                if (!grown) {
+                    free(list);
+                    return NULL;
+                }
+                list = grown;
+            }
+            list[n++] = child;
+        }
+    }
+    *count = n;
+    return list;
+}
+
+int index_check_move(const char* from, const char* to, const char* username) {
+    size_t from_len = strlen(from);
+    size_t to_len = strlen(to);
+    int result = ERR_SUCCESS;
+
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    FileEntry* entry = find_entry(from);
+    const char* slash = strrchr(to, '/');
+    if (!entry) {
+        result = ERR_FILE_NOT_FOUND;
+    } else if (strcmp(entry->meta.owner, username) != 0) {
+        result = ERR_NOT_OWNER;
+    } else if (find_entry(to)) {
+        result = ERR_FILE_EXISTS;
+    } else if (slash && !find_parent(to)) {
+        result = ERR_FOLDER_NOT_FOUND;
+    } else if (!to[0] || to[to_len - 1] == '/' ||
+               (strncmp(to, from, from_len) == 0 && to[from_len] == '/')) {
+        // Empty name, or a folder moved under itself
+        result = ERR_INVALID_PARAM;
+    } else {
+        int count;
+        FileEntry** subtree = collect_subtree(entry, &count);
+        if (!subtree) {
+            result = ERR_SERVER_ERROR;
+        } else {
+            for (int i = 0; i < count; i++) {
+                if (strlen(subtree[i]->meta.filename) - from_len + to_len >= MAX_FILENAME) {
+                    result = ERR_INVALID_PARAM;
+                    break;
+                }
+            }
+            free(subtree);
+        }
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+    return result;
+}
+
+void index_move(const char* from, const char* to) {
+    size_t from_len = strlen(from);
+
+    pthread_rwlock_wrlock(&server_state.index_lock);
+    FileEntry* top = find_entry(from);
+    int count;
+    FileEntry** subtree = top ? collect_subtree(top, &count) : NULL;
+    if (!subtree) {
+        pthread_rwlock_unlock(&server_state.index_lock);
+        return;
+    }
+
+    // Re-key every entry and its grants; the tree links and storage path stay
+    for (int i = 0; i < count; i++) {
+        FileEntry* entry = subtree[i];
+        for (AclEntry* acl = entry->acl; acl; acl = acl->next_in_file) {
+            unhash_acl(acl);
+        }
+        unhash_entry(entry);
+        trie_delete(server_state.file_trie, entry->meta.filename);
+
+        char renamed[MAX_FILENAME];
+        snprintf(renamed, sizeof(renamed), "%s%s", to, entry->meta.filename + from_len);
+        strcpy(entry->meta.filename, renamed);
+
+        hash_entry(entry);
+        trie_insert(server_state.file_trie, entry->meta.filename);
+        for (AclEntry* acl = entry->acl; acl; acl = acl->next_in_file) {
+            hash_acl(acl);
+        }
+    }
+    free(subtree);
+
+    unlink_child(top);
+    link_child(top, find_parent(top->meta.filename));
+    pthread_rwlock_unlock(&server_state.index_lock);
+}
+
+void index_free() {
+    for (size_t i = 0; i < server_state.acl_buckets; i++) {
+        AclEntry* acl = server_state.acl_table[i];
+        while (acl) {
+            AclEntry* next = acl->next;
+            free(acl);
+            acl = next;
+        }
+    }
+    free(server_state.acl_table);
+    server_state.acl_table = NULL;
+    server_state.acl_buckets = 0;
+    server_state.acl_total = 0;
+
+    for (size_t i = 0; i < server_state.file_buckets; i++) {
+        FileEntry* entry = server_state.file_table[i];
+        while (entry) {
+            FileEntry* next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(server_state.file_table);
+    server_state.file_table = NULL;
+    server_state.file_buckets = 0;
+    server_state.file_total = 0;
+    server_state.top_level = NULL;
+}
+
+void index_reserve(size_t files, size_t acls) {
+    pthread_rwlock_wrlock(&server_state.index_lock);
+    while (server_state.file_buckets < files) {
+        size_t before = server_state.file_buckets;
+        grow_file_table();
+        if (server_state.file_buckets == before) break;
+    }
+    while (server_state.acl_buckets < acls) {
+        size_t before = server_state.acl_buckets;
+        grow_acl_table();
+        if (server_state.acl_buckets == before) break;
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+}
+
+int index_for_each(int (*fn)(const FileEntry* entry, void* arg), void* arg) {
+    int rc = 0;
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    for (size_t i = 0; i < server_state.file_buckets && rc == 0; i++) {
+        for (FileEntry* entry = server_state.file_table[i]; entry && rc == 0; entry = entry->next) {
+            rc = fn(entry, arg);
+        }
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+    return rc;
+}
+
+int index_get_permissions(const char* filename, const char* username) {
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    AclEntry* acl = find_acl(filename, username);
+    int permissions = acl ? acl->access.permissions : ACCESS_NONE;
+    pthread_rwlock_unlock(&server_state.index_lock);
+    return permissions;
+}
+
+#define SEARCH_BATCH 256
+
+// Caller holds index_lock
+static int can_read(const char* filename, const char* username) {
+    FileEntry* entry = find_entry(filename);
+    return entry && entry_readable(entry, username);
+}
+
+int index_search_prefix(const char* prefix, const char* after, const char* username,
+                        char** results, int max_results, char* resume) {
+    char* batch[SEARCH_BATCH];
+    char cursor[MAX_FILENAME];
+    strncpy(cursor, after, sizeof(cursor) - 1);
+    cursor[sizeof(cursor) - 1] = '\0';
+    resume[0] = '\0';
+
+    int count = 0;
+    int scanned = 0;
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    while (count < max_results) {
+        if (scanned >= SEARCH_MAX_SCAN) {
+            // Bound the time spent under the lock; the caller resumes from here
+            strcpy(resume, cursor);
+            break;
+        }
+        int n = trie_search_prefix(server_state.file_trie, prefix, cursor, batch, SEARCH_BATCH);
+        int i;
+        for (i = 0; i < n && count < max_results; i++) {
+            strncpy(cursor, batch[i], sizeof(cursor) - 1);
+            scanned++;
+            if (can_read(batch[i], username)) {
+                results[count++] = batch[i];
+            } else {
+                free(batch[i]);
+            }
+        }
+        for (; i < n; i++) {
+            free(batch[i]);
+        }
+        if (n < SEARCH_BATCH) break;
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+    return count;
+}
+
+// Caller holds index_lock exclusively
+static void set_permissions_locked(FileEntry* file, const char* username, int permissions) {
+    AclEntry* acl = find_acl(file->meta.filename, username);
+    if (acl) {
+        if (permissions != ACCESS_NONE) {
+            acl->access.permissions = permissions;
+            return;
+        }
+        AclEntry** link = &file->acl;
+        while (*link != acl) {
+            link = &(*link)->next_in_file;
+        }
+        *link = acl->next_in_file;
+        drop_acl(acl);
+        return;
+    }
+    if (permissions == ACCESS_NONE) {
+        return;
+    }
+
+    acl = malloc(sizeof(AclEntry));
+    if (!acl) {
+        return;
+    }
+    strncpy(acl->access.username, username, MAX_USERNAME - 1);
+    acl->access.username[MAX_USERNAME - 1] = '\0';
+    acl->access.permissions = permissions;
+    acl->file = file;
+    acl->next_in_file = file->acl;
+    file->acl = acl;
+
+    if (server_state.acl_total >= server_state.acl_buckets) {
+        grow_acl_table();
+    }
+    hash_acl(acl);
+    server_state.acl_total++;
+}
+
+void index_set_permissions(const char* filename, const char* username, int permissions) {
+    pthread_rwlock_wrlock(&server_state.index_lock);
+    FileEntry* file = find_entry(filename);
+    if (file) {
+        set_permissions_locked(file, username, permissions);
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+}
+
+void index_reload_permissions(const char* filename) {
+    // Used after a rolled back batch: the database is right, the index may not be
+    CachedStmt* cs = &nm_statements[NM_STMT_FILE_ACL];
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    if (!stmt) {
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_STATIC);
+
+    pthread_rwlock_wrlock(&server_state.index_lock);
+    FileEntry* file = find_entry(filename);
+    if (file) {
+        drop_file_acl(file);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            set_permissions_locked(file, (const char*)sqlite3_column_text(stmt, 0),
+                                   sqlite3_column_int(stmt, 1));
+        }
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+    stmt_release(cs);
+}
+
+void index_touch_file(const char* filename, int modified) {
+    time_t now = time(NULL);
+
+    // Shared lock only: concurrent touches store whole words and any of
+    // their values is an acceptable timestamp
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    FileEntry* entry = find_entry(filename);
+    if (entry) {
+        time_t* field = modified ? &entry->meta.modified_at : &entry->meta.accessed_at;
+        // Hot files are touched many times a second; only the first counts
+        if (__atomic_load_n(field, __ATOMIC_RELAXED) != now) {
+            __atomic_store_n(field, now, __ATOMIC_SEQ_CST);
+            if (!__atomic_exchange_n(&entry->dirty, 1, __ATOMIC_SEQ_CST)) {
+                pthread_mutex_lock(&server_state.dirty_mutex);
+                entry->next_dirty = server_state.dirty_head;
+                server_state.dirty_head = entry;
+                pthread_mutex_unlock(&server_state.dirty_mutex);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&server_state.index_lock);
+}
+
+typedef struct {
+    char filename[MAX_FILENAME];
+    time_t accessed_at;
+    time_t modified_at;
+} DirtyTimestamps;
+
+int index_flush_timestamps() {
+    // Snapshot the dirty entries, then write them without holding the index
+    pthread_rwlock_rdlock(&server_state.index_lock);
+    pthread_mutex_lock(&server_state.dirty_mutex);
+    int count = 0;
+    for (FileEntry* e = server_state.dirty_head; e; e = e->next_dirty) {
+        count++;
+    }
+    DirtyTimestamps* batch = count ? malloc(sizeof(DirtyTimestamps) * count) : NULL;
+    if (batch) {
+        int i = 0;
+        FileEntry* entry = server_state.dirty_head;
+        while (entry) {
+            FileEntry* next = entry->next_dirty;
+            // Clear before reading, so a touch that lands after the read
+            // finds the entry clean and queues it again
+            __atomic_store_n(&entry->dirty, 0, __ATOMIC_SEQ_CST);
+            strcpy(batch[i].filename, entry->meta.filename);
+            batch[i].accessed_at = __atomic_load_n(&entry->meta.accessed_at, __ATOMIC_SEQ_CST);
+            batch[i].modified_at = __atomic_load_n(&entry->meta.modified_at, __ATOMIC_SEQ_CST);
+            entry->next_dirty = NULL;
+            entry = next;
+            i++;
+        }
+        server_state.dirty_head = NULL;
+    } else {
+        count = 0; // Out of memory: leave everything dirty for the next pass
+    }
+    pthread_mutex_unlock(&server_state.dirty_mutex);
+    pthread_rwlock_unlock(&server_state.index_lock);
+
+    if (count == 0) {
+        return 0;
+    }
+
+    // One batch for all of them; nobody waits on it
+    group_commit_begin(&server_state.commits);
+    CachedStmt* cs = &nm_statements[NM_STMT_SAVE_TIMESTAMPS];
+    for (int i = 0; i < count; i++) {
+        sqlite3_stmt* stmt = stmt_acquire(cs);
+        if (!stmt) break;
+        sqlite3_bind_int64(stmt, 1, batch[i].accessed_at);
+        sqlite3_bind_int64(stmt, 2, batch[i].modified_at);
+        sqlite3_bind_text(stmt, 3, batch[i].filename, -1, SQLITE_STATIC);
+        sqlite3_step(stmt);
+        stmt_release(cs);
+    }
+    group_commit_end(&server_state.commits);
+
+    free(batch);
+    return count;
+}
+
+static void* flush_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&server_state.dirty_mutex);
+    while (!server_state.flush_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += server_state.flush_interval_ms / 1000;
+        deadline.tv_nsec += (long)(server_state.flush_interval_ms % 1000) * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&server_state.flush_cond, &server_state.dirty_mutex, &deadline);
+        if (server_state.flush_stop) break;
+
+        // Lock order is index_lock -> dirty_mutex, so flush without it
+        pthread_mutex_unlock(&server_state.dirty_mutex);
+        index_flush_timestamps();
+        pthread_mutex_lock(&server_state.dirty_mutex);
+    }
+    pthread_mutex_unlock(&server_state.dirty_mutex);
+    return NULL;
+}
+
+int timestamp_flusher_start() {
+    server_state.flush_stop = 0;
+    if (pthread_create(&server_state.flush_thread, NULL, flush_main, NULL) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void timestamp_flusher_stop() {
+    pthread_mutex_lock(&server_state.dirty_mutex);
+    server_state.flush_stop = 1;
+    pthread_cond_signal(&server_state.flush_cond);
+    pthread_mutex_unlock(&server_state.dirty_mutex);
+    pthread_join(server_state.flush_thread, NULL);
+
+    int count = index_flush_timestamps();
+    char log_buf[128];
+    snprintf(log_buf, sizeof(log_buf), "Flushed %d file timestamps on shutdown", count);
+    log_message("NameServer", log_buf);
+}
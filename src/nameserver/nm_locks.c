@@ -0,0 +1,439 @@
+#include "../../include/nameserver.h"
+
+// Sentence locks: (file, sentence) -> the connection editing it. Every lock
+// is also chained off its holder's socket, so a disconnect drops the
+// session's locks without a scan, and carries a lease that each re-acquire
+// renews; the reaper thread drops leases nobody renewed. Guarded by
+// lock_table_mutex.
+//
+// Locks are released on disconnect before the socket is closed, so a later
+// connection that gets the same fd never inherits them.
+//
+// A request locks a set of sentences all or nothing, under one hold of the
+// mutex, so two editors can never each hold part of what the other wants.
+//
+// A WRITE_LOCK that may wait joins the FIFO of the first busy sentence
+// instead of failing. No worker blocks on it: whoever releases that lock
+// hands it to the first waiter and re-queues the waiter's request, with
+// what is left of its wait, on its own connection. There the request runs
+// again and finds the lock held; if another sentence of its set is busy,
+// it gives back what it was handed (a waiter never holds part of its set)
+// and queues on that one. The reaper re-queues waiters whose timeout
+// passed without the wait, so they get ERR_LOCKED.
+
+static unsigned long lock_hash(const char* filename, int sentence) {
+    return filename_hash(filename) * 31 + (unsigned)sentence;
+}
+
+// Caller holds lock_table_mutex; returns the link to the lock, or to the
+// NULL at the end of its chain
+static LockEntry** find_lock(const char* filename, int sentence) {
+    LockEntry** link = &server_state.lock_table[lock_hash(filename, sentence) % NM_LOCK_BUCKETS];
+    while (*link && ((*link)->lock.sentence_number != sentence ||
+                     strcmp((*link)->lock.filename, filename) != 0)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+// Caller holds lock_table_mutex
+static void link_socket(LockEntry* entry) {
+    size_t b = entry->lock.client_socket % NM_LOCK_BUCKETS;
+    entry->next_by_socket = server_state.socket_locks[b];
+    server_state.socket_locks[b] = entry;
+}
+
+// Caller holds lock_table_mutex
+static void unlink_socket(LockEntry* entry) {
+    LockEntry** by_socket = &server_state.socket_locks[entry->lock.client_socket % NM_LOCK_BUCKETS];
+    while (*by_socket != entry) {
+        by_socket = &(*by_socket)->next_by_socket;
+    }
+    *by_socket = entry->next_by_socket;
+}
+
+// Caller holds lock_table_mutex; the lock must have no waiters
+static void drop_lock(LockEntry** link) {
+    LockEntry* entry = *link;
+    *link = entry->next;
+    unlink_socket(entry);
+    server_state.lock_total--;
+    free(entry);
+}
+
+static void log_lock(const char* event, const SentenceLock* lock) {
+    char log_buf[512];
+    snprintf(log_buf, sizeof(log_buf), "Lock %s: %s sentence %d by %s",
+            event, lock->filename, lock->sentence_number, lock->username);
+    log_message("NameServer", log_buf);
+}
+
+// One line for a whole set; sentences are ascending
+static void log_locks(const char* event, const char* filename, const int* sentences, int count,
+                      const char* username) {
+    char log_buf[512];
+    if (count == 1) {
+        snprintf(log_buf, sizeof(log_buf), "Lock %s: %s sentence %d by %s",
+                event, filename, sentences[0], username);
+    } else {
+        snprintf(log_buf, sizeof(log_buf), "Locks %s: %s %d sentences %d..%d by %s",
+                event, filename, count, sentences[0], sentences[count - 1], username);
+    }
+    log_message("NameServer", log_buf);
+}
+
+static long remaining_ms(const struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+// Caller holds lock_table_mutex. Re-runs the waiter's request on its
+// connection and frees the waiter. With keep_waiting, whatever is left of
+// its wait goes along; without, the request is answered either way.
+static void resume_waiter(const LockEntry* entry, LockWaiter* waiter, int keep_waiting) {
+    Message* msg = malloc(sizeof(Message));
+    if (msg) {
+        init_message(msg);
+        strcpy(msg->type, waiter->type);
+        strcpy(msg->username, waiter->username);
+        strcpy(msg->filename, entry->lock.filename);
+        long left = keep_waiting ? remaining_ms(&waiter->deadline) : 0;
+        if (left > 0) {
+            snprintf(msg->data, sizeof(msg->data), "%s -w %ld", waiter->spec, left);
+        } else {
+            snprintf(msg->data, sizeof(msg->data), "%s", waiter->spec);
+        }
+        msg->request_id = waiter->request_id;
+        connection_resume(waiter->sock, msg);
+    }
+    free(waiter);
+    server_state.waiter_total--;
+}
+
+// Caller holds lock_table_mutex. Hands the lock to its first waiter, or
+// drops it if nobody is waiting.
+static void release_entry(LockEntry** link) {
+    LockEntry* entry = *link;
+    LockWaiter* waiter = entry->waiters;
+    if (!waiter) {
+        drop_lock(link);
+        return;
+    }
+    entry->waiters = waiter->next;
+    if (!entry->waiters) {
+        entry->waiters_tail = NULL;
+    }
+
+    unlink_socket(entry);
+    strcpy(entry->lock.username, waiter->username);
+    entry->lock.client_socket = waiter->sock;
+    entry->lock.locked_at = time(NULL);
+    entry->expires_at = entry->lock.locked_at + server_state.lock_lease_seconds;
+    entry->granted = 1;
+    link_socket(entry);
+    log_lock("granted", &entry->lock);
+
+    resume_waiter(entry, waiter, 1);
+}
+
+static int deadline_passed(const struct timespec* deadline, const struct timespec* now) {
+    return now->tv_sec > deadline->tv_sec ||
+           (now->tv_sec == deadline->tv_sec && now->tv_nsec >= deadline->tv_nsec);
+}
+
+// Caller holds lock_table_mutex. With now set, resumes every waiter whose
+// deadline passed; otherwise frees every waiter of sock unanswered.
+static void sweep_waiters(int sock, const struct timespec* now) {
+    for (size_t i = 0; i < NM_LOCK_BUCKETS && server_state.waiter_total > 0; i++) {
+        for (LockEntry* entry = server_state.lock_table[i]; entry; entry = entry->next) {
+            LockWaiter** link = &entry->waiters;
+            LockWaiter* prev = NULL;
+            while (*link) {
+                LockWaiter* waiter = *link;
+                int remove = now ? deadline_passed(&waiter->deadline, now) : waiter->sock == sock;
+                if (!remove) {
+                    prev = waiter;
+                    link = &waiter->next;
+                    continue;
+                }
+                *link = waiter->next;
+                if (entry->waiters_tail == waiter) {
+                    entry->waiters_tail = prev;
+                }
+                if (now) {
+                    resume_waiter(entry, waiter, 0);
+                } else {
+                    free(waiter);
+                    server_state.waiter_total--;
+                }
+            }
+        }
+    }
+}
+
+// Caller holds lock_table_mutex. Gives back the locks of the set that were
+// handed to this request while it waited.
+static void release_granted(const char* filename, const int* sentences, int count, int sock) {
+    for (int i = 0; i < count; i++) {
+        LockEntry** link = find_lock(filename, sentences[i]);
+        if (*link && (*link)->lock.client_socket == sock && (*link)->granted) {
+            log_lock("returned", &(*link)->lock);
+            release_entry(link);
+        }
+    }
+}
+
+int lock_acquire(const Message* request, const int* sentences, int count, int sock, int wait_ms,
+                 char* holder, int* conflict) {
+    const char* filename = request->filename;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&server_state.lock_table_mutex);
+
+    // Check the whole set before taking any of it
+    LockEntry* blocker = NULL;
+    for (int i = 0; i < count && !blocker; i++) {
+        LockEntry** link = find_lock(filename, sentences[i]);
+        if (*link && (*link)->lock.client_socket != sock && (*link)->expires_at <= now) {
+            // Lease ran out before the reaper got to it; waiters still go first
+            log_lock("expired", &(*link)->lock);
+            release_entry(link);
+            link = find_lock(filename, sentences[i]);
+        }
+        if (*link && (*link)->lock.client_socket != sock) {
+            // Held by a different session, even if it is the same user
+            blocker = *link;
+            *conflict = sentences[i];
+        }
+    }
+
+    if (blocker) {
+        strncpy(holder, blocker->lock.username, MAX_USERNAME - 1);
+        holder[MAX_USERNAME - 1] = '\0';
+        release_granted(filename, sentences, count, sock);
+        if (wait_ms <= 0) {
+            pthread_mutex_unlock(&server_state.lock_table_mutex);
+            return ERR_LOCKED;
+        }
+
+        LockWaiter* waiter = calloc(1, sizeof(LockWaiter));
+        if (!waiter) {
+            pthread_mutex_unlock(&server_state.lock_table_mutex);
+            return ERR_SERVER_ERROR;
+        }
+        waiter->sock = sock;
+        waiter->request_id = request->request_id;
+        strncpy(waiter->type, request->type, sizeof(waiter->type) - 1);
+        strncpy(waiter->username, request->username, MAX_USERNAME - 1);
+        sscanf(request->data, "%127s", waiter->spec);
+        clock_gettime(CLOCK_MONOTONIC, &waiter->deadline);
+        waiter->deadline.tv_sec += wait_ms / 1000;
+        waiter->deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000;
+        if (waiter->deadline.tv_nsec >= 1000000000) {
+            waiter->deadline.tv_sec++;
+            waiter->deadline.tv_nsec -= 1000000000;
+        }
+
+        if (blocker->waiters_tail) {
+            blocker->waiters_tail->next = waiter;
+        } else {
+            blocker->waiters = waiter;
+        }
+        blocker->waiters_tail = waiter;
+        // The reaper sleeps longer while nobody waits; wake it to time this one
+        if (server_state.waiter_total++ == 0) {
+            pthread_cond_signal(&server_state.reaper_cond);
+        }
+        pthread_mutex_unlock(&server_state.lock_table_mutex);
+
+        char log_buf[512];
+        snprintf(log_buf, sizeof(log_buf), "Lock wait: %s sentence %d by %s (held by %s, up to %d ms)",
+                filename, *conflict, request->username, holder, wait_ms);
+        log_message("NameServer", log_buf);
+        return NM_LOCK_QUEUED;
+    }
+
+    // All free or already ours: take the rest, renewing every lease
+    int created = 0;
+    for (int i = 0; i < count; i++) {
+        LockEntry** link = find_lock(filename, sentences[i]);
+        LockEntry* entry = *link;
+        if (!entry) {
+            entry = calloc(1, sizeof(LockEntry));
+            if (!entry) {
+                // All or nothing: drop what this call created, the entries
+                // without a lease yet (nobody can be waiting on them)
+                for (int j = 0; j < i; j++) {
+                    LockEntry** undo = find_lock(filename, sentences[j]);
+                    if ((*undo)->expires_at == 0) {
+                        drop_lock(undo);
+                    }
+                }
+                pthread_mutex_unlock(&server_state.lock_table_mutex);
+                return ERR_SERVER_ERROR;
+            }
+            strncpy(entry->lock.filename, filename, MAX_FILENAME - 1);
+            entry->lock.sentence_number = sentences[i];
+            strncpy(entry->lock.username, request->username, MAX_USERNAME - 1);
+            entry->lock.client_socket = sock;
+            entry->lock.locked_at = now;
+
+            size_t b = lock_hash(filename, sentences[i]) % NM_LOCK_BUCKETS;
+            entry->next = server_state.lock_table[b];
+            server_state.lock_table[b] = entry;
+            link_socket(entry);
+            server_state.lock_total++;
+            created++;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        LockEntry* entry = *find_lock(filename, sentences[i]);
+        entry->granted = 0;
+        entry->expires_at = now + server_state.lock_lease_seconds;
+    }
+    if (created > 0) {
+        log_locks("acquired", filename, sentences, count, request->username);
+    }
+
+    pthread_mutex_unlock(&server_state.lock_table_mutex);
+    return ERR_SUCCESS;
+}
+
+int lock_release(const char* filename, const int* sentences, int count, int sock) {
+    int released = 0;
+    pthread_mutex_lock(&server_state.lock_table_mutex);
+    for (int i = 0; i < count; i++) {
+        LockEntry** link = find_lock(filename, sentences[i]);
+        if (*link && (*link)->lock.client_socket == sock) {
+            // Logged before any hand-over, so "granted" lines follow it
+            if (released++ == 0) {
+                log_locks("released", filename, sentences, count, (*link)->lock.username);
+            }
+            release_entry(link);
+        }
+    }
+    pthread_mutex_unlock(&server_state.lock_table_mutex);
+    return released;
+}
+
+int lock_release_socket(int sock) {
+    int count = 0;
+    pthread_mutex_lock(&server_state.lock_table_mutex);
+    // Waiters have no per-socket index; only walk the table if any exist
+    if (server_state.waiter_total > 0) {
+        sweep_waiters(sock, NULL);
+    }
+    LockEntry* entry = server_state.socket_locks[sock % NM_LOCK_BUCKETS];
+    while (entry) {
+        LockEntry* next = entry->next_by_socket;
+        if (entry->lock.client_socket == sock) {
+            log_lock("released on disconnect", &entry->lock);
+            release_entry(find_lock(entry->lock.filename, entry->lock.sentence_number));
+            count++;
+        }
+        entry = next;
+    }
+    pthread_mutex_unlock(&server_state.lock_table_mutex);
+    return count;
+}
+
+int lock_subtree_held(const char* path) {
+    size_t len = strlen(path);
+    int held = 0;
+    // MOVE is rare enough to afford a walk over every bucket
+    pthread_mutex_lock(&server_state.lock_table_mutex);
+    for (size_t i = 0; i < NM_LOCK_BUCKETS && !held; i++) {
+        for (LockEntry* entry = server_state.lock_table[i]; entry; entry = entry->next) {
+            const char* name = entry->lock.filename;
+            if (strncmp(name, path, len) == 0 && (name[len] == '\0' || name[len] == '/')) {
+                held = 1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&server_state.lock_table_mutex);
+    return held;
+}
+
+// Caller holds lock_table_mutex
+static void reap_expired(time_t now) {
+    for (size_t i = 0; i < NM_LOCK_BUCKETS; i++) {
+        LockEntry** link = &server_state.lock_table[i];
+        while (*link) {
+            if ((*link)->expires_at <= now) {
+                // Handing over restarts the lease, so the loop moves past it
+                log_lock("expired", &(*link)->lock);
+                release_entry(link);
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+}
+
+static void* reaper_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&server_state.lock_table_mutex);
+    while (!server_state.reaper_stop) {
+        // Lock waits time out in milliseconds; leases only in seconds
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        if (server_state.waiter_total > 0) {
+            deadline.tv_nsec += NM_LOCK_WAIT_POLL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+        } else {
+            deadline.tv_sec += NM_LOCK_REAP_INTERVAL_SECONDS;
+        }
+        pthread_cond_timedwait(&server_state.reaper_cond, &server_state.lock_table_mutex, &deadline);
+        if (server_state.lock_total > 0) {
+            reap_expired(time(NULL));
+        }
+        if (server_state.waiter_total > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            sweep_waiters(-1, &now);
+        }
+    }
+    pthread_mutex_unlock(&server_state.lock_table_mutex);
+    return NULL;
+}
+
+int lock_reaper_start() {
+    server_state.reaper_stop = 0;
+    if (pthread_create(&server_state.reaper_thread, NULL, reaper_main, NULL) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void lock_reaper_stop() {
+    pthread_mutex_lock(&server_state.lock_table_mutex);
+    server_state.reaper_stop = 1;
+    pthread_cond_signal(&server_state.reaper_cond);
+    pthread_mutex_unlock(&server_state.lock_table_mutex);
+    pthread_join(server_state.reaper_thread, NULL);
+}
+
+void locks_free() {
+    for (size_t i = 0; i < NM_LOCK_BUCKETS; i++) {
+        LockEntry* entry = server_state.lock_table[i];
+        while (entry) {
+            LockEntry* next = entry->next;
+            LockWaiter* waiter = entry->waiters;
+            while (waiter) {
+                LockWaiter* next_waiter = waiter->next;
+                free(waiter);
+                waiter = next_waiter;
+            }
+            free(entry);
+            entry = next;
+        }
+        server_state.lock_table[i] = NULL;
+        server_state.socket_locks[i] = NULL;
+    }
+    server_state.lock_total = 0;
+    server_state.waiter_total = 0;
+}
@@ -1,161 +1,575 @@
 #include "../../include/nameserver.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
 
 NameServerState server_state;
 volatile sig_atomic_t keep_running = 1;
 
+// A client session. The epoll thread owns the read buffer; everything else
+// is guarded by work_mutex. Requests of one connection run one at a time, in
+// order, so handlers never write to the same socket concurrently.
+typedef struct PendingRequest {
+    char* frame;
+    size_t len;
+    Message* msg;           // Already decoded (a resumed request), else NULL
+    struct PendingRequest* next;
+} PendingRequest;
+
+typedef struct NMConnection {
+    int sock;
+    char* rbuf;             // Bytes of a partially received frame
+    size_t rlen;
+    size_t rcap;
+    PendingRequest* head;   // Decoded frames waiting for a worker
+    PendingRequest* tail;
+    int queued_frames;      // Received frames in the list (resumed requests not counted)
+    int scheduled;          // In the ready queue or running on a worker
+    int closed;             // Peer hung up; freed once no longer scheduled
+    struct NMConnection* next_ready;
+} NMConnection;
+
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static NMConnection* ready_head = NULL;
+static NMConnection* ready_tail = NULL;
+static int workers_stop = 0;
+static NMConnection** conns_by_fd = NULL;  // For connection_resume
+static size_t conns_by_fd_size = 0;
+
 void handle_shutdown(int sig) {
     (void)sig; // Unused parameter
+    // Only the flag: the signal can land on any thread, including one
+    // holding the allocator or a SQLite lock, so logging waits for main
     keep_running = 0;
-    log_message("NameServer", "Shutdown signal received, stopping server...");
 }
 
-void* handle_client(void* arg);
+static void usage(const char* prog) {
+    printf("Usage: %s [-w workers] [-i commit_interval_ms] [-d full|normal|async] [-f flush_interval_ms]\n"
+           "          [-l lock_lease_seconds] [-t ss_timeout_seconds]\n", prog);
+}
+
+static void raise_fd_limit() {
+    // Mostly idle sessions are cheap now; let the fd limit be the only cap
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// Caller holds work_mutex
+static int track_connection(NMConnection* conn) {
+    if ((size_t)conn->sock >= conns_by_fd_size) {
+        size_t size = conns_by_fd_size ? conns_by_fd_size : 1024;
+        while (size <= (size_t)conn->sock) size *= 2;
+        NMConnection** grown = realloc(conns_by_fd, size * sizeof(NMConnection*));
+        if (!grown) return -1;
+        memset(grown + conns_by_fd_size, 0, (size - conns_by_fd_size) * sizeof(NMConnection*));
+        conns_by_fd = grown;
+        conns_by_fd_size = size;
+    }
+    conns_by_fd[conn->sock] = conn;
+    return 0;
+}
+
+// Called without work_mutex, once the connection is closed and no longer
+// scheduled: releasing its locks may hand them to other connections, which
+// takes work_mutex to resume their requests
+static void free_connection(NMConnection* conn) {
+    // Before close: once the fd is reused, these would belong to a stranger
+    lock_release_socket(conn->sock);
+
+    pthread_mutex_lock(&work_mutex);
+    if ((size_t)conn->sock < conns_by_fd_size && conns_by_fd[conn->sock] == conn) {
+        conns_by_fd[conn->sock] = NULL;
+    }
+    pthread_mutex_unlock(&work_mutex);
+
+    PendingRequest* req = conn->head;
+    while (req) {
+        PendingRequest* next = req->next;
+        free(req->frame);
+        free(req->msg);
+        free(req);
+        req = next;
+    }
+    close(conn->sock);
+    free(conn->rbuf);
+    free(conn);
+}
+
+// Caller holds work_mutex
+static void schedule_connection(NMConnection* conn) {
+    conn->scheduled = 1;
+    conn->next_ready = NULL;
+    if (ready_tail) {
+        ready_tail->next_ready = conn;
+    } else {
+        ready_head = conn;
+    }
+    ready_tail = conn;
+    pthread_cond_signal(&work_cond);
+}
+
+// Caller holds work_mutex
+static void queue_request(NMConnection* conn, PendingRequest* req) {
+    if (conn->tail) {
+        conn->tail->next = req;
+    } else {
+        conn->head = req;
+    }
+    conn->tail = req;
+    if (!conn->scheduled) {
+        schedule_connection(conn);
+    }
+}
+
+void connection_resume(int sock, Message* msg) {
+    PendingRequest* req = calloc(1, sizeof(PendingRequest));
+    pthread_mutex_lock(&work_mutex);
+    NMConnection* conn = (size_t)sock < conns_by_fd_size ? conns_by_fd[sock] : NULL;
+    if (req && conn && !conn->closed) {
+        req->msg = msg;
+        queue_request(conn, req);
+        req = NULL;
+        msg = NULL;
+    }
+    pthread_mutex_unlock(&work_mutex);
+    free(req);
+    free(msg);
+}
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    Message* msg = malloc(sizeof(Message));
+
+    pthread_mutex_lock(&work_mutex);
+    while (1) {
+        while (!ready_head && !workers_stop) {
+            pthread_cond_wait(&work_cond, &work_mutex);
+        }
+        if (!ready_head) break;
+
+        NMConnection* conn = ready_head;
+        ready_head = conn->next_ready;
+        if (!ready_head) ready_tail = NULL;
+
+        PendingRequest* req = conn->head;
+        conn->head = req->next;
+        if (!conn->head) conn->tail = NULL;
+        if (!req->msg) conn->queued_frames--;
+        pthread_mutex_unlock(&work_mutex);
+
+        if (req->msg) {
+            dispatch_request(conn->sock, req->msg);
+        } else if (decode_message(req->frame, req->len, msg) == 0) {
+            dispatch_request(conn->sock, msg);
+        }
+        free(req->frame);
+        free(req->msg);
+        free(req);
+
+        pthread_mutex_lock(&work_mutex);
+        if (conn->head) {
+            // Requeue at the tail so one busy session can't starve others
+            schedule_connection(conn);
+        } else {
+            conn->scheduled = 0;
+            if (conn->closed) {
+                pthread_mutex_unlock(&work_mutex);
+                free_connection(conn);
+                pthread_mutex_lock(&work_mutex);
+            }
+        }
+    }
+    pthread_mutex_unlock(&work_mutex);
+
+    free(msg);
+    return NULL;
+}
+
+// Split complete frames off the connection's read buffer and queue them.
+// Returns -1 if the session should end: the stream is malformed, the
+// client has NM_MAX_QUEUED_FRAMES requests queued without waiting for
+// replies, or memory ran out.
+static int queue_frames(NMConnection* conn) {
+    size_t offset = 0;
+    int queued = 0;
+    const char* error = NULL;
+
+    pthread_mutex_lock(&work_mutex);
+    while (1) {
+        long size = wire_frame_size(conn->rbuf + offset, conn->rlen - offset);
+        if (size < 0) {
+            error = "Malformed frame, closing connection";
+            break;
+        }
+        if (size == 0) break;
+        if (conn->queued_frames >= NM_MAX_QUEUED_FRAMES) {
+            error = "Too many queued requests, closing connection";
+            break;
+        }
+
+        PendingRequest* req = malloc(sizeof(PendingRequest));
+        char* frame = req ? malloc(size) : NULL;
+        if (!frame) {
+            free(req);
+            error = "Out of memory queuing request, closing connection";
+            break;
+        }
+        req->frame = frame;
+        memcpy(req->frame, conn->rbuf + offset, size);
+        req->len = size;
+        req->msg = NULL;
+        req->next = NULL;
+        if (conn->tail) {
+            conn->tail->next = req;
+        } else {
+            conn->head = req;
+        }
+        conn->tail = req;
+        conn->queued_frames++;
+        offset += size;
+        queued = 1;
+    }
+    if (queued && !conn->scheduled) {
+        schedule_connection(conn);
+    }
+    pthread_mutex_unlock(&work_mutex);
+
+    if (error) {
+        // Frames already queued still run, but their replies fail at once
+        // instead of each waiting out the send timeout
+        shutdown(conn->sock, SHUT_RDWR);
+        log_message("NameServer", error);
+        return -1;
+    }
+
+    // Keep only the partial frame; idle sessions hold no buffer at all
+    conn->rlen -= offset;
+    if (conn->rlen == 0) {
+        free(conn->rbuf);
+        conn->rbuf = NULL;
+        conn->rcap = 0;
+    } else if (offset > 0) {
+        memmove(conn->rbuf, conn->rbuf + offset, conn->rlen);
+    }
+    return 0;
+}
+
+// Drain the socket (edge-triggered). Returns -1 when the session should end.
+static int read_connection(NMConnection* conn, char* chunk, size_t chunk_size) {
+    while (1) {
+        ssize_t n = recv(conn->sock, chunk, chunk_size, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return -1;
+
+        if (conn->rlen + n > conn->rcap) {
+            size_t cap = conn->rcap ? conn->rcap : 4096;
+            while (cap < conn->rlen + n) cap *= 2;
+            char* grown = realloc(conn->rbuf, cap);
+            if (!grown) return -1;
+            conn->rbuf = grown;
+            conn->rcap = cap;
+        }
+        memcpy(conn->rbuf + conn->rlen, chunk, n);
+        conn->rlen += n;
+
+        if (queue_frames(conn) < 0) {
+            return -1;
+        }
+    }
+}
+
+static void close_connection(int epfd, NMConnection* conn) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+
+    pthread_mutex_lock(&work_mutex);
+    conn->closed = 1;
+    // A scheduled session finishes its queued requests and is freed by the worker
+    int idle = !conn->scheduled;
+    pthread_mutex_unlock(&work_mutex);
+    if (idle) {
+        free_connection(conn);
+    }
+}
+
+static void accept_connections(int epfd, int server_fd) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_sock = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
+        if (client_sock < 0) {
+            if (errno == EINTR) continue;
+            return; // EAGAIN: backlog drained
+        }
+
+        set_socket_nodelay(client_sock);
+        // Replies are sent blocking from the workers; a client that stops
+        // reading them must not hold a worker for good
+        struct timeval send_timeout;
+        send_timeout.tv_sec = NM_SEND_TIMEOUT_MS / 1000;
+        send_timeout.tv_usec = (NM_SEND_TIMEOUT_MS % 1000) * 1000;
+        setsockopt(client_sock, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+        char client_ip[INET_ADDRSTRLEN];
+        char log_buf[128];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        snprintf(log_buf, sizeof(log_buf), "Connection from %s:%d", client_ip, ntohs(client_addr.sin_port));
+        log_message("NameServer", log_buf);
+
+        NMConnection* conn = calloc(1, sizeof(NMConnection));
+        if (!conn) {
+            close(client_sock);
+            continue;
+        }
+        conn->sock = client_sock;
+        pthread_mutex_lock(&work_mutex);
+        int tracked = track_connection(conn);
+        pthread_mutex_unlock(&work_mutex);
+        if (tracked < 0) {
+            close(client_sock);
+            free(conn);
+            continue;
+        }
+
+        // The socket itself stays blocking so handlers can send replies
+        // normally; the reactor only ever reads with MSG_DONTWAIT
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, client_sock, &ev) < 0) {
+            log_message("NameServer", "Failed to register connection");
+            free_connection(conn);
+        }
+    }
+}
 
-int main() {
+int main(int argc, char* argv[]) {
     memset(&server_state, 0, sizeof(server_state));
-    pthread_mutex_init(&server_state.mutex, NULL);
+    init_locks();
     server_state.file_trie = trie_create();
     server_state.next_ss_id = 1;
-    
+    server_state.worker_count = NM_DEFAULT_WORKERS;
+    server_state.commit_interval_ms = GROUP_COMMIT_DEFAULT_INTERVAL_MS;
+    server_state.durability = DURABILITY_NORMAL;
+    server_state.flush_interval_ms = NM_DEFAULT_FLUSH_INTERVAL_MS;
+    server_state.lock_lease_seconds = NM_DEFAULT_LOCK_LEASE_SECONDS;
+    server_state.ss_timeout_seconds = NM_DEFAULT_SS_TIMEOUT_SECONDS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:i:d:f:l:t:")) != -1) {
+        switch (opt) {
+            case 'w':
+                server_state.worker_count = atoi(optarg);
+                break;
+            case 'i':
+                server_state.commit_interval_ms = atoi(optarg);
+                break;
+            case 'd':
+                if (parse_durability(optarg, &server_state.durability) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                server_state.flush_interval_ms = atoi(optarg);
+                break;
+            case 'l':
+                server_state.lock_lease_seconds = atoi(optarg);
+                break;
+            case 't':
+                server_state.ss_timeout_seconds = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (server_state.worker_count <= 0 || server_state.commit_interval_ms <= 0 ||
+        server_state.flush_interval_ms <= 0 || server_state.lock_lease_seconds <= 0 ||
+        server_state.ss_timeout_seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
     mkdir("data", 0755);
-    
+
     if (init_database() < 0) {
         log_message("NameServer", "Failed to initialize database");
         return 1;
     }
-    
-    load_files_from_db();
+
+    if (snapshot_load(NM_SNAPSHOT_PATH) < 0) {
+        load_files_from_db();
+        load_acl_from_db();
+    }
+    load_users_from_db();
+    if (group_commit_init(&server_state.commits, server_state.db,
+                          server_state.commit_interval_ms, server_state.durability) < 0) {
+        log_message("NameServer", "Failed to start group commit");
+        return 1;
+    }
+    if (timestamp_flusher_start() < 0) {
+        log_message("NameServer", "Failed to start timestamp flusher");
+        return 1;
+    }
+    if (lock_reaper_start() < 0) {
+        log_message("NameServer", "Failed to start lock reaper");
+        return 1;
+    }
+    if (failure_detector_start() < 0) {
+        log_message("NameServer", "Failed to start failure detector");
+        return 1;
+    }
     log_message("NameServer", "Name Server initialized successfully");
-    
+
     // Register signal handlers for graceful shutdown
     signal(SIGINT, handle_shutdown);
     signal(SIGTERM, handle_shutdown);
-    
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+
     int server_fd = create_server_socket(NM_PORT);
     if (server_fd < 0) {
         log_message("NameServer", "Failed to create server socket");
         return 1;
     }
-    
-    // Set socket timeout so accept() doesn't block indefinitely
-    struct timeval timeout;
-    timeout.tv_sec = 1;  // 1 second timeout
-    timeout.tv_usec = 0;
-    setsockopt(server_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+
+    int epfd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // NULL marks the listening socket
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        log_message("NameServer", "Failed to set up epoll");
+        return 1;
+    }
+
+    pthread_t* workers = malloc(sizeof(pthread_t) * server_state.worker_count);
+    for (int i = 0; i < server_state.worker_count; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) {
+            log_message("NameServer", "Failed to create worker thread");
+            return 1;
+        }
+    }
+
     char log_buf[128];
-    snprintf(log_buf, sizeof(log_buf), "Name Server listening on port %d", NM_PORT);
+    snprintf(log_buf, sizeof(log_buf), "Name Server listening on port %d (%d workers)",
+            NM_PORT, server_state.worker_count);
     log_message("NameServer", log_buf);
-    
+
+    size_t chunk_size = sizeof(WireHeader) + sizeof(Message);
+    char* chunk = malloc(chunk_size);
+    struct epoll_event events[NM_MAX_EVENTS];
+
     while (keep_running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        int client_sock = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
-        
-        if (client_sock < 0) {
-            // Timeout or error - check if we should continue
-            if (!keep_running) break;
-            continue;
-        }
-        
-        // Clear timeout on client socket (inherited from server socket)
-        struct timeval no_timeout;
-        no_timeout.tv_sec = 0;
-        no_timeout.tv_usec = 0;
-        setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof(no_timeout));
-        
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        snprintf(log_buf, sizeof(log_buf), "Connection from %s:%d", client_ip, ntohs(client_addr.sin_port));
-        log_message("NameServer", log_buf);
-        
-        pthread_t thread;
-        int* sock_ptr = malloc(sizeof(int));
-        *sock_ptr = client_sock;
-        
-        if (pthread_create(&thread, NULL, handle_client, sock_ptr) != 0) {
-            log_message("NameServer", "Failed to create thread");
-            free(sock_ptr);
-            close(client_sock);
-            continue;
+        // Timeout so a shutdown signal is noticed promptly
+        int n = epoll_wait(epfd, events, NM_MAX_EVENTS, 1000);
+
+        for (int i = 0; i < n; i++) {
+            NMConnection* conn = events[i].data.ptr;
+            if (!conn) {
+                accept_connections(epfd, server_fd);
+                continue;
+            }
+
+            int done = 0;
+            if (events[i].events & EPOLLIN) {
+                done = read_connection(conn, chunk, chunk_size) < 0;
+            }
+            if (done || (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                close_connection(epfd, conn);
+            }
         }
-        pthread_detach(thread);
     }
-    
+    log_message("NameServer", "Shutdown signal received, stopping server...");
+
+    pthread_mutex_lock(&work_mutex);
+    workers_stop = 1;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&work_mutex);
+    for (int i = 0; i < server_state.worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(chunk);
+
+    close(epfd);
     close(server_fd);
+    lock_reaper_stop();
+    failure_detector_stop();
+    timestamp_flusher_stop();
+    group_commit_shutdown(&server_state.commits);
+    // Everything is committed now; save the namespace for the next start
+    snapshot_save(NM_SNAPSHOT_PATH);
+    stmt_cache_finalize(nm_statements, NM_STMT_COUNT);
     sqlite3_close(server_state.db);
+    index_free();
+    users_free();
+    locks_free();
     trie_free(server_state.file_trie);
-    pthread_mutex_destroy(&server_state.mutex);
+    destroy_locks();
     return 0;
 }
 
-void* handle_client(void* arg) {
-    int client_sock = *(int*)arg;
-    free(arg);
-    
-    Message msg;
-    while (receive_message(client_sock, &msg) == 0) {
-        char log_buf[512];
-        snprintf(log_buf, sizeof(log_buf), "Request: type=%s user=%s file=%s", 
-                msg.type, msg.username, msg.filename);
-        log_message("NameServer", log_buf);
-        
-        if (strcmp(msg.type, MSG_REGISTER_SS) == 0) {
-            handle_register_ss(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_REGISTER_CLIENT) == 0) {
-            handle_register_client(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_CREATE) == 0) {
-            handle_create(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_READ) == 0 || strcmp(msg.type, MSG_STREAM) == 0 || strcmp(msg.type, MSG_INFO) == 0) {
-            handle_read(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_WRITE_LOCK) == 0 || strcmp(msg.type, MSG_WRITE) == 0) {
-            handle_write(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_WRITE_COMMIT) == 0) {
-            pthread_mutex_lock(&server_state.mutex);
-            int sentence_num;
-            sscanf(msg.data, "%d", &sentence_num);
-            release_lock(msg.filename, sentence_num, msg.username, client_sock);
-            
-            sqlite3_stmt* stmt;
-            sqlite3_prepare_v2(server_state.db, "UPDATE files SET modified_at = ? WHERE filename = ?;", -1, &stmt, NULL);
-            sqlite3_bind_int64(stmt, 1, time(NULL));
-            sqlite3_bind_text(stmt, 2, msg.filename, -1, SQLITE_STATIC);
-            sqlite3_step(stmt);
-            sqlite3_finalize(stmt);
-            
-            Message resp;
-            init_message(&resp);
-            resp.error_code = ERR_SUCCESS;
-            send_message(client_sock, &resp);
-            pthread_mutex_unlock(&server_state.mutex);
-        } else if (strcmp(msg.type, MSG_DELETE) == 0) {
-            handle_delete(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_VIEW) == 0) {
-            handle_view(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_LIST) == 0) {
-            handle_list(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_ADDACCESS) == 0) {
-            handle_addaccess(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_REMACCESS) == 0) {
-            handle_remaccess(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_UNDO) == 0) {
-            handle_undo(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_EXEC) == 0) {
-            handle_exec(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_CREATEFOLDER) == 0) {
-            handle_createfolder(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_CHECKPOINT) == 0) {
-            handle_checkpoint(client_sock, &msg);
-        } else if (strcmp(msg.type, MSG_REQUESTACCESS) == 0) {
-            handle_request_access(client_sock, &msg);
-        } else {
-            Message resp;
-            init_message(&resp);
-            set_message_error(&resp, ERR_INVALID_PARAM, "Unknown command");
-            send_message(client_sock, &resp);
-        }
+void dispatch_request(int client_sock, Message* msg) {
+    // Every storage server sends one a second; not worth a log line each
+    if (strcmp(msg->type, MSG_HEARTBEAT) == 0) {
+        handle_heartbeat(client_sock, msg);
+        return;
+    }
+
+    char log_buf[512];
+    snprintf(log_buf, sizeof(log_buf), "Request: type=%s user=%s file=%s",
+            msg->type, msg->username, msg->filename);
+    log_message("NameServer", log_buf);
+
+    if (strcmp(msg->type, MSG_REGISTER_SS) == 0) {
+        handle_register_ss(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_REGISTER_CLIENT) == 0) {
+        handle_register_client(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_CREATE) == 0) {
+        handle_create(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_READ) == 0 || strcmp(msg->type, MSG_STREAM) == 0 || strcmp(msg->type, MSG_INFO) == 0) {
+        handle_read(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_WRITE_LOCK) == 0 || strcmp(msg->type, MSG_WRITE) == 0) {
+        handle_write(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_WRITE_COMMIT) == 0 || strcmp(msg->type, MSG_WRITE_UNLOCK) == 0) {
+        handle_write_release(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_DELETE) == 0) {
+        handle_delete(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_VIEW) == 0) {
+        handle_view(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_SEARCH) == 0) {
+        handle_search(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_LIST) == 0) {
+        handle_list(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_ADDACCESS) == 0) {
+        handle_addaccess(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_REMACCESS) == 0) {
+        handle_remaccess(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_UNDO) == 0) {
+        handle_undo(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_EXEC) == 0) {
+        handle_exec(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_CREATEFOLDER) == 0) {
+        handle_createfolder(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_MOVE) == 0) {
+        handle_move(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_VIEWFOLDER) == 0) {
+        handle_viewfolder(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_CHECKPOINT) == 0) {
+        handle_checkpoint(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_REQUESTACCESS) == 0) {
+        handle_request_access(client_sock, msg);
+    } else if (strcmp(msg->type, MSG_MULTI) == 0) {
+        handle_multi(client_sock, msg);
+    } else {
+        Message resp;
+        init_response(&resp, msg);
+        set_message_error(&resp, ERR_INVALID_PARAM, "Unknown command");
+        send_message(client_sock, &resp);
     }
-    
-    close(client_sock);
-    return NULL;
 }
@@ -0,0 +1,494 @@
+#include "../../include/nameserver.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Binary snapshot of the in-memory namespace, in host byte order (it is only
+// ever read back by the machine that wrote it):
+//
+//   SnapshotHeader
+//   ss_count   x SnapshotServer
+//   file_count x SnapshotFile, each followed by its name, owner, storage path
+//                (only if it differs from the name) and access entries
+//                ({user_len, permissions, user}), padded to 8 bytes
+//
+// The checksum covers everything after the header. The trie is not stored
+// (its nodes are pointers); it is rebuilt from the names on a second thread
+// while the main one fills the hash tables.
+
+#define SNAPSHOT_MAGIC 0x534e4d4e   // "NMNS"
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;        // Must match the marker in nm_meta
+    uint64_t file_count;
+    uint64_t acl_count;
+    uint32_t ss_count;
+    int32_t next_ss_id;
+    uint64_t payload_bytes;
+    uint64_t checksum;
+} SnapshotHeader;
+
+typedef struct {
+    int32_t id;
+    int32_t port;
+    int32_t file_count;
+    int32_t reserved;
+    char ip[INET_ADDRSTRLEN];
+} SnapshotServer;
+
+typedef struct {
+    int64_t created_at;
+    int64_t modified_at;
+    int64_t accessed_at;
+    int32_t storage_server_id;
+    int32_t replica_server_id;
+    int32_t word_count;
+    int32_t char_count;
+    int32_t sentence_count;
+    uint32_t acl_count;
+    uint16_t name_len;
+    uint16_t owner_len;
+    uint16_t path_len;          // 0: stored under its name
+    uint8_t is_folder;
+    uint8_t reserved;
+} SnapshotFile;
+
+typedef struct {
+    FILE* f;
+    char* buf;                  // One record at a time
+    size_t cap;
+    uint64_t checksum;
+    uint64_t bytes;
+    uint64_t files;
+    uint64_t acls;
+} SnapshotWriter;
+
+static double elapsed_ms(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Multiply/xor mix a word at a time; len is a multiple of 8
+static uint64_t checksum_update(uint64_t h, const void* data, size_t len) {
+    const unsigned char* p = data;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+static size_t pad8(size_t len) {
+    return (len + 7) & ~(size_t)7;
+}
+
+// Marker rows live in nm_meta; a missing row means "no valid snapshot"
+static int read_marker(uint64_t* generation) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(server_state.db, "SELECT value FROM nm_meta WHERE key = 'snapshot';",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    int rc = -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        *generation = (uint64_t)sqlite3_column_int64(stmt, 0);
+        rc = 0;
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+static int write_marker(uint64_t generation) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(server_state.db, "INSERT OR REPLACE INTO nm_meta (key, value) VALUES ('snapshot', ?);",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)generation);
+    int rc = sqlite3_step(stmt) == SQLITE_DONE ? 0 : -1;
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+static int clear_marker() {
+    return sqlite3_exec(server_state.db, "DELETE FROM nm_meta WHERE key = 'snapshot';", 0, 0, NULL) == SQLITE_OK ? 0 : -1;
+}
+
+static int write_bytes(SnapshotWriter* w, const void* data, size_t len) {
+    w->checksum = checksum_update(w->checksum, data, len);
+    w->bytes += len;
+    return fwrite(data, 1, len, w->f) == len ? 0 : -1;
+}
+
+static int write_file(const FileEntry* entry, void* arg) {
+    SnapshotWriter* w = arg;
+    const FileMetadata* meta = &entry->meta;
+
+    SnapshotFile rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.created_at = meta->created_at;
+    rec.modified_at = meta->modified_at;
+    rec.accessed_at = meta->accessed_at;
+    rec.storage_server_id = meta->storage_server_id;
+    rec.replica_server_id = meta->replica_server_id;
+    rec.word_count = meta->word_count;
+    rec.char_count = meta->char_count;
+    rec.sentence_count = meta->sentence_count;
+    rec.is_folder = meta->is_folder;
+    rec.name_len = strlen(meta->filename);
+    rec.owner_len = strlen(meta->owner);
+    rec.path_len = strcmp(meta->path, meta->filename) != 0 ? strlen(meta->path) : 0;
+
+    size_t len = sizeof(rec) + rec.name_len + rec.owner_len + rec.path_len;
+    for (const AclEntry* acl = entry->acl; acl; acl = acl->next_in_file) {
+        rec.acl_count++;
+        len += 2 + strlen(acl->access.username);
+    }
+    len = pad8(len);
+
+    if (len > w->cap) {
+        char* buf = realloc(w->buf, len);
+        if (!buf) return -1;
+        w->buf = buf;
+        w->cap = len;
+    }
+    char* p = w->buf;
+    memcpy(p, &rec, sizeof(rec));
+    p += sizeof(rec);
+    memcpy(p, meta->filename, rec.name_len);
+    p += rec.name_len;
+    memcpy(p, meta->owner, rec.owner_len);
+    p += rec.owner_len;
+    memcpy(p, meta->path, rec.path_len);
+    p += rec.path_len;
+    for (const AclEntry* acl = entry->acl; acl; acl = acl->next_in_file) {
+        size_t user_len = strlen(acl->access.username);
+        *p++ = (char)user_len;
+        *p++ = (char)acl->access.permissions;
+        memcpy(p, acl->access.username, user_len);
+        p += user_len;
+    }
+    memset(p, 0, w->buf + len - p);
+
+    w->files++;
+    w->acls += rec.acl_count;
+    return write_bytes(w, w->buf, len);
+}
+
+int snapshot_save(const char* path) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char tmp_path[MAX_PATH];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    SnapshotWriter w;
+    memset(&w, 0, sizeof(w));
+    w.f = fopen(tmp_path, "wb");
+    if (!w.f) {
+        log_message("NameServer", "Failed to create namespace snapshot");
+        return -1;
+    }
+
+    // Header last, once the counts and checksum are known
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    int rc = fwrite(&header, sizeof(header), 1, w.f) == 1 ? 0 : -1;
+
+    for (int i = 0; i < server_state.ss_count && rc == 0; i++) {
+        const StorageServerInfo* ss = &server_state.storage_servers[i];
+        SnapshotServer rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.id = ss->id;
+        rec.port = ss->port;
+        rec.file_count = ss->file_count;
+        memcpy(rec.ip, ss->ip, sizeof(rec.ip));
+        rc = write_bytes(&w, &rec, sizeof(rec));
+    }
+    if (rc == 0) {
+        rc = index_for_each(write_file, &w);
+    }
+    free(w.buf);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.generation = ((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec) ^ ((uint64_t)getpid() << 48);
+    header.file_count = w.files;
+    header.acl_count = w.acls;
+    header.ss_count = server_state.ss_count;
+    header.next_ss_id = server_state.next_ss_id;
+    header.payload_bytes = w.bytes;
+    header.checksum = w.checksum;
+
+    if (rc == 0) {
+        rc = fseek(w.f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, w.f) == 1 &&
+             fflush(w.f) == 0 && fsync(fileno(w.f)) == 0 ? 0 : -1;
+    }
+    if (fclose(w.f) != 0) {
+        rc = -1;
+    }
+    // The file must be durable under its final name before the marker
+    // vouches for it
+    if (rc == 0 && rename(tmp_path, path) == 0) {
+        int dir = open("data", O_RDONLY);
+        if (dir >= 0) {
+            fsync(dir);
+            close(dir);
+        }
+        rc = write_marker(header.generation);
+    } else {
+        unlink(tmp_path);
+        rc = -1;
+    }
+
+    char log_buf[256];
+    if (rc == 0) {
+        snprintf(log_buf, sizeof(log_buf), "Saved namespace snapshot: %lu files, %lu access entries, %lu bytes in %.1f ms",
+                (unsigned long)w.files, (unsigned long)w.acls,
+                (unsigned long)(sizeof(header) + w.bytes), elapsed_ms(&start));
+    } else {
+        snprintf(log_buf, sizeof(log_buf), "Failed to write namespace snapshot");
+    }
+    log_message("NameServer", log_buf);
+    return rc;
+}
+
+// Splits off the file record at *p: its fixed part, its name, owner and
+// storage path (not NUL-terminated) and the start of its access entries.
+// Returns -1 if the record is malformed or runs past end.
+static int next_file(const char** p, const char* end, SnapshotFile* rec, const char** name, const char** acl) {
+    if ((size_t)(end - *p) < sizeof(*rec)) {
+        return -1;
+    }
+    memcpy(rec, *p, sizeof(*rec));
+    const char* q = *p + sizeof(*rec);
+    if (rec->name_len == 0 || rec->name_len >= MAX_FILENAME || rec->owner_len >= MAX_USERNAME ||
+        rec->path_len >= MAX_FILENAME || (size_t)(end - q) < (size_t)rec->name_len + rec->owner_len + rec->path_len) {
+        return -1;
+    }
+    *name = q;
+    q += rec->name_len + rec->owner_len + rec->path_len;
+    *acl = q;
+    for (uint32_t a = 0; a < rec->acl_count; a++) {
+        if (end - q < 2 || (unsigned char)q[0] >= MAX_USERNAME || end - q - 2 < (unsigned char)q[0]) {
+            return -1;
+        }
+        q += 2 + (unsigned char)q[0];
+    }
+    size_t len = pad8(q - *p);
+    if ((size_t)(end - *p) < len) {
+        return -1;
+    }
+    *p += len;
+    return 0;
+}
+
+typedef struct {
+    const char* files;          // First file record
+    const char* end;
+    uint64_t count;
+    Trie* trie;
+    int failed;
+} TrieBuild;
+
+// Runs beside the main load: the trie only needs the names
+static void* build_trie(void* arg) {
+    TrieBuild* build = arg;
+    const char* p = build->files;
+    char name[MAX_FILENAME];
+    for (uint64_t i = 0; i < build->count; i++) {
+        SnapshotFile rec;
+        const char* raw;
+        const char* acl;
+        if (next_file(&p, build->end, &rec, &raw, &acl) < 0) {
+            build->failed = 1;
+            break;
+        }
+        memcpy(name, raw, rec.name_len);
+        name[rec.name_len] = '\0';
+        trie_insert(build->trie, name);
+    }
+    return NULL;
+}
+
+// Bulk-load a mapped snapshot into the (empty) index and SS registry.
+// Returns a reason on failure, NULL on success.
+static const char* load_mapped(const char* map, size_t size, uint64_t generation) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        return "truncated";
+    }
+    memcpy(&header, map, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+        return "unknown format";
+    }
+    if (header.generation != generation) {
+        return "stale (database changed since it was written)";
+    }
+    if (header.payload_bytes != size - sizeof(header) || header.payload_bytes % 8 != 0) {
+        return "truncated";
+    }
+    const char* p = map + sizeof(header);
+    const char* end = map + size;
+    if (checksum_update(0, p, header.payload_bytes) != header.checksum) {
+        return "checksum mismatch";
+    }
+    if (header.ss_count > MAX_STORAGE_SERVERS ||
+        (size_t)(end - p) < header.ss_count * sizeof(SnapshotServer)) {
+        return "corrupt storage server table";
+    }
+
+    // Servers come back as registered but not alive until they reconnect
+    for (uint32_t i = 0; i < header.ss_count; i++) {
+        SnapshotServer rec;
+        memcpy(&rec, p, sizeof(rec));
+        p += sizeof(rec);
+        StorageServerInfo* ss = &server_state.storage_servers[i];
+        memset(ss, 0, sizeof(*ss));
+        ss->id = rec.id;
+        ss->port = rec.port;
+        ss->file_count = rec.file_count;
+        memcpy(ss->ip, rec.ip, sizeof(ss->ip));
+        ss->ip[INET_ADDRSTRLEN - 1] = '\0';
+    }
+    server_state.ss_count = header.ss_count;
+    server_state.next_ss_id = header.next_ss_id;
+
+    TrieBuild build = { p, end, header.file_count, trie_create(), 0 };
+    pthread_t trie_thread;
+    if (!build.trie || pthread_create(&trie_thread, NULL, build_trie, &build) != 0) {
+        trie_free(build.trie);
+        return "out of memory";
+    }
+
+    index_reserve(header.file_count, header.acl_count);
+
+    const char* error = NULL;
+    FileMetadata meta;
+    char username[MAX_USERNAME];
+    for (uint64_t i = 0; i < header.file_count && !error; i++) {
+        SnapshotFile rec;
+        const char* q;
+        const char* acl;
+        if (next_file(&p, end, &rec, &q, &acl) < 0) {
+            error = "corrupt file table";
+            break;
+        }
+
+        memset(&meta, 0, sizeof(meta));
+        memcpy(meta.filename, q, rec.name_len);
+        q += rec.name_len;
+        memcpy(meta.owner, q, rec.owner_len);
+        q += rec.owner_len;
+        memcpy(meta.path, q, rec.path_len);
+        meta.storage_server_id = rec.storage_server_id;
+        meta.replica_server_id = rec.replica_server_id;
+        meta.word_count = rec.word_count;
+        meta.char_count = rec.char_count;
+        meta.sentence_count = rec.sentence_count;
+        meta.created_at = rec.created_at;
+        meta.modified_at = rec.modified_at;
+        meta.accessed_at = rec.accessed_at;
+        meta.is_folder = rec.is_folder;
+        if (index_load_file(&meta) < 0) {
+            error = "out of memory";
+            break;
+        }
+
+        for (uint32_t a = 0; a < rec.acl_count; a++) {
+            size_t user_len = (unsigned char)acl[0];
+            int permissions = (unsigned char)acl[1];
+            memcpy(username, acl + 2, user_len);
+            username[user_len] = '\0';
+            acl += 2 + user_len;
+            index_set_permissions(meta.filename, username, permissions);
+        }
+    }
+    if (!error && p != end) {
+        error = "trailing data";
+    }
+
+    pthread_join(trie_thread, NULL);
+    if (!error && build.failed) {
+        error = "corrupt file table";
+    }
+    if (error) {
+        trie_free(build.trie);
+        return error;
+    }
+
+    pthread_rwlock_wrlock(&server_state.index_lock);
+    trie_free(server_state.file_trie);
+    server_state.file_trie = build.trie;
+    pthread_rwlock_unlock(&server_state.index_lock);
+
+    index_link_orphans();
+    return NULL;
+}
+
+int snapshot_load(const char* path) {
+    uint64_t generation;
+    // From here on the database may change under this snapshot, so it is
+    // never trusted again. If the marker cannot be cleared, don't use it.
+    if (read_marker(&generation) < 0) {
+        return -1;
+    }
+    if (clear_marker() < 0) {
+        log_message("NameServer", "Failed to clear snapshot marker, loading from database");
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_message("NameServer", "Namespace snapshot missing, loading from database");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+        close(fd);
+        log_message("NameServer", "Namespace snapshot truncated, loading from database");
+        return -1;
+    }
+    size_t size = st.st_size;
+    char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_message("NameServer", "Failed to map namespace snapshot, loading from database");
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    madvise(map, size, MADV_WILLNEED);
+
+    const char* error = load_mapped(map, size, generation);
+    munmap(map, size);
+
+    char log_buf[256];
+    if (error) {
+        // Undo a partial load so the database load starts from scratch
+        index_free();
+        trie_free(server_state.file_trie);
+        server_state.file_trie = trie_create();
+        memset(server_state.storage_servers, 0, sizeof(server_state.storage_servers));
+        server_state.ss_count = 0;
+        server_state.next_ss_id = 1;
+
+        snprintf(log_buf, sizeof(log_buf), "Namespace snapshot %s, loading from database", error);
+        log_message("NameServer", log_buf);
+        return -1;
+    }
+
+    snprintf(log_buf, sizeof(log_buf), "Loaded %lu files, %lu access entries and %d storage servers from snapshot in %.1f ms",
+            (unsigned long)server_state.file_total, (unsigned long)server_state.acl_total,
+            server_state.ss_count, elapsed_ms(&start));
+    log_message("NameServer", log_buf);
+    return 0;
+}
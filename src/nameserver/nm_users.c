@@ -0,0 +1,160 @@
+#include "../../include/nameserver.h"
+
+// Registered users: the users table, mirrored in a hash table keyed by name
+// so registering and granting never scan or query. LIST pages come straight
+// from the table's username index. Guarded by user_lock.
+
+// Caller holds user_lock
+static UserEntry* find_user(const char* username) {
+    if (!server_state.user_buckets) {
+        return NULL;
+    }
+    UserEntry* user = server_state.user_table[filename_hash(username) % server_state.user_buckets];
+    while (user && strcmp(user->info.username, username) != 0) {
+        user = user->next;
+    }
+    return user;
+}
+
+// Caller holds user_lock exclusively
+static void grow_user_table() {
+    size_t buckets = server_state.user_buckets ? server_state.user_buckets * 2 : NM_USER_TABLE_INITIAL;
+    UserEntry** table = calloc(buckets, sizeof(UserEntry*));
+    if (!table) {
+        return; // Keep the old table; chains just get longer
+    }
+
+    for (size_t i = 0; i < server_state.user_buckets; i++) {
+        UserEntry* user = server_state.user_table[i];
+        while (user) {
+            UserEntry* next = user->next;
+            size_t b = filename_hash(user->info.username) % buckets;
+            user->next = table[b];
+            table[b] = user;
+            user = next;
+        }
+    }
+
+    free(server_state.user_table);
+    server_state.user_table = table;
+    server_state.user_buckets = buckets;
+}
+
+// Caller holds user_lock exclusively
+static UserEntry* add_user(int id, const char* username, time_t registered_at) {
+    UserEntry* user = calloc(1, sizeof(UserEntry));
+    if (!user) {
+        return NULL;
+    }
+    user->id = id;
+    strncpy(user->info.username, username, MAX_USERNAME - 1);
+    user->info.registered_at = registered_at;
+
+    if (server_state.user_total >= server_state.user_buckets) {
+        grow_user_table();
+    }
+    size_t b = filename_hash(username) % server_state.user_buckets;
+    user->next = server_state.user_table[b];
+    server_state.user_table[b] = user;
+    server_state.user_total++;
+    return user;
+}
+
+int load_users_from_db() {
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT id, username, registered_at FROM users;";
+
+    if (sqlite3_prepare_v2(server_state.db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+
+    int count = 0;
+    pthread_rwlock_wrlock(&server_state.user_lock);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (add_user(sqlite3_column_int(stmt, 0), (const char*)sqlite3_column_text(stmt, 1),
+                     sqlite3_column_int64(stmt, 2))) {
+            count++;
+        }
+    }
+    pthread_rwlock_unlock(&server_state.user_lock);
+
+    sqlite3_finalize(stmt);
+
+    char log_buf[128];
+    snprintf(log_buf, sizeof(log_buf), "Loaded %d users from database", count);
+    log_message("NameServer", log_buf);
+
+    return 0;
+}
+
+int user_lookup(const char* username) {
+    pthread_rwlock_rdlock(&server_state.user_lock);
+    UserEntry* user = find_user(username);
+    int id = user ? user->id : 0;
+    pthread_rwlock_unlock(&server_state.user_lock);
+    return id;
+}
+
+int user_register(const char* username, int* created) {
+    *created = 0;
+    // Known users (every reconnect) never touch the database
+    int id = user_lookup(username);
+    if (id) {
+        return id;
+    }
+
+    group_commit_begin(&server_state.commits);
+    pthread_rwlock_wrlock(&server_state.user_lock);
+    UserEntry* user = find_user(username);
+    if (!user) {
+        time_t now = time(NULL);
+        CachedStmt* cs = &nm_statements[NM_STMT_INSERT_USER];
+        sqlite3_stmt* stmt = stmt_acquire(cs);
+        if (stmt) {
+            sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 2, now);
+            // Writes are serialized by the commits mutex, so the rowid is ours
+            if (sqlite3_step(stmt) == SQLITE_DONE) {
+                user = add_user((int)sqlite3_last_insert_rowid(server_state.db), username, now);
+                *created = user != NULL;
+            }
+            stmt_release(cs);
+        }
+    }
+    id = user ? user->id : -1;
+    pthread_rwlock_unlock(&server_state.user_lock);
+    group_commit_end(&server_state.commits);
+    return id;
+}
+
+void user_forget(const char* username) {
+    pthread_rwlock_wrlock(&server_state.user_lock);
+    if (server_state.user_buckets) {
+        UserEntry** link = &server_state.user_table[filename_hash(username) % server_state.user_buckets];
+        while (*link && strcmp((*link)->info.username, username) != 0) {
+            link = &(*link)->next;
+        }
+        if (*link) {
+            UserEntry* user = *link;
+            *link = user->next;
+            free(user);
+            server_state.user_total--;
+        }
+    }
+    pthread_rwlock_unlock(&server_state.user_lock);
+}
+
+void users_free() {
+    for (size_t i = 0; i < server_state.user_buckets; i++) {
+        UserEntry* user = server_state.user_table[i];
+        while (user) {
+            UserEntry* next = user->next;
+            free(user);
+            user = next;
+        }
+    }
+    free(server_state.user_table);
+    server_state.user_table = NULL;
+    server_state.user_buckets = 0;
+    server_state.user_total = 0;
+}
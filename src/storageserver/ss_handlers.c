@@ -17,52 +17,62 @@ static int validate_basic_request(Message* msg) {
     return 1;
 }
 
+// Handlers take the file's lock (shared to read, exclusive to modify), touch
+// the metadata database only under db_mutex, and reply after releasing both.
+
 void handle_create(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Validate request
     if (!validate_basic_request(msg)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "Invalid request parameters");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
-    char* path = get_file_path(msg->filename);
+    FileLock* lock = acquire_file_lock(msg->filename, 1);
+    
+    char path[MAX_PATH];
+    get_file_path(msg->filename, path, sizeof(path));
     
     // Check if file already exists
     if (access(path, F_OK) == 0) {
+        release_file_lock(lock);
         set_message_error(&resp, ERR_FILE_EXISTS, "File already exists");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
     // Create empty file
     FILE* fp = fopen(path, "w");
     if (!fp) {
+        release_file_lock(lock);
         set_message_error(&resp, ERR_SERVER_ERROR, "Failed to create file");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     fclose(fp);
+    // Empty, so bytes_stored stays as it is until the first write
     
     // Initialize metadata
-    sqlite3_stmt* stmt;
-    const char* sql = "INSERT INTO file_metadata (filename, word_count, char_count, sentence_count, last_modified) "
-                     "VALUES (?, 0, 0, 0, ?);";
+    CachedStmt* cs = &ss_statements[SS_STMT_INSERT_METADATA];
     
-    if (sqlite3_prepare_v2(ss_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    pthread_mutex_lock(&ss_state.db_mutex);
+    group_commit_begin(&ss_state.commits);
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    if (stmt) {
         sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
         sqlite3_bind_int64(stmt, 2, time(NULL));
         sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     }
+    group_commit_end(&ss_state.commits);
+    pthread_mutex_unlock(&ss_state.db_mutex);
     
+    release_file_lock(lock);
+    
+    group_commit_wait(&ss_state.commits);
     resp.error_code = ERR_SUCCESS;
     strcpy(resp.data, "File created");
     send_message(sock, &resp);
@@ -70,55 +80,48 @@ void handle_create(int sock, Message* msg) {
     char log_buf[256];
     snprintf(log_buf, sizeof(log_buf), "File created: %s", msg->filename);
     log_message("StorageServer", log_buf);
-    
-    pthread_mutex_unlock(&ss_state.mutex);
 }
 
 void handle_read(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Validate request
     if (!validate_basic_request(msg)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "Invalid request parameters");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
     char content[BUFFER_SIZE];
+    FileLock* lock = acquire_file_lock(msg->filename, 0);
     int result = load_file_content(msg->filename, content, sizeof(content));
+    release_file_lock(lock);
     
     if (result < 0) {
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "Failed to read file");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
     resp.error_code = ERR_SUCCESS;
     strncpy(resp.data, content, sizeof(resp.data) - 1);
     send_message(sock, &resp);
-    
-    pthread_mutex_unlock(&ss_state.mutex);
 }
 
 void handle_write(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Validate request
     if (!validate_basic_request(msg)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "Invalid request parameters");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
+    FileLock* lock = acquire_file_lock(msg->filename, 1);
+    
     // Parse: sentence_num|word_idx|new_content or just new content for full write
     int sentence_num = -1, word_idx = -1;
     char new_content[BUFFER_SIZE] = {0};
@@ -128,23 +131,30 @@ void handle_write(int sock, Message* msg) {
         // Word-level edit
         char current_content[BUFFER_SIZE];
         if (load_file_content(msg->filename, current_content, sizeof(current_content)) < 0) {
+            release_file_lock(lock);
             set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
             send_message(sock, &resp);
-            pthread_mutex_unlock(&ss_state.mutex);
             return;
         }
         
         // Save undo state
         save_undo_state(msg->filename, current_content);
         
-        // Parse sentences
-        char sentences[MAX_SENTENCES][MAX_SENTENCE];
+        // Parse sentences (heap: the table is ~1MB, too large for a worker stack)
+        char (*sentences)[MAX_SENTENCE] = malloc(MAX_SENTENCES * sizeof(*sentences));
+        if (!sentences) {
+            release_file_lock(lock);
+            set_message_error(&resp, ERR_SERVER_ERROR, "Out of memory");
+            send_message(sock, &resp);
+            return;
+        }
         int sentence_count = parse_sentences(current_content, sentences, MAX_SENTENCES);
         
         if (sentence_num < 0 || sentence_num >= sentence_count) {
+            free(sentences);
+            release_file_lock(lock);
             set_message_error(&resp, ERR_INVALID_PARAM, "Invalid sentence number");
             send_message(sock, &resp);
-            pthread_mutex_unlock(&ss_state.mutex);
             return;
         }
         
@@ -153,9 +163,10 @@ void handle_write(int sock, Message* msg) {
         int word_count = parse_words(sentences[sentence_num], words, MAX_WORDS_PER_SENTENCE);
         
         if (word_idx < 0 || word_idx >= word_count) {
+            free(sentences);
+            release_file_lock(lock);
             set_message_error(&resp, ERR_INVALID_PARAM, "Invalid word index");
             send_message(sock, &resp);
-            pthread_mutex_unlock(&ss_state.mutex);
             return;
         }
         
@@ -176,6 +187,7 @@ void handle_write(int sock, Message* msg) {
             if (i > 0) strcat(final_content, " ");
             strcat(final_content, sentences[i]);
         }
+        free(sentences);
         
         save_file_content(msg->filename, final_content);
     } else {
@@ -188,6 +200,9 @@ void handle_write(int sock, Message* msg) {
         save_file_content(msg->filename, msg->data);
     }
     
+    release_file_lock(lock);
+    
+    group_commit_wait(&ss_state.commits);
     resp.error_code = ERR_SUCCESS;
     strcpy(resp.data, "Write successful");
     send_message(sock, &resp);
@@ -195,45 +210,55 @@ void handle_write(int sock, Message* msg) {
     char log_buf[256];
     snprintf(log_buf, sizeof(log_buf), "File written: %s", msg->filename);
     log_message("StorageServer", log_buf);
-    
-    pthread_mutex_unlock(&ss_state.mutex);
 }
 
 void handle_delete(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Validate request
     if (!validate_basic_request(msg)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "Invalid request parameters");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
-    char* path = get_file_path(msg->filename);
+    FileLock* lock = acquire_file_lock(msg->filename, 1);
+    
+    char path[MAX_PATH];
+    get_file_path(msg->filename, path, sizeof(path));
     
+    struct stat st;
+    long long size = stat(path, &st) == 0 ? (long long)st.st_size : 0;
     if (unlink(path) < 0) {
+        release_file_lock(lock);
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "Failed to delete file");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
+    add_stored_bytes(-size);
     
     // Delete metadata
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(ss_state.db, "DELETE FROM file_metadata WHERE filename = ?;", -1, &stmt, NULL);
-    sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    CachedStmt* cs = &ss_statements[SS_STMT_DELETE_METADATA];
+    pthread_mutex_lock(&ss_state.db_mutex);
+    group_commit_begin(&ss_state.commits);
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    if (stmt) {
+        sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
+        sqlite3_step(stmt);
+        stmt_release(cs);
+    }
+    group_commit_end(&ss_state.commits);
+    pthread_mutex_unlock(&ss_state.db_mutex);
     
     // Delete undo state
     char undo_path[MAX_PATH];
     snprintf(undo_path, sizeof(undo_path), "%s/undo/%s", ss_state.data_dir, msg->filename);
     unlink(undo_path);
     
+    release_file_lock(lock);
+    
+    group_commit_wait(&ss_state.commits);
     resp.error_code = ERR_SUCCESS;
     strcpy(resp.data, "File deleted");
     send_message(sock, &resp);
@@ -241,31 +266,28 @@ void handle_delete(int sock, Message* msg) {
     char log_buf[256];
     snprintf(log_buf, sizeof(log_buf), "File deleted: %s", msg->filename);
     log_message("StorageServer", log_buf);
-    
-    pthread_mutex_unlock(&ss_state.mutex);
 }
 
 void handle_stream(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Validate request
     if (!validate_basic_request(msg)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "Invalid request parameters");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
+    // Stream from a snapshot so writers are not held off for the whole stream
     char content[BUFFER_SIZE];
+    FileLock* lock = acquire_file_lock(msg->filename, 0);
     int result = load_file_content(msg->filename, content, sizeof(content));
+    release_file_lock(lock);
     
     if (result < 0) {
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "Failed to read file");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
@@ -275,7 +297,11 @@ void handle_stream(int sock, Message* msg) {
     send_message(sock, &resp);
     
     // Parse words and stream them
-    char sentences[MAX_SENTENCES][MAX_SENTENCE];
+    char (*sentences)[MAX_SENTENCE] = malloc(MAX_SENTENCES * sizeof(*sentences));
+    if (!sentences) {
+        log_message("StorageServer", "Stream aborted: out of memory");
+        return;
+    }
     int sentence_count = parse_sentences(content, sentences, MAX_SENTENCES);
     
     for (int i = 0; i < sentence_count; i++) {
@@ -284,52 +310,49 @@ void handle_stream(int sock, Message* msg) {
         
         for (int j = 0; j < word_count; j++) {
             Message word_msg;
-            init_message(&word_msg);
-            strcpy(word_msg.type, "STREAM_WORD");
+            init_response(&word_msg, msg);
+            strcpy(word_msg.type, MSG_STREAM_WORD);
             strcpy(word_msg.data, words[j]);
             
             if (send_message(sock, &word_msg) < 0) {
                 log_message("StorageServer", "Stream interrupted");
-                pthread_mutex_unlock(&ss_state.mutex);
+                free(sentences);
                 return;
             }
             
             usleep(100000); // 0.1 second delay
         }
     }
+    free(sentences);
     
     // Send end marker
     Message end_msg;
-    init_message(&end_msg);
-    strcpy(end_msg.type, "STREAM_END");
+    init_response(&end_msg, msg);
+    strcpy(end_msg.type, MSG_STREAM_END);
     send_message(sock, &end_msg);
     
     char log_buf[256];
     snprintf(log_buf, sizeof(log_buf), "File streamed: %s", msg->filename);
     log_message("StorageServer", log_buf);
-    
-    pthread_mutex_unlock(&ss_state.mutex);
 }
 
 void handle_info(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Validate request
     if (!validate_basic_request(msg)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "Invalid request parameters");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
     // Get metadata from database
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT word_count, char_count, sentence_count, last_modified FROM file_metadata WHERE filename = ?;";
+    CachedStmt* cs = &ss_statements[SS_STMT_FILE_INFO];
     
-    if (sqlite3_prepare_v2(ss_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    pthread_mutex_lock(&ss_state.db_mutex);
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    if (stmt) {
         sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
         
         if (sqlite3_step(stmt) == SQLITE_ROW) {
@@ -339,45 +362,45 @@ void handle_info(int sock, Message* msg) {
             time_t modified = sqlite3_column_int64(stmt, 3);
             
             char time_str[64];
-            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&modified));
+            struct tm tm_info;
+            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime_r(&modified, &tm_info));
             
             resp.error_code = ERR_SUCCESS;
-            snprintf(resp.data, sizeof(resp.data), 
+            snprintf(resp.data, sizeof(resp.data),
                     "Words: %d | Characters: %d | Sentences: %d | Modified: %s",
                     word_count, char_count, sentence_count, time_str);
         } else {
             set_message_error(&resp, ERR_FILE_NOT_FOUND, "File metadata not found");
         }
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     } else {
         set_message_error(&resp, ERR_SERVER_ERROR, "Database error");
     }
+    pthread_mutex_unlock(&ss_state.db_mutex);
     
     send_message(sock, &resp);
-    pthread_mutex_unlock(&ss_state.mutex);
 }
 
 void handle_undo(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Validate request
     if (!validate_basic_request(msg)) {
         set_message_error(&resp, ERR_PERMISSION_DENIED, "Invalid request parameters");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
+    FileLock* lock = acquire_file_lock(msg->filename, 1);
+    
     char undo_content[BUFFER_SIZE];
     int result = load_undo_state(msg->filename, undo_content, sizeof(undo_content));
     
     if (result < 0) {
+        release_file_lock(lock);
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "No undo history available");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
@@ -397,18 +420,21 @@ void handle_undo(int sock, Message* msg) {
         set_message_error(&resp, ERR_FILE_NOT_FOUND, "Current file not found");
     }
     
+    release_file_lock(lock);
+    group_commit_wait(&ss_state.commits);
     send_message(sock, &resp);
-    pthread_mutex_unlock(&ss_state.mutex);
 }
 
 void handle_replicate(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Save replicated content
-    if (save_file_content(msg->filename, msg->data) < 0) {
+    FileLock* lock = acquire_file_lock(msg->filename, 1);
+    int result = save_file_content(msg->filename, msg->data);
+    release_file_lock(lock);
+    
+    if (result < 0) {
         set_message_error(&resp, ERR_SERVER_ERROR, "Replication failed");
     } else {
         resp.error_code = ERR_SUCCESS;
@@ -419,32 +445,31 @@ void handle_replicate(int sock, Message* msg) {
         log_message("StorageServer", log_buf);
     }
     
+    group_commit_wait(&ss_state.commits);
     send_message(sock, &resp);
-    pthread_mutex_unlock(&ss_state.mutex);
 }
 
 void handle_checkpoint_ops(int sock, Message* msg) {
-    pthread_mutex_lock(&ss_state.mutex);
-    
     Message resp;
-    init_message(&resp);
+    init_response(&resp, msg);
     
     // Parse command from data: CREATE|tag or LIST or REVERT|tag
     char cmd[32], tag[64];
     if (sscanf(msg->data, "%[^|]|%s", cmd, tag) < 1) {
         set_message_error(&resp, ERR_INVALID_PARAM, "Invalid checkpoint command");
         send_message(sock, &resp);
-        pthread_mutex_unlock(&ss_state.mutex);
         return;
     }
     
     if (strcmp(cmd, "CREATE") == 0) {
+        FileLock* lock = acquire_file_lock(msg->filename, 0);
+        
         // Load current content
         char content[BUFFER_SIZE];
         if (load_file_content(msg->filename, content, sizeof(content)) < 0) {
+            release_file_lock(lock);
             set_message_error(&resp, ERR_FILE_NOT_FOUND, "File not found");
             send_message(sock, &resp);
-            pthread_mutex_unlock(&ss_state.mutex);
             return;
         }
         
@@ -460,28 +485,34 @@ void handle_checkpoint_ops(int sock, Message* msg) {
             fclose(fp);
             
             // Save to database
-            sqlite3_stmt* stmt;
-            const char* sql = "INSERT INTO checkpoints (filename, tag, checkpoint_file, created_at) VALUES (?, ?, ?, ?);";
-            if (sqlite3_prepare_v2(ss_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+            CachedStmt* cs = &ss_statements[SS_STMT_INSERT_CHECKPOINT];
+            pthread_mutex_lock(&ss_state.db_mutex);
+            group_commit_begin(&ss_state.commits);
+            sqlite3_stmt* stmt = stmt_acquire(cs);
+            if (stmt) {
                 sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
                 sqlite3_bind_text(stmt, 2, tag, -1, SQLITE_STATIC);
                 sqlite3_bind_text(stmt, 3, checkpoint_file, -1, SQLITE_STATIC);
                 sqlite3_bind_int64(stmt, 4, time(NULL));
                 sqlite3_step(stmt);
-                sqlite3_finalize(stmt);
+                stmt_release(cs);
             }
+            group_commit_end(&ss_state.commits);
+            pthread_mutex_unlock(&ss_state.db_mutex);
             
             resp.error_code = ERR_SUCCESS;
             snprintf(resp.data, sizeof(resp.data), "Checkpoint '%s' created", tag);
         } else {
             set_message_error(&resp, ERR_SERVER_ERROR, "Failed to create checkpoint");
         }
+        release_file_lock(lock);
     }
     else if (strcmp(cmd, "LIST") == 0) {
-        sqlite3_stmt* stmt;
-        const char* sql = "SELECT tag, created_at FROM checkpoints WHERE filename = ? ORDER BY created_at DESC;";
+        CachedStmt* cs = &ss_statements[SS_STMT_LIST_CHECKPOINTS];
         
-        if (sqlite3_prepare_v2(ss_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        pthread_mutex_lock(&ss_state.db_mutex);
+        sqlite3_stmt* stmt = stmt_acquire(cs);
+        if (stmt) {
             sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
             
             char result[BUFFER_SIZE] = "Checkpoints:\n";
@@ -489,7 +520,8 @@ void handle_checkpoint_ops(int sock, Message* msg) {
                 const char* cp_tag = (const char*)sqlite3_column_text(stmt, 0);
                 time_t created = sqlite3_column_int64(stmt, 1);
                 char time_str[64];
-                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&created));
+                struct tm tm_info;
+                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime_r(&created, &tm_info));
                 
                 char line[256];
                 snprintf(line, sizeof(line), "  %s - %s\n", cp_tag, time_str);
@@ -500,52 +532,62 @@ void handle_checkpoint_ops(int sock, Message* msg) {
             
             resp.error_code = ERR_SUCCESS;
             strncpy(resp.data, result, sizeof(resp.data) - 1);
-            sqlite3_finalize(stmt);
+            stmt_release(cs);
         }
+        pthread_mutex_unlock(&ss_state.db_mutex);
     }
     else if (strcmp(cmd, "REVERT") == 0) {
         // Find checkpoint
-        sqlite3_stmt* stmt;
-        const char* sql = "SELECT checkpoint_file FROM checkpoints WHERE filename = ? AND tag = ?;";
+        CachedStmt* cs = &ss_statements[SS_STMT_FIND_CHECKPOINT];
+        char checkpoint_file[MAX_FILENAME] = "";
         
-        if (sqlite3_prepare_v2(ss_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        pthread_mutex_lock(&ss_state.db_mutex);
+        sqlite3_stmt* stmt = stmt_acquire(cs);
+        if (stmt) {
             sqlite3_bind_text(stmt, 1, msg->filename, -1, SQLITE_STATIC);
             sqlite3_bind_text(stmt, 2, tag, -1, SQLITE_STATIC);
             
             if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char* checkpoint_file = (const char*)sqlite3_column_text(stmt, 0);
-                char checkpoint_path[MAX_PATH];
-                snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/checkpoints/%s", ss_state.data_dir, checkpoint_file);
+                strncpy(checkpoint_file, (const char*)sqlite3_column_text(stmt, 0), sizeof(checkpoint_file) - 1);
+            } else {
+                set_message_error(&resp, ERR_CHECKPOINT_NOT_FOUND, "Checkpoint not found");
+            }
+            stmt_release(cs);
+        }
+        pthread_mutex_unlock(&ss_state.db_mutex);
+        
+        if (checkpoint_file[0]) {
+            char checkpoint_path[MAX_PATH];
+            snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/checkpoints/%s", ss_state.data_dir, checkpoint_file);
+            
+            // Load checkpoint content
+            char content[BUFFER_SIZE];
+            FILE* fp = fopen(checkpoint_path, "r");
+            if (fp) {
+                size_t read = fread(content, 1, sizeof(content) - 1, fp);
+                content[read] = '\0';
+                fclose(fp);
+                
+                FileLock* lock = acquire_file_lock(msg->filename, 1);
                 
-                // Load checkpoint content
-                char content[BUFFER_SIZE];
-                FILE* fp = fopen(checkpoint_path, "r");
-                if (fp) {
-                    size_t read = fread(content, 1, sizeof(content) - 1, fp);
-                    content[read] = '\0';
-                    fclose(fp);
-                    
-                    // Save current as undo before reverting
-                    char current[BUFFER_SIZE];
-                    if (load_file_content(msg->filename, current, sizeof(current)) >= 0) {
-                        save_undo_state(msg->filename, current);
-                    }
-                    
-                    // Revert to checkpoint
-                    save_file_content(msg->filename, content);
-                    
-                    resp.error_code = ERR_SUCCESS;
-                    snprintf(resp.data, sizeof(resp.data), "Reverted to checkpoint '%s'", tag);
-                } else {
-                    set_message_error(&resp, ERR_CHECKPOINT_NOT_FOUND, "Checkpoint file not found");
+                // Save current as undo before reverting
+                char current[BUFFER_SIZE];
+                if (load_file_content(msg->filename, current, sizeof(current)) >= 0) {
+                    save_undo_state(msg->filename, current);
                 }
+                
+                // Revert to checkpoint
+                save_file_content(msg->filename, content);
+                release_file_lock(lock);
+                
+                resp.error_code = ERR_SUCCESS;
+                snprintf(resp.data, sizeof(resp.data), "Reverted to checkpoint '%s'", tag);
             } else {
-                set_message_error(&resp, ERR_CHECKPOINT_NOT_FOUND, "Checkpoint not found");
+                set_message_error(&resp, ERR_CHECKPOINT_NOT_FOUND, "Checkpoint file not found");
             }
-            sqlite3_finalize(stmt);
         }
     }
     
+    group_commit_wait(&ss_state.commits);
     send_message(sock, &resp);
-    pthread_mutex_unlock(&ss_state.mutex);
 }
@@ -0,0 +1,58 @@
+#include "../../include/storageserver.h"
+
+static unsigned int lock_bucket(const char* filename) {
+    unsigned long hash = 5381;
+    for (const char* p = filename; *p; p++) {
+        hash = hash * 33 + (unsigned char)*p;
+    }
+    return hash % SS_LOCK_BUCKETS;
+}
+
+FileLock* acquire_file_lock(const char* filename, int exclusive) {
+    unsigned int bucket = lock_bucket(filename);
+    
+    pthread_mutex_lock(&ss_state.lock_table_mutex);
+    FileLock* lock = ss_state.file_locks[bucket];
+    while (lock && strcmp(lock->filename, filename) != 0) {
+        lock = lock->next;
+    }
+    if (!lock) {
+        lock = calloc(1, sizeof(FileLock));
+        if (!lock) {
+            pthread_mutex_unlock(&ss_state.lock_table_mutex);
+            return NULL;
+        }
+        strncpy(lock->filename, filename, MAX_FILENAME - 1);
+        pthread_rwlock_init(&lock->rwlock, NULL);
+        lock->next = ss_state.file_locks[bucket];
+        ss_state.file_locks[bucket] = lock;
+    }
+    // Count waiters too, so the entry cannot be freed while we block on it
+    lock->refcount++;
+    pthread_mutex_unlock(&ss_state.lock_table_mutex);
+    
+    if (exclusive) {
+        pthread_rwlock_wrlock(&lock->rwlock);
+    } else {
+        pthread_rwlock_rdlock(&lock->rwlock);
+    }
+    return lock;
+}
+
+void release_file_lock(FileLock* lock) {
+    if (!lock) return;
+    
+    pthread_rwlock_unlock(&lock->rwlock);
+    
+    pthread_mutex_lock(&ss_state.lock_table_mutex);
+    if (--lock->refcount == 0) {
+        FileLock** link = &ss_state.file_locks[lock_bucket(lock->filename)];
+        while (*link != lock) {
+            link = &(*link)->next;
+        }
+        *link = lock->next;
+        pthread_rwlock_destroy(&lock->rwlock);
+        free(lock);
+    }
+    pthread_mutex_unlock(&ss_state.lock_table_mutex);
+}
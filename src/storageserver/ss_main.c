@@ -1,21 +1,275 @@
 #include "../../include/storageserver.h"
+#include <sys/statvfs.h>
+#include <poll.h>
 
 StorageServerState ss_state;
+
+CachedStmt ss_statements[SS_STMT_COUNT] = {
+    [SS_STMT_INSERT_METADATA] = {
+        .sql = "INSERT INTO file_metadata (filename, word_count, char_count, sentence_count, last_modified) "
+               "VALUES (?, 0, 0, 0, ?);" },
+    [SS_STMT_SAVE_METADATA] = {
+        .sql = "INSERT OR REPLACE INTO file_metadata (filename, word_count, char_count, sentence_count, last_modified) "
+               "VALUES (?, ?, ?, ?, ?);" },
+    [SS_STMT_DELETE_METADATA] = { .sql = "DELETE FROM file_metadata WHERE filename = ?;" },
+    [SS_STMT_FILE_INFO] = {
+        .sql = "SELECT word_count, char_count, sentence_count, last_modified FROM file_metadata WHERE filename = ?;" },
+    [SS_STMT_INSERT_CHECKPOINT] = {
+        .sql = "INSERT INTO checkpoints (filename, tag, checkpoint_file, created_at) VALUES (?, ?, ?, ?);" },
+    [SS_STMT_LIST_CHECKPOINTS] = {
+        .sql = "SELECT tag, created_at FROM checkpoints WHERE filename = ? ORDER BY created_at DESC;" },
+    [SS_STMT_FIND_CHECKPOINT] = {
+        .sql = "SELECT checkpoint_file FROM checkpoints WHERE filename = ? AND tag = ?;" },
+};
 volatile sig_atomic_t keep_running = 1;
 
 void handle_shutdown(int sig) {
     (void)sig; // Unused parameter
+    // Only the flag: the signal can land on any thread, including one
+    // holding the allocator or a SQLite lock, so logging waits for main
     keep_running = 0;
-    log_message("StorageServer", "Shutdown signal received, stopping server...");
+}
+
+static void usage(const char* prog) {
+    printf("Usage: %s <port> [-w workers] [-q queue_size] [-i commit_interval_ms] [-d full|normal|async]\n", prog);
+}
+
+static void log_pool_stats(const char* event) {
+    char log_buf[256];
+    pthread_mutex_lock(&ss_state.queue_mutex);
+    snprintf(log_buf, sizeof(log_buf),
+            "%s: queue depth %d/%d (high water %d), accepted %lu, rejected %lu",
+            event, ss_state.queue_depth, ss_state.queue_capacity, ss_state.queue_high_water,
+            ss_state.accepted_total, ss_state.rejected_total);
+    pthread_mutex_unlock(&ss_state.queue_mutex);
+    log_message("StorageServer", log_buf);
+}
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&ss_state.queue_mutex);
+        while (ss_state.queue_depth == 0) {
+            pthread_cond_wait(&ss_state.queue_cond, &ss_state.queue_mutex);
+        }
+        int client_sock = ss_state.conn_queue[ss_state.queue_head];
+        ss_state.queue_head = (ss_state.queue_head + 1) % ss_state.queue_capacity;
+        ss_state.queue_depth--;
+        pthread_mutex_unlock(&ss_state.queue_mutex);
+
+        handle_client(client_sock);
+    }
+    return NULL;
+}
+
+// Documents are the regular files at the top of data_dir other than the
+// metadata database; undo and checkpoint copies live in subdirectories.
+// Scanned once at startup, then kept current by add_stored_bytes.
+static unsigned long long count_stored_bytes() {
+    unsigned long long total = 0;
+    DIR* dir = opendir(ss_state.data_dir);
+    if (!dir) {
+        return 0;
+    }
+    struct dirent* entry;
+    struct stat st;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, "metadata.db") == 0 ||
+            strcmp(entry->d_name, "metadata.db-wal") == 0 ||
+            strcmp(entry->d_name, "metadata.db-shm") == 0 ||
+            strcmp(entry->d_name, "metadata.db-journal") == 0) {
+            continue;
+        }
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode)) {
+            total += st.st_size;
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+void add_stored_bytes(long long delta) {
+    pthread_mutex_lock(&ss_state.stats_mutex);
+    ss_state.bytes_stored += delta;
+    pthread_mutex_unlock(&ss_state.stats_mutex);
+}
+
+// Heartbeats go out on the registration connection. If the Name Server
+// closed it (it restarted, or is gone), register again on the next beat
+// so a restarted one routes to this server without an operator stepping in.
+static void* heartbeat_main(void* arg) {
+    (void)arg;
+    Message msg;
+    unsigned long last_requests = 0;
+    unsigned long long last_request_us = 0;
+    struct timespec last_beat;
+    clock_gettime(CLOCK_MONOTONIC, &last_beat);
+    while (keep_running) {
+        sleep(SS_HEARTBEAT_INTERVAL_SECONDS);
+        
+        if (ss_state.nm_socket >= 0) {
+            // The Name Server never writes here, so readable means closed
+            char byte;
+            if (recv(ss_state.nm_socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+                log_message("StorageServer", "Lost Name Server connection, registering again");
+                close(ss_state.nm_socket);
+                ss_state.nm_socket = -1;
+            }
+        }
+        if (ss_state.nm_socket < 0 && register_with_nameserver() < 0) {
+            ss_state.nm_socket = -1;
+            continue;
+        }
+        
+        // Rate and mean latency over the requests since the last beat
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        pthread_mutex_lock(&ss_state.stats_mutex);
+        unsigned long requests = ss_state.requests_total - last_requests;
+        unsigned long long request_us = ss_state.request_us_total - last_request_us;
+        last_requests = ss_state.requests_total;
+        last_request_us = ss_state.request_us_total;
+        unsigned long long used_bytes = ss_state.bytes_stored;
+        pthread_mutex_unlock(&ss_state.stats_mutex);
+        long elapsed_ms = (now.tv_sec - last_beat.tv_sec) * 1000 + (now.tv_nsec - last_beat.tv_nsec) / 1000000;
+        last_beat = now;
+        int rate = elapsed_ms > 0 ? (int)(requests * 1000 / elapsed_ms) : 0;
+        int latency_us = requests > 0 ? (int)(request_us / requests) : 0;
+        
+        unsigned long long free_bytes = 0;
+        struct statvfs fs;
+        if (statvfs(ss_state.data_dir, &fs) == 0) {
+            free_bytes = (unsigned long long)fs.f_bavail * fs.f_frsize;
+        }
+        
+        init_message(&msg);
+        strcpy(msg.type, MSG_HEARTBEAT);
+        snprintf(msg.data, sizeof(msg.data), "SS_ID:%d|USED:%llu|FREE:%llu|RPS:%d|LAT_US:%d",
+                 ss_state.ss_id, used_bytes, free_bytes, rate, latency_us);
+        if (send_message(ss_state.nm_socket, &msg) < 0) {
+            close(ss_state.nm_socket);
+            ss_state.nm_socket = -1;
+        }
+    }
+    return NULL;
+}
+
+// Queue an accepted socket for the pool; returns -1 if the queue is full
+static int enqueue_connection(int client_sock) {
+    pthread_mutex_lock(&ss_state.queue_mutex);
+    if (ss_state.queue_depth == ss_state.queue_capacity) {
+        ss_state.rejected_total++;
+        pthread_mutex_unlock(&ss_state.queue_mutex);
+        return -1;
+    }
+    int tail = (ss_state.queue_head + ss_state.queue_depth) % ss_state.queue_capacity;
+    ss_state.conn_queue[tail] = client_sock;
+    ss_state.queue_depth++;
+    if (ss_state.queue_depth > ss_state.queue_high_water) {
+        ss_state.queue_high_water = ss_state.queue_depth;
+    }
+    ss_state.accepted_total++;
+    pthread_cond_signal(&ss_state.queue_cond);
+    pthread_mutex_unlock(&ss_state.queue_mutex);
+    return 0;
+}
+
+static Message* busy_reply;  // ERR_SERVER_BUSY with request ID 0, built once
+
+// Closes rejected sockets once their requests are read and thrown away:
+// closing with unread input would reset the connection and could discard
+// the busy reply before the client reads it
+static void* rejecter_main(void* arg) {
+    (void)arg;
+    char scratch[4096];
+    while (1) {
+        pthread_mutex_lock(&ss_state.reject_mutex);
+        while (ss_state.reject_depth == 0) {
+            pthread_cond_wait(&ss_state.reject_cond, &ss_state.reject_mutex);
+        }
+        int sock = ss_state.reject_queue[ss_state.reject_head];
+        ss_state.reject_head = (ss_state.reject_head + 1) % SS_REJECT_QUEUE;
+        ss_state.reject_depth--;
+        pthread_mutex_unlock(&ss_state.reject_mutex);
+
+        // Bounded in total, however slowly the client sends
+        struct timespec deadline, now;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += SS_REJECT_DRAIN_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (1) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long left_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+            if (left_ms <= 0) break;
+            struct pollfd pfd = { sock, POLLIN, 0 };
+            if (poll(&pfd, 1, left_ms) <= 0) break;
+            if (recv(sock, scratch, sizeof(scratch), MSG_DONTWAIT) <= 0) break;
+        }
+        close(sock);
+    }
+    return NULL;
+}
+
+// Tell a client we are saturated instead of letting it wait in the backlog.
+// The accept thread never reads here: the reply goes out at once, without
+// echoing the request ID, and the rejecter thread closes the socket.
+static void reject_connection(int client_sock) {
+    send_message(client_sock, busy_reply);
+    shutdown(client_sock, SHUT_WR);
+
+    pthread_mutex_lock(&ss_state.reject_mutex);
+    if (ss_state.reject_depth < SS_REJECT_QUEUE) {
+        int tail = (ss_state.reject_head + ss_state.reject_depth) % SS_REJECT_QUEUE;
+        ss_state.reject_queue[tail] = client_sock;
+        ss_state.reject_depth++;
+        pthread_cond_signal(&ss_state.reject_cond);
+        client_sock = -1;
+    }
+    pthread_mutex_unlock(&ss_state.reject_mutex);
+    if (client_sock >= 0) {
+        close(client_sock);
+    }
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <port>\n", argv[0]);
+    int worker_count = SS_DEFAULT_WORKERS;
+    int queue_capacity = SS_DEFAULT_QUEUE;
+    int commit_interval_ms = GROUP_COMMIT_DEFAULT_INTERVAL_MS;
+    Durability durability = DURABILITY_NORMAL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:q:i:d:")) != -1) {
+        switch (opt) {
+            case 'w':
+                worker_count = atoi(optarg);
+                break;
+            case 'q':
+                queue_capacity = atoi(optarg);
+                break;
+            case 'i':
+                commit_interval_ms = atoi(optarg);
+                break;
+            case 'd':
+                if (parse_durability(optarg, &durability) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || worker_count <= 0 || queue_capacity <= 0 ||
+        commit_interval_ms <= 0) {
+        usage(argv[0]);
         return 1;
     }
     
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
     if (port <= 1024 || port > 65535) {
         printf("Invalid port number (must be 1025-65535)\n");
         return 1;
@@ -30,6 +284,15 @@ int main(int argc, char* argv[]) {
         log_message("StorageServer", "Failed to initialize");
         return 1;
     }
+    ss_state.worker_count = worker_count;
+    ss_state.queue_capacity = queue_capacity;
+    ss_state.conn_queue = malloc(sizeof(int) * queue_capacity);
+    ss_state.commit_interval_ms = commit_interval_ms;
+    ss_state.durability = durability;
+    if (group_commit_init(&ss_state.commits, ss_state.db, commit_interval_ms, durability) < 0) {
+        log_message("StorageServer", "Failed to start group commit");
+        return 1;
+    }
     
     if (register_with_nameserver() < 0) {
         log_message("StorageServer", "Failed to register with Name Server");
@@ -39,10 +302,7 @@ int main(int argc, char* argv[]) {
     // Register signal handlers for graceful shutdown
     signal(SIGINT, handle_shutdown);
     signal(SIGTERM, handle_shutdown);
-    
-    char log_buf[128];
-    snprintf(log_buf, sizeof(log_buf), "Storage Server listening on port %d", port);
-    log_message("StorageServer", log_buf);
+    signal(SIGPIPE, SIG_IGN);
     
     int server_fd = create_server_socket(port);
     if (server_fd < 0) {
@@ -56,6 +316,38 @@ int main(int argc, char* argv[]) {
     timeout.tv_usec = 0;
     setsockopt(server_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
     
+    for (int i = 0; i < worker_count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, NULL) != 0) {
+            log_message("StorageServer", "Failed to create worker thread");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    
+    busy_reply = malloc(sizeof(Message));
+    pthread_t rejecter_thread;
+    if (!busy_reply || pthread_create(&rejecter_thread, NULL, rejecter_main, NULL) != 0) {
+        log_message("StorageServer", "Failed to create rejecter thread");
+        return 1;
+    }
+    pthread_detach(rejecter_thread);
+    init_message(busy_reply);
+    set_message_error(busy_reply, ERR_SERVER_BUSY, "Storage server busy, retry later");
+    
+    pthread_t heartbeat_thread;
+    if (pthread_create(&heartbeat_thread, NULL, heartbeat_main, NULL) != 0) {
+        log_message("StorageServer", "Failed to create heartbeat thread");
+        return 1;
+    }
+    pthread_detach(heartbeat_thread);
+    
+    char log_buf[128];
+    snprintf(log_buf, sizeof(log_buf), "Storage Server listening on port %d (%d workers, queue %d)",
+            port, worker_count, queue_capacity);
+    log_message("StorageServer", log_buf);
+    
+    time_t last_reject_log = 0;
     while (keep_running) {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
@@ -67,35 +359,45 @@ int main(int argc, char* argv[]) {
             continue;
         }
         
-        // Clear timeout on client socket (inherited from server socket)
-        struct timeval no_timeout;
-        no_timeout.tv_sec = 0;
-        no_timeout.tv_usec = 0;
-        setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof(no_timeout));
-        
-        pthread_t thread;
-        int* sock_ptr = malloc(sizeof(int));
-        *sock_ptr = client_sock;
+        // Replace the accept timeout (inherited from the server socket) with
+        // the idle timeout, so idle connections can't hold the whole pool
+        struct timeval idle_timeout;
+        idle_timeout.tv_sec = SS_IDLE_TIMEOUT_SECONDS;
+        idle_timeout.tv_usec = 0;
+        setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &idle_timeout, sizeof(idle_timeout));
+        set_socket_nodelay(client_sock);
         
-        if (pthread_create(&thread, NULL, handle_client, sock_ptr) != 0) {
-            log_message("StorageServer", "Failed to create thread");
-            free(sock_ptr);
-            close(client_sock);
-            continue;
+        if (enqueue_connection(client_sock) < 0) {
+            reject_connection(client_sock);
+            // At most one rejection report per second while overloaded
+            time_t now = time(NULL);
+            if (now != last_reject_log) {
+                last_reject_log = now;
+                log_pool_stats("Server busy, rejected connection");
+            }
         }
-        pthread_detach(thread);
     }
     
+    log_message("StorageServer", "Shutdown signal received, stopping server...");
+    log_pool_stats("Shutting down");
     close(server_fd);
+    group_commit_shutdown(&ss_state.commits);
+    stmt_cache_finalize(ss_statements, SS_STMT_COUNT);
     sqlite3_close(ss_state.db);
-    pthread_mutex_destroy(&ss_state.mutex);
+    pthread_mutex_destroy(&ss_state.db_mutex);
     return 0;
 }
 
 int init_storage_server(int port) {
     memset(&ss_state, 0, sizeof(ss_state));
     ss_state.port = port;
-    pthread_mutex_init(&ss_state.mutex, NULL);
+    pthread_mutex_init(&ss_state.db_mutex, NULL);
+    pthread_mutex_init(&ss_state.lock_table_mutex, NULL);
+    pthread_mutex_init(&ss_state.queue_mutex, NULL);
+    pthread_cond_init(&ss_state.queue_cond, NULL);
+    pthread_mutex_init(&ss_state.reject_mutex, NULL);
+    pthread_cond_init(&ss_state.reject_cond, NULL);
+    pthread_mutex_init(&ss_state.stats_mutex, NULL);
     
     // Create storage directory
     snprintf(ss_state.data_dir, sizeof(ss_state.data_dir), "%s_%d", SS_DATA_DIR, port);
@@ -108,12 +410,15 @@ int init_storage_server(int port) {
     snprintf(checkpoint_dir, sizeof(checkpoint_dir), "%s/checkpoints", ss_state.data_dir);
     mkdir(undo_dir, 0755);
     mkdir(checkpoint_dir, 0755);
+    ss_state.bytes_stored = count_stored_bytes();
     
     // Initialize database for metadata
     char db_path[MAX_PATH];
     snprintf(db_path, sizeof(db_path), "%s/metadata.db", ss_state.data_dir);
     
-    int rc = sqlite3_open(db_path, &ss_state.db);
+    // The commit thread shares this connection with the workers
+    int rc = sqlite3_open_v2(db_path, &ss_state.db,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, NULL);
     if (rc != SQLITE_OK) {
         log_message("StorageServer", "Failed to open metadata database");
         return -1;
@@ -141,6 +446,10 @@ int init_storage_server(int port) {
     
     sqlite3_exec(ss_state.db, sql, 0, 0, NULL);
     
+    if (stmt_cache_prepare(ss_state.db, ss_statements, SS_STMT_COUNT) < 0) {
+        return -1;
+    }
+    
     log_message("StorageServer", "Storage Server initialized");
     return 0;
 }
@@ -184,12 +493,12 @@ int register_with_nameserver() {
     }
 }
 
-void* handle_client(void* arg) {
-    int client_sock = *(int*)arg;
-    free(arg);
-    
+void handle_client(int client_sock) {
     Message msg;
     while (receive_message(client_sock, &msg) == 0) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        
         char log_buf[512];
         snprintf(log_buf, sizeof(log_buf), "Request: type=%s file=%s", msg.type, msg.filename);
         log_message("StorageServer", log_buf);
@@ -216,24 +525,34 @@ void* handle_client(void* arg) {
             handle_checkpoint_ops(client_sock, &msg);
         } else {
             Message resp;
-            init_message(&resp);
+            init_response(&resp, &msg);
             set_message_error(&resp, ERR_INVALID_PARAM, "Unknown command");
             send_message(client_sock, &resp);
         }
+        
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        unsigned long long us = (end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000;
+        pthread_mutex_lock(&ss_state.stats_mutex);
+        ss_state.requests_total++;
+        ss_state.request_us_total += us;
+        pthread_mutex_unlock(&ss_state.stats_mutex);
     }
     
     close(client_sock);
-    return NULL;
 }
 
-char* get_file_path(const char* filename) {
-    static char path[MAX_PATH];
-    snprintf(path, sizeof(path), "%s/%s", ss_state.data_dir, filename);
-    return path;
+void get_file_path(const char* filename, char* path, size_t size) {
+    snprintf(path, size, "%s/%s", ss_state.data_dir, filename);
 }
 
+// Caller holds the file's lock exclusively
 int save_file_content(const char* filename, const char* content) {
-    char* path = get_file_path(filename);
+    char path[MAX_PATH];
+    get_file_path(filename, path, sizeof(path));
+    
+    struct stat st;
+    long long old_size = stat(path, &st) == 0 ? (long long)st.st_size : 0;
     
     FILE* fp = fopen(path, "w");
     if (!fp) {
@@ -243,8 +562,14 @@ int save_file_content(const char* filename, const char* content) {
     fputs(content, fp);
     fclose(fp);
     
+    int char_count = strlen(content);
+    add_stored_bytes(char_count - old_size);
+    
     // Update metadata
-    char sentences[MAX_SENTENCES][MAX_SENTENCE];
+    char (*sentences)[MAX_SENTENCE] = malloc(MAX_SENTENCES * sizeof(*sentences));
+    if (!sentences) {
+        return -1;
+    }
     int sentence_count = parse_sentences(content, sentences, MAX_SENTENCES);
     
     int word_count = 0;
@@ -252,28 +577,31 @@ int save_file_content(const char* filename, const char* content) {
         char words[MAX_WORDS_PER_SENTENCE][MAX_WORD];
         word_count += parse_words(sentences[i], words, MAX_WORDS_PER_SENTENCE);
     }
+    free(sentences);
     
-    int char_count = strlen(content);
-    
-    sqlite3_stmt* stmt;
-    const char* sql = "INSERT OR REPLACE INTO file_metadata (filename, word_count, char_count, sentence_count, last_modified) "
-                     "VALUES (?, ?, ?, ?, ?);";
+    CachedStmt* cs = &ss_statements[SS_STMT_SAVE_METADATA];
     
-    if (sqlite3_prepare_v2(ss_state.db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    pthread_mutex_lock(&ss_state.db_mutex);
+    group_commit_begin(&ss_state.commits);
+    sqlite3_stmt* stmt = stmt_acquire(cs);
+    if (stmt) {
         sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_STATIC);
         sqlite3_bind_int(stmt, 2, word_count);
         sqlite3_bind_int(stmt, 3, char_count);
         sqlite3_bind_int(stmt, 4, sentence_count);
         sqlite3_bind_int64(stmt, 5, time(NULL));
         sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+        stmt_release(cs);
     }
+    group_commit_end(&ss_state.commits);
+    pthread_mutex_unlock(&ss_state.db_mutex);
     
     return 0;
 }
 
 int load_file_content(const char* filename, char* buffer, size_t max_size) {
-    char* path = get_file_path(filename);
+    char path[MAX_PATH];
+    get_file_path(filename, path, sizeof(path));
     
     FILE* fp = fopen(path, "r");
     if (!fp) {